@@ -0,0 +1,17 @@
+// Correctness checks the benchmark suite runs before it measures anything:
+// a fast path that gives a different answer than the code it replaces is a
+// bug, not a speedup, so the suite stops at the first disagreement.
+
+#ifndef FORO_CLANG_FORMAT_BENCH_CHECK_H_
+#define FORO_CLANG_FORMAT_BENCH_CHECK_H_
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+[[noreturn]] inline auto fail(const std::string &What) -> void {
+    std::fprintf(stderr, "check failed: %s\n", What.c_str());
+    std::abort();
+}
+
+#endif
@@ -0,0 +1,42 @@
+// The files of `bench/corpus` and the helpers the benchmarks share to load
+// them and to scale them up.
+
+#ifndef FORO_CLANG_FORMAT_BENCH_CORPUS_H_
+#define FORO_CLANG_FORMAT_BENCH_CORPUS_H_
+
+#include <fstream>
+#include <iterator>
+#include <string>
+
+namespace corpus {
+
+inline const char *const Files[] = {
+    "sample.c",    "sample.cpp",   "Sample.java",
+    "sample.js",   "sample.proto", "sample.json",
+};
+
+inline auto read_file(const std::string &Path) -> std::string {
+    std::ifstream In(Path, std::ios::binary);
+    return {std::istreambuf_iterator<char>(In),
+            std::istreambuf_iterator<char>()};
+}
+
+// `Code` repeated `Times` times; JSON documents become the elements of an
+// array so that the result still parses.
+inline auto repeat(const std::string &Name, const std::string &Code,
+                   int Times) -> std::string {
+    const bool Json = Name.ends_with(".json");
+    std::string Out = Json && Times > 1 ? "[\n" : "";
+    for (int I = 0; I < Times; ++I) {
+        if (Json && I > 0)
+            Out += ",\n";
+        Out += Code;
+    }
+    if (Json && Times > 1)
+        Out += "]\n";
+    return Out;
+}
+
+} // namespace corpus
+
+#endif
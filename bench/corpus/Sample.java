@@ -0,0 +1,55 @@
+package org.example.inventory;
+
+import java.util.Map;
+import java.util.HashMap;
+import java.util.List;
+import java.util.ArrayList;
+import java.util.Optional;
+import java.util.stream.Collectors;
+
+class Inventory {
+    private final Map<String, Item> items = new HashMap<>();
+  private int revision;
+
+    static final class Item {
+        final String sku; final String name;
+        int quantity;
+        Item(String sku, String name, int quantity) { this.sku = sku; this.name = name; this.quantity = quantity; }
+    }
+
+    public synchronized void add(String sku, String name, int quantity)
+    {
+        Item item = items.get(sku);
+        if (item == null) { items.put(sku, new Item(sku, name, quantity)); }
+        else {
+            item.quantity += quantity;
+        }
+        revision++;
+    }
+
+    public synchronized boolean remove(String sku, int quantity) throws IllegalStateException {
+        Item item = items.get(sku);
+        if (item == null || item.quantity < quantity) return false;
+        item.quantity -= quantity;
+        if (item.quantity == 0) items.remove(sku);
+        revision++;
+        return true;
+    }
+
+    public Optional<Item> find(String sku) { return Optional.ofNullable(items.get(sku)); }
+
+    public List<String> lowStock(int threshold) {
+        return items.values().stream().filter(i -> i.quantity < threshold).map(i -> i.sku + ":" + i.quantity).sorted().collect(Collectors.toList());
+    }
+
+    public int revision() {
+      return revision;
+    }
+
+    @Override
+    public String toString() {
+        StringBuilder sb = new StringBuilder("Inventory{");
+        for (Map.Entry<String, Item> e : items.entrySet()) { sb.append(e.getKey()).append('=').append(e.getValue().quantity).append(", "); }
+        return sb.append("revision=").append(revision).append('}').toString();
+    }
+}
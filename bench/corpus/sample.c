@@ -0,0 +1,76 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "ring.h"
+
+#define RING_MIN_CAPACITY 16
+#define RING_GROW(n) ((n) < RING_MIN_CAPACITY ? RING_MIN_CAPACITY : (n) * 2)
+
+struct ring {
+  unsigned char *data; size_t head;
+    size_t tail;
+  size_t capacity;
+};
+
+static int ring_grow(struct ring *r,size_t need)
+{
+    size_t cap = RING_GROW(r->capacity);
+    while (cap < need) cap = RING_GROW(cap);
+    unsigned char *data = malloc(cap);
+    if(!data) return -1;
+    size_t used = r->tail - r->head;
+    for (size_t i = 0; i < used; i++) data[i] = r->data[(r->head + i) % r->capacity];
+    free(r->data);
+    r->data = data; r->head = 0; r->tail = used; r->capacity = cap;
+    return 0;
+}
+
+struct ring *ring_new(void) {
+  struct ring *r = calloc(1, sizeof *r);
+  if (r == NULL)
+  {
+    return NULL;
+  }
+  return r;
+}
+
+void ring_free(struct ring *r) { if (r) { free(r->data); free(r); } }
+
+int ring_push(struct ring *r, const void *src, size_t len) {
+    const unsigned char *p = src;
+    if (r->tail - r->head + len > r->capacity && ring_grow(r, r->tail - r->head + len) != 0)
+        return -1;
+    for (size_t i = 0; i < len; ++i) {
+        r->data[(r->tail + i) % r->capacity] = p[i];
+    }
+    r->tail += len;
+    return 0;
+}
+
+size_t ring_pop(struct ring *r, void *dst, size_t len)
+{
+    unsigned char *p = dst; size_t n = 0;
+    while (n < len && r->head < r->tail) {
+        p[n++] = r->data[r->head++ % r->capacity];
+    }
+    return n;
+}
+
+static const char *const ring_errors[] = {"ok", "out of memory", "empty", "full",
+    "invalid argument"};
+
+const char *ring_strerror(int code) {
+    switch (code) {
+    case 0: return ring_errors[0];
+    case -1: return ring_errors[1];
+    case -2: return ring_errors[2];
+    default:
+        return ring_errors[4];
+    }
+}
+
+void ring_dump(const struct ring *r, FILE *out) {
+    fprintf(out, "ring %p: head=%zu tail=%zu capacity=%zu\n", (const void *)r, r->head, r->tail, r->capacity);
+    for (size_t i = r->head; i < r->tail; i++) fprintf(out, "%02x%c", r->data[i % r->capacity], (i + 1 - r->head) % 16 ? ' ' : '\n');
+    fputc('\n', out);
+}
@@ -0,0 +1,78 @@
+#include "scheduler.h"
+#include <algorithm>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+namespace sched {
+namespace {
+constexpr int kDefaultPriority=0;
+
+struct Task{
+    std::function<void()> fn;
+    int priority = kDefaultPriority;
+    uint64_t sequence;
+    bool operator<(const Task& other) const { return priority < other.priority || (priority == other.priority && sequence > other.sequence); }
+};
+}  // namespace
+
+class Scheduler::Impl {
+public:
+  explicit Impl(unsigned workers) : stopping_(false) {
+      for (unsigned i = 0; i < workers; ++i) threads_.emplace_back([this] { run(); });
+  }
+
+  ~Impl() {
+    { std::lock_guard<std::mutex> lock(mutex_); stopping_ = true; }
+    cv_.notify_all();
+    for (auto &t : threads_) t.join();
+  }
+
+  void post(std::function<void()> fn, int priority) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queue_.push_back(Task{std::move(fn), priority, next_sequence_++});
+      std::push_heap(queue_.begin(), queue_.end());
+    }
+    cv_.notify_one();
+  }
+
+private:
+  void run() {
+    for (;;) {
+      Task task;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+        if (stopping_ && queue_.empty()) return;
+        std::pop_heap(queue_.begin(), queue_.end());
+        task = std::move(queue_.back());
+        queue_.pop_back();
+      }
+      try { task.fn(); } catch (...) { /* Tasks report their own errors. */ }
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<Task> queue_;
+  std::vector<std::thread> threads_;
+  uint64_t next_sequence_ = 0;
+  bool stopping_;
+};
+
+Scheduler::Scheduler(unsigned workers) : impl_(std::make_unique<Impl>(workers)) {}
+Scheduler::~Scheduler() = default;
+
+void Scheduler::post(std::function<void()> fn, int priority) { impl_->post(std::move(fn), priority); }
+
+template <typename Range, typename F>
+void parallel_for_each(Scheduler &s, Range &&range, F f) {
+    for (auto &&item : range) s.post([&item, f] { f(item); }, kDefaultPriority);
+}
+
+auto make_counter() -> std::function<int()> { int n = 0; return [n]() mutable { return ++n; }; }
+
+}  // namespace sched
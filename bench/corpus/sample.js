@@ -0,0 +1,51 @@
+import {readFile} from 'node:fs/promises';
+import path from 'node:path';
+import { EventEmitter } from 'node:events';
+
+const DEFAULT_OPTIONS = {retries: 3, backoffMs: 250, timeoutMs: 5000,
+  headers: {'user-agent': 'sample/1.0'}};
+
+export class Fetcher extends EventEmitter {
+  constructor(options = {}) {
+    super();
+    this.options = {...DEFAULT_OPTIONS, ...options};
+      this.inflight = new Map();
+  }
+
+  async fetchJson(url) {
+    if (this.inflight.has(url)) return this.inflight.get(url);
+    const promise = this.#withRetries(async () => {
+      const controller = new AbortController();
+      const timer = setTimeout(() => controller.abort(), this.options.timeoutMs);
+      try {
+        const response = await fetch(url, {headers: this.options.headers, signal: controller.signal});
+        if (!response.ok) throw new Error(`HTTP ${response.status} for ${url}`);
+        return await response.json();
+      } finally { clearTimeout(timer); }
+    }).finally(() => this.inflight.delete(url));
+    this.inflight.set(url, promise);
+    return promise;
+  }
+
+  async #withRetries(fn) {
+    let lastError;
+    for (let attempt = 0; attempt <= this.options.retries; attempt++) {
+      try { return await fn(); }
+      catch (err) {
+        lastError = err;
+        this.emit('retry', {attempt, err});
+        await new Promise(resolve => setTimeout(resolve, this.options.backoffMs * 2 ** attempt));
+      }
+    }
+    throw lastError;
+  }
+}
+
+export async function loadConfig(dir) {
+  const file = path.join(dir, 'config.json');
+  const text = await readFile(file, 'utf8');
+  const config = JSON.parse(text);
+  return Object.fromEntries(Object.entries(config).filter(([key, value]) => value !== null && !key.startsWith('_')));
+}
+
+export const summarize = (items) => items.reduce((acc, {kind, size}) => ({...acc, [kind]: (acc[kind] ?? 0) + size}), {});
@@ -0,0 +1,223 @@
+// Compares the compiled `.clang-format-ignore` matcher against checking the
+// patterns one by one with `matchFilePath`. Before anything is measured,
+// `check_file_path_patterns` makes sure the two agree on every pattern and
+// path below, and on every short path over a small alphabet.
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "check.h"
+#include "file_path_patterns.h"
+#include "match_file_path.cpp"
+
+using clang::format::FilePathPatterns;
+
+namespace {
+
+using PatternList = std::vector<std::pair<std::string, bool>>;
+
+// The loop `is_ignored` used to run.
+bool is_ignored_by_loop(const PatternList &Patterns, llvm::StringRef Path) {
+    for (const auto &[Pattern, Negated] : Patterns) {
+        if (clang::format::matchFilePath(Pattern, Path) == !Negated)
+            return true;
+    }
+    return false;
+}
+
+FilePathPatterns compile(const PatternList &Patterns) {
+    FilePathPatterns Set;
+    for (const auto &[Pattern, Negated] : Patterns)
+        Set.add(Pattern, Negated);
+    Set.compile();
+    return Set;
+}
+
+// A typical ignore file at the root of a repository.
+const PatternList &typical_patterns() {
+    static const PatternList Patterns = [] {
+        PatternList List;
+        for (const char *Pattern :
+             {"third_party/*/*", "third_party/*/*/*", "build/*", "out/*/*",
+              "*.pb.h", "*.pb.cc", "src/gen/*/*.h", "src/gen/*/*.cpp",
+              "tools/[a-m]*/*.c", "tests/fixtures/*/*", "vendor/*/*/*/*.h",
+              "docs/*.md", "*.generated.*", "src/legacy/v?/*.cc"}) {
+            List.emplace_back(std::string("/repo/") + Pattern, false);
+        }
+        return List;
+    }();
+    return Patterns;
+}
+
+const std::vector<std::string> &typical_paths() {
+    static const std::vector<std::string> Paths = {
+        "/repo/src/main.cpp",
+        "/repo/src/format/lib.cpp",
+        "/repo/src/format/lib.h",
+        "/repo/src/gen/proto/messages.h",
+        "/repo/src/legacy/v1/old.cc",
+        "/repo/third_party/zlib/deflate.c",
+        "/repo/third_party/llvm/include/llvm/ADT/StringRef.h",
+        "/repo/tools/lint/check.c",
+        "/repo/tools/xform/apply.c",
+        "/repo/api/service.pb.cc",
+        "/repo/api/service.grpc.pb.h",
+        "/repo/tests/unit/format_test.cpp",
+        "/repo/vendor/a/b/c/d.h",
+        "/repo/include/foro/plugin.h",
+    };
+    return Paths;
+}
+
+void BM_TypicalLoop(benchmark::State &State) {
+    const auto &Patterns = typical_patterns();
+    for (auto _ : State) {
+        for (const auto &Path : typical_paths())
+            benchmark::DoNotOptimize(is_ignored_by_loop(Patterns, Path));
+    }
+    State.SetItemsProcessed(State.iterations() * typical_paths().size());
+}
+BENCHMARK(BM_TypicalLoop);
+
+void BM_TypicalCompiled(benchmark::State &State) {
+    const auto Set = compile(typical_patterns());
+    for (auto _ : State) {
+        for (const auto &Path : typical_paths())
+            benchmark::DoNotOptimize(Set.is_ignored(Path));
+    }
+    State.SetItemsProcessed(State.iterations() * typical_paths().size());
+}
+BENCHMARK(BM_TypicalCompiled);
+
+// Many stars against one long path segment that never quite matches: the
+// backtracking matcher retries every split of the segment between the stars
+// before giving up.
+const PatternList &adversarial_patterns() {
+    static const PatternList Patterns = {
+        {"/repo/*a*a*a*a*a*cb", false},
+        {"/repo/*a?a*a?a*a?cb", false},
+        {"/repo/*[ab]*[ab]*[ab]*[ab]*cb", false},
+    };
+    return Patterns;
+}
+
+std::string adversarial_path(int64_t Length) {
+    return "/repo/" + std::string(Length, 'a') + "b";
+}
+
+void BM_AdversarialLoop(benchmark::State &State) {
+    const auto &Patterns = adversarial_patterns();
+    const auto Path = adversarial_path(State.range(0));
+    for (auto _ : State)
+        benchmark::DoNotOptimize(is_ignored_by_loop(Patterns, Path));
+}
+BENCHMARK(BM_AdversarialLoop)->RangeMultiplier(2)->Range(8, 32);
+
+void BM_AdversarialCompiled(benchmark::State &State) {
+    const auto Set = compile(adversarial_patterns());
+    const auto Path = adversarial_path(State.range(0));
+    for (auto _ : State)
+        benchmark::DoNotOptimize(Set.is_ignored(Path));
+}
+BENCHMARK(BM_AdversarialCompiled)->RangeMultiplier(2)->Range(8, 32);
+
+// The corners of `matchFilePath`: runs of stars, a star before a slash or an
+// escape, a lone trailing backslash, and brackets that are ranges, negated,
+// empty, unpaired or span a slash, and so match literally.
+const PatternList &edge_patterns() {
+    static const PatternList Patterns = [] {
+        PatternList List;
+        for (const char *Pattern :
+             {"*", "*/*", "a*b", "*a*", "?b", "a?/*", "**b", "*\\/a",
+              "*\\b", "a\\", "a\\*", "[ab]*", "[!a]*", "[a-b].", "[/]a",
+              "[]a", "[!]", "a[", "*.", ".*/b*", "*/*/*", "a/**"}) {
+            List.emplace_back(std::string("/repo/") + Pattern, false);
+        }
+        return List;
+    }();
+    return Patterns;
+}
+
+// Every path of one to `Length` characters from `Alphabet` below `/repo/`.
+std::vector<std::string> all_paths(const std::string &Alphabet,
+                                   size_t Length) {
+    std::vector<std::string> Paths;
+    std::vector<std::string> Level = {""};
+    for (size_t L = 0; L < Length; ++L) {
+        std::vector<std::string> Next;
+        for (const auto &Tail : Level) {
+            for (char C : Alphabet)
+                Next.push_back(Tail + C);
+        }
+        for (const auto &Tail : Next)
+            Paths.push_back("/repo/" + Tail);
+        Level = std::move(Next);
+    }
+    return Paths;
+}
+
+// `Patterns` with every other one negated, so that both rules get exercised.
+PatternList alternately_negated(const PatternList &Patterns) {
+    PatternList List = Patterns;
+    for (size_t I = 1; I < List.size(); I += 2)
+        List[I].second = true;
+    return List;
+}
+
+void check_set(const PatternList &Patterns,
+               const std::vector<std::string> &Paths) {
+    const auto Set = compile(Patterns);
+    for (const auto &Path : Paths) {
+        const auto Matches = Set.match(Path);
+        for (size_t I = 0; I < Patterns.size(); ++I) {
+            if (Matches[I] !=
+                clang::format::matchFilePath(Patterns[I].first, Path))
+                fail("match of " + Patterns[I].first + " against " + Path);
+        }
+        if (Set.is_ignored(Path) != is_ignored_by_loop(Patterns, Path))
+            fail("is_ignored of " + Path);
+    }
+
+    // `ignores_all_below` may only claim what holds for every path below, so
+    // each path must be ignored if it is claimed for any of its directories.
+    for (const auto &Path : Paths) {
+        for (size_t Slash = Path.find('/', 1); Slash != std::string::npos;
+             Slash = Path.find('/', Slash + 1)) {
+            const auto Dir = Path.substr(0, Slash);
+            if (Set.ignores_all_below(Dir) &&
+                !is_ignored_by_loop(Patterns, Path))
+                fail("ignores_all_below " + Dir + " but not " + Path);
+        }
+    }
+}
+
+} // namespace
+
+// Aborts unless the compiled sets agree with `matchFilePath` pattern by
+// pattern and with the loop they replace.
+void check_file_path_patterns() {
+    std::vector<std::string> Adversarial;
+    for (int64_t Length = 0; Length <= 32; ++Length)
+        Adversarial.push_back(adversarial_path(Length));
+    const auto Short = all_paths("ab/.", 6);
+
+    const PatternList *Sets[] = {&typical_patterns(), &adversarial_patterns(),
+                                 &edge_patterns()};
+    const std::vector<std::string> *PathSets[] = {&typical_paths(),
+                                                  &Adversarial, &Short};
+    for (const auto *Patterns : Sets) {
+        for (const auto *Paths : PathSets) {
+            check_set(*Patterns, *Paths);
+            check_set(alternately_negated(*Patterns), *Paths);
+        }
+    }
+
+    // One pattern at a time as well, so that no pattern hides behind another.
+    for (const auto &Pattern : edge_patterns()) {
+        check_set({Pattern}, Short);
+        check_set({{Pattern.first, true}}, Short);
+    }
+}
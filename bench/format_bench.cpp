@@ -0,0 +1,187 @@
+// Formats a generated translation unit through the library API and counts the
+// heap allocations every call makes. Before anything is measured,
+// `check_chunked_reformat` makes sure formatting in chunks gives the same
+// output as formatting the whole file.
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "check.h"
+#include "clang/Format/Format.h"
+#include "lib.h"
+#include "parallel_format.h"
+#include "replacements.h"
+
+namespace {
+
+std::atomic<uint64_t> Allocations{0};
+
+} // namespace
+
+void *operator new(std::size_t Size) {
+    Allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *Ptr = std::malloc(Size ? Size : 1))
+        return Ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *Ptr) noexcept { std::free(Ptr); }
+void operator delete(void *Ptr, std::size_t) noexcept { std::free(Ptr); }
+
+namespace {
+
+// Badly formatted functions, so that every one of them needs edits.
+std::string sample_source(int64_t Functions) {
+    std::string Code = "#include <vector>\n#include <string>\n\n";
+    for (int64_t I = 0; I < Functions; ++I) {
+        const std::string N = std::to_string(I);
+        Code += "int   function_" + N +
+                "(int a,int b){ std::vector<int> v{a,b};\n"
+                "  if(a>b){return a+b*" +
+                N +
+                ";}\n"
+                "else { for(int i=0;i<b;++i) v.push_back(i); }\n"
+                " return (int)v.size(); }\n\n";
+    }
+    return Code;
+}
+
+// Reports the average number of allocations per iteration since `Before`.
+void count_allocations(benchmark::State &State, uint64_t Before) {
+    State.counters["allocs"] = benchmark::Counter(
+        static_cast<double>(Allocations.load() - Before),
+        benchmark::Counter::kAvgIterations);
+}
+
+void BM_Format(benchmark::State &State) {
+    FormatContext Ctx;
+    const auto Code = sample_source(State.range(0));
+
+    const uint64_t Before = Allocations.load();
+    for (auto _ : State) {
+        auto R = format(Ctx, Code, "bench.cpp", "LLVM");
+        benchmark::DoNotOptimize(R);
+    }
+    count_allocations(State, Before);
+    State.SetBytesProcessed(State.iterations() * Code.size());
+}
+BENCHMARK(BM_Format)->Arg(10)->Arg(100)->Arg(1000);
+
+void BM_FormatInto(benchmark::State &State) {
+    FormatContext Ctx;
+    const auto Code = sample_source(State.range(0));
+    std::string Out;
+    Out.reserve(2 * Code.size());
+
+    const uint64_t Before = Allocations.load();
+    for (auto _ : State) {
+        auto R = format_into(Ctx, Code, "bench.cpp", "LLVM", [&](size_t Size) {
+            Out.resize(Size);
+            return Out.data();
+        });
+        benchmark::DoNotOptimize(R);
+    }
+    count_allocations(State, Before);
+    State.SetBytesProcessed(State.iterations() * Code.size());
+}
+BENCHMARK(BM_FormatInto)->Arg(10)->Arg(100)->Arg(1000);
+
+// An editor formatting the few lines just typed.
+void BM_FormatLines(benchmark::State &State) {
+    FormatContext Ctx;
+    const auto Code = sample_source(State.range(0));
+    const std::vector<unsigned> Lines = {10, 14};
+
+    const uint64_t Before = Allocations.load();
+    for (auto _ : State) {
+        auto R = format_line(Ctx, Code, "bench.cpp", "LLVM", Lines);
+        benchmark::DoNotOptimize(R);
+    }
+    count_allocations(State, Before);
+}
+BENCHMARK(BM_FormatLines)->Arg(100)->Arg(1000);
+
+using clang::format::FormatStyle;
+
+// Groups of declarations with trailing comments, so that alignment has
+// something to line up across the blank lines between them.
+std::string declaration_source(int64_t Groups) {
+    std::string Code;
+    for (int64_t I = 0; I < Groups; ++I) {
+        const std::string N = std::to_string(I);
+        Code += "int   short_" + N + " = 1;   // one\n"
+                "unsigned long long   much_longer_name_" + N +
+                " =   2; // two\n\n";
+    }
+    return Code;
+}
+
+// Styles to check chunked formatting in, with those whose rules look across
+// declarations, and so across the seams between chunks, last.
+std::vector<std::pair<std::string, FormatStyle>> chunk_styles() {
+    FormatStyle Aligned = clang::format::getLLVMStyle();
+    Aligned.AlignConsecutiveAssignments.Enabled = true;
+    Aligned.AlignConsecutiveAssignments.AcrossEmptyLines = true;
+    Aligned.AlignConsecutiveDeclarations.Enabled = true;
+    Aligned.AlignConsecutiveDeclarations.AcrossEmptyLines = true;
+    Aligned.AlignTrailingComments.OverEmptyLines = 2;
+
+    FormatStyle Separated = clang::format::getLLVMStyle();
+    Separated.MaxEmptyLinesToKeep = 0;
+    Separated.SeparateDefinitionBlocks = FormatStyle::SDS_Always;
+
+    return {{"LLVM", clang::format::getLLVMStyle()},
+            {"Mozilla", clang::format::getMozillaStyle()},
+            {"WebKit", clang::format::getWebKitStyle()},
+            {"GNU", clang::format::getGNUStyle()},
+            {"aligned", Aligned},
+            {"separated", Separated}};
+}
+
+} // namespace
+
+// Aborts unless every chunked `reformat` of the samples, where it doesn't
+// give up, formats them exactly like `reformat` of the whole file, and unless
+// the library does the same with chunked formatting turned on.
+void check_chunked_reformat() {
+    using clang::format::apply_replacements;
+
+    const std::pair<std::string, std::string> Sources[] = {
+        {"functions", sample_source(500)},
+        {"declarations", declaration_source(1000)},
+    };
+    bool Chunked = false;
+    for (const auto &[StyleName, Style] : chunk_styles()) {
+        for (const auto &[SourceName, Code] : Sources) {
+            const auto Whole = apply_replacements(
+                Code, clang::format::reformat(
+                          Style, Code, {clang::tooling::Range(0, Code.size())},
+                          "bench.cpp"));
+            const auto Chunks =
+                clang::format::reformat_in_chunks(Style, Code, "bench.cpp", 4);
+            if (!Chunks)
+                continue;
+            Chunked = true;
+            if (apply_replacements(Code, *Chunks) != Whole) {
+                fail("chunked reformat of the " + SourceName +
+                     " sample in " + StyleName + " style");
+            }
+        }
+    }
+    if (!Chunked)
+        fail("reformat_in_chunks gave up on every sample");
+
+    const auto Code = sample_source(500);
+    FormatContext WholeCtx, ChunkedCtx;
+    set_parallel_format(ChunkedCtx, 1, 4);
+    const auto Expected = format(WholeCtx, Code, "bench.cpp", "LLVM");
+    const auto Actual = format(ChunkedCtx, Code, "bench.cpp", "LLVM");
+    if (Expected.error || Actual.error || Expected.content != Actual.content)
+        fail("format with chunked formatting turned on");
+}
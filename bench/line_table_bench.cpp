@@ -0,0 +1,115 @@
+// Indexes the lines of a generated source file with `LineTable`, the way every
+// ranged request does. Before anything is measured, `check_line_table` makes
+// sure the vectorized scan and the lookups agree with a byte-by-byte
+// reference on buffers of mixed line endings.
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "line_table.h"
+
+using clang::format::LineTable;
+
+namespace {
+
+std::string sample_lines(int64_t Lines) {
+    std::string Code;
+    for (int64_t I = 0; I < Lines; ++I) {
+        Code += "    int value_" + std::to_string(I) + " = compute(" +
+                std::to_string(I % 97) + ");\n";
+    }
+    return Code;
+}
+
+void BM_LineTableReset(benchmark::State &State) {
+    const auto Code = sample_lines(State.range(0));
+    LineTable Table;
+    for (auto _ : State) {
+        Table.reset(Code);
+        benchmark::DoNotOptimize(Table.lines());
+    }
+    State.SetBytesProcessed(State.iterations() * Code.size());
+}
+BENCHMARK(BM_LineTableReset)->Arg(100)->Arg(10000);
+
+// Line starts found one byte at a time: a line ends after a `\n`, after a
+// `\r` that isn't followed by a `\n`, and after a `\r\n` as a whole.
+std::vector<unsigned> reference_starts(const std::string &Code) {
+    std::vector<unsigned> Starts = {0};
+    for (size_t I = 0; I < Code.size(); ++I) {
+        if (Code[I] == '\n' ||
+            (Code[I] == '\r' && (I + 1 == Code.size() || Code[I + 1] != '\n')))
+            Starts.push_back(I + 1);
+    }
+    return Starts;
+}
+
+// `SourceManager::translateLineCol`: a line past the end maps to the last
+// byte, and a column past the end of its line to the line break, or to the
+// last byte of an unterminated last line.
+unsigned reference_offset(const std::string &Code,
+                          const std::vector<unsigned> &Starts, unsigned Line,
+                          unsigned Col) {
+    if (Line > Starts.size())
+        return Code.empty() ? 0 : Code.size() - 1;
+    const unsigned Pos = Starts[Line - 1];
+    if (Pos == Code.size())
+        return Pos;
+    const size_t Break = Code.find_first_of("\r\n", Pos);
+    const unsigned End =
+        std::min<size_t>(Break == std::string::npos ? Code.size() : Break,
+                         Code.size() - 1);
+    return std::min(Pos + Col - 1, End);
+}
+
+void check_buffer(LineTable &Table, const std::string &Code) {
+    const auto Starts = reference_starts(Code);
+    Table.reset(Code);
+    if (Table.lines() != Starts.size())
+        fail("line count of a buffer of " + std::to_string(Code.size()) +
+             " bytes");
+    for (unsigned Line = 1; Line <= Starts.size() + 2; ++Line) {
+        for (unsigned Col = 1; Col <= Code.size() + 2; ++Col) {
+            if (Table.offset(Line, Col) !=
+                reference_offset(Code, Starts, Line, Col))
+                fail("offset of " + std::to_string(Line) + ":" +
+                     std::to_string(Col) + " in a buffer of " +
+                     std::to_string(Code.size()) + " bytes");
+        }
+    }
+}
+
+} // namespace
+
+// Aborts unless `LineTable` agrees with the reference on every line and column
+// of buffers that put breaks, and `\r\n` pairs in particular, on both sides
+// of the 16-byte blocks of the scan.
+void check_line_table() {
+    LineTable Table;
+    check_buffer(Table, "");
+
+    std::mt19937 Random(5);
+    const char Alphabet[] = {'a', 'a', '\n', '\r'};
+    for (size_t Size = 1; Size <= 80; ++Size) {
+        for (int Round = 0; Round < 8; ++Round) {
+            std::string Code(Size, 'a');
+            for (auto &C : Code)
+                C = Alphabet[Random() % sizeof(Alphabet)];
+            check_buffer(Table, Code);
+        }
+    }
+
+    // A `\r\n` split by every block boundary up to the fourth.
+    for (size_t At = 1; At < 64; ++At) {
+        std::string Code(80, 'a');
+        Code[At - 1] = '\r';
+        Code[At] = '\n';
+        check_buffer(Table, Code);
+    }
+}
@@ -0,0 +1,47 @@
+// Entry point of the benchmark suite. It first checks that the fast paths
+// under measurement agree with the code they replace and aborts if not.
+// Besides the benchmarks registered statically, it runs the corpus
+// benchmarks of `plugin_bench.cpp` and `ring_bench.cpp` and records the
+// formatter version in the context of every report, so that JSON reports
+// (`--benchmark_out=<file> --benchmark_out_format=json`) can be compared
+// across builds.
+
+#include <benchmark/benchmark.h>
+
+#include <cstdlib>
+#include <string>
+
+#include "lib.h"
+
+void check_chunked_reformat();
+void check_file_path_patterns();
+void check_line_table();
+void check_transports(const std::string &Dir);
+
+void register_plugin_benchmarks(const std::string &Dir);
+void register_ring_benchmarks(const std::string &Dir);
+
+int main(int argc, char **argv) {
+    // Measure the formatter rather than the result cache, unless asked to.
+    setenv("FORO_CLANG_FORMAT_CACHE_SIZE", "0", /*overwrite=*/0);
+
+    check_chunked_reformat();
+    check_file_path_patterns();
+    check_line_table();
+
+    const char *Corpus = std::getenv("FORO_CLANG_FORMAT_CORPUS_DIR");
+    const std::string Dir = Corpus ? Corpus : FORO_CLANG_FORMAT_CORPUS_DIR;
+    check_transports(Dir);
+
+    register_plugin_benchmarks(Dir);
+    register_ring_benchmarks(Dir);
+
+    benchmark::AddCustomContext("formatter_version", version());
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,169 @@
+// Training run for profile-guided builds: loads the plugin and formats every
+// source file under a directory through `foro_main`, the way a host does, a
+// few times over. Run against an instrumented plugin it leaves the raw
+// profiles behind; see `pgo-build.sh`.
+//
+//   foro-clang-format-train <plugin> <corpus-dir> [passes]
+//
+// Every pass sends each file once as a whole-file format request and once as
+// a check request. Disable the result cache (FORO_CLANG_FORMAT_CACHE_SIZE=0)
+// so that later passes format again instead of hitting it.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <dlfcn.h>
+
+namespace {
+
+namespace fs = std::filesystem;
+
+using ForoMain = uint64_t (*)(uint64_t, uint64_t);
+using ForoFree = void (*)(uint64_t, uint64_t, uint64_t);
+
+// Extensions clang-format picks a language for.
+const char *const Extensions[] = {
+    ".c",   ".cc",  ".cpp",  ".cxx",  ".c++",  ".h",     ".hh",
+    ".hpp", ".hxx", ".inc",  ".m",    ".mm",   ".java",  ".js",
+    ".mjs", ".cjs", ".ts",   ".json", ".proto", ".cs",   ".td",
+    ".v",   ".sv",  ".txtpb", ".textproto",
+};
+
+bool is_source(const fs::path &Path) {
+    const std::string Extension = Path.extension().string();
+    for (const char *E : Extensions) {
+        if (Extension == E)
+            return true;
+    }
+    return false;
+}
+
+void append_json_string(std::string &Out, const std::string &Text) {
+    Out += '"';
+    for (const unsigned char C : Text) {
+        switch (C) {
+        case '"':
+            Out += "\\\"";
+            break;
+        case '\\':
+            Out += "\\\\";
+            break;
+        case '\n':
+            Out += "\\n";
+            break;
+        case '\t':
+            Out += "\\t";
+            break;
+        default:
+            if (C < 0x20) {
+                char Escape[8];
+                std::snprintf(Escape, sizeof(Escape), "\\u%04x", C);
+                Out += Escape;
+            } else {
+                Out += static_cast<char>(C);
+            }
+        }
+    }
+    Out += '"';
+}
+
+std::string request(const std::string &Path, const std::string &Code,
+                    bool Check) {
+    std::string Out = "{\"os-target\":";
+    append_json_string(Out, Path);
+    Out += ",\"target-content\":";
+    append_json_string(Out, Code);
+    if (Check)
+        Out += ",\"check\":true";
+    return Out + "}";
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    if (argc < 3 || argc > 4) {
+        std::fprintf(stderr, "usage: %s <plugin> <corpus-dir> [passes]\n",
+                     argv[0]);
+        return 2;
+    }
+    const int Passes = argc == 4 ? std::atoi(argv[3]) : 3;
+
+    void *Handle = dlopen(argv[1], RTLD_NOW | RTLD_LOCAL);
+    if (!Handle) {
+        std::fprintf(stderr, "dlopen: %s\n", dlerror());
+        return 1;
+    }
+    auto Main = reinterpret_cast<ForoMain>(dlsym(Handle, "foro_main"));
+    auto Free = reinterpret_cast<ForoFree>(dlsym(Handle, "foro_free"));
+    if (!Main || !Free) {
+        std::fprintf(stderr, "missing foro_main or foro_free\n");
+        return 1;
+    }
+
+    // Prepare every request up front, so that the profile is the plugin's.
+    std::vector<std::string> Requests;
+    uint64_t Bytes = 0;
+    std::error_code Error;
+    for (fs::recursive_directory_iterator
+             It(argv[2], fs::directory_options::skip_permission_denied, Error),
+         End;
+         It != End; It.increment(Error)) {
+        if (Error)
+            break;
+        if (!It->is_regular_file() || !is_source(It->path()))
+            continue;
+
+        std::ifstream In(It->path(), std::ios::binary);
+        const std::string Code{std::istreambuf_iterator<char>(In),
+                               std::istreambuf_iterator<char>()};
+        const std::string Path = fs::absolute(It->path()).string();
+        Requests.push_back(request(Path, Code, /*Check=*/false));
+        Requests.push_back(request(Path, Code, /*Check=*/true));
+        Bytes += Code.size();
+    }
+    if (Error) {
+        std::fprintf(stderr, "%s: %s\n", argv[2], Error.message().c_str());
+        return 1;
+    }
+    if (Requests.empty()) {
+        std::fprintf(stderr, "no source files under %s\n", argv[2]);
+        return 1;
+    }
+
+    unsigned Failures = 0;
+    const auto Start = std::chrono::steady_clock::now();
+    for (int Pass = 0; Pass < Passes; ++Pass) {
+        for (const std::string &R : Requests) {
+            const uint64_t Result =
+                Main(reinterpret_cast<uint64_t>(R.data()), R.size());
+            uint64_t Size;
+            std::memcpy(&Size, reinterpret_cast<const void *>(Result), 8);
+            const std::string_view Reply(
+                reinterpret_cast<const char *>(Result) + 8, Size);
+            if (Reply.find("\"format-status\":\"error\"") !=
+                    std::string_view::npos ||
+                Reply.find("plugin-panic") != std::string_view::npos) {
+                ++Failures;
+            }
+            Free(Result, 8 + Size, 8);
+        }
+    }
+    const double Seconds = std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - Start)
+                               .count();
+
+    std::fprintf(stderr,
+                 "%zu files, %llu bytes, %d passes in %.2f s, %u failures\n",
+                 Requests.size() / 2, static_cast<unsigned long long>(Bytes),
+                 Passes, Seconds, Failures);
+    return 0;
+}
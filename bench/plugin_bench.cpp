@@ -0,0 +1,227 @@
+// Runs the files of `bench/corpus` through `foro_main` end to end and through
+// each stage of it on its own, so that a change to one stage shows up against
+// the total. Every file is measured as is and repeated to 8 and 64 times its
+// size.
+//
+// Benchmarks are named `<Stage>/<file>/x<repeats>`. Each one also reports the
+// peak resident set size of the process so far. The stages:
+//
+//   ForoMain      request bytes in, response bytes out, as the host sees it,
+//                 on one and on four threads
+//   JsonDecode    parsing the request
+//   IsIgnored     matching the target against the ignore files
+//   GetStyle      finding and parsing `.clang-format`, without the cache
+//   SortIncludes  `sortIncludes` over the whole file
+//   Reformat      `reformat` over the whole file
+//   Apply         splicing the replacements of `Reformat` into the file
+//   Encode        serialising the response
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <cstring>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "clang/Format/Format.h"
+#include "corpus.h"
+#include "lib.h"
+#include "replacements.h"
+
+extern "C" {
+uint64_t foro_malloc(uint64_t size, uint64_t alignment);
+uint64_t foro_main(uint64_t ptr, uint64_t len);
+void foro_free(uint64_t ptr, uint64_t size, uint64_t alignment);
+}
+
+namespace {
+
+using clang::format::FormatStyle;
+using clang::tooling::Range;
+using clang::tooling::Replacements;
+
+struct Sample {
+    std::string Name; // File name, also the benchmark label.
+    std::string Path; // Where the request says the file is.
+    std::string Code;
+};
+
+const int Repeats[] = {1, 8, 64};
+
+auto request_for(const Sample &S) -> std::string {
+    return nlohmann::json{{"os-target", S.Path}, {"target-content", S.Code}}
+        .dump();
+}
+
+auto style_for(const Sample &S) -> FormatStyle {
+    auto Style = clang::format::getStyle("file", S.Path, "LLVM", S.Code);
+    if (!Style) {
+        llvm::consumeError(Style.takeError());
+        return clang::format::getLLVMStyle();
+    }
+    return *Style;
+}
+
+// The code `reformat` sees: JSON goes through the JavaScript formatter behind
+// an assignment, as `format` does it.
+auto reformat_input(const FormatStyle &Style, const std::string &Code)
+    -> std::string {
+    return Style.isJson() ? "x = " + Code : Code;
+}
+
+auto peak_rss() -> double {
+    rusage Usage;
+    getrusage(RUSAGE_SELF, &Usage);
+#if defined(__APPLE__)
+    return static_cast<double>(Usage.ru_maxrss);
+#else
+    return static_cast<double>(Usage.ru_maxrss) * 1024;
+#endif
+}
+
+void set_bytes(benchmark::State &State, const Sample &S) {
+    State.SetBytesProcessed(State.iterations() * S.Code.size());
+}
+
+// The request goes through `foro_malloc` like a host's does.
+void bm_foro_main(benchmark::State &State, const Sample &S) {
+    const std::string Request = request_for(S);
+    for (auto _ : State) {
+        const uint64_t Input = foro_malloc(Request.size(), 1);
+        std::memcpy(reinterpret_cast<void *>(Input), Request.data(),
+                    Request.size());
+        const uint64_t Result = foro_main(Input, Request.size());
+        foro_free(Input, Request.size(), 1);
+
+        uint64_t Size;
+        std::memcpy(&Size, reinterpret_cast<const void *>(Result), 8);
+        foro_free(Result, 8 + Size, 8);
+    }
+    set_bytes(State, S);
+}
+
+void bm_json_decode(benchmark::State &State, const Sample &S) {
+    const std::string Request = request_for(S);
+    for (auto _ : State) {
+        auto Json = nlohmann::json::parse(Request);
+        benchmark::DoNotOptimize(Json);
+    }
+    set_bytes(State, S);
+}
+
+void bm_is_ignored(benchmark::State &State, const Sample &S) {
+    FormatContext Ctx;
+    for (auto _ : State) {
+        bool Ignored = is_ignored(Ctx, S.Path);
+        benchmark::DoNotOptimize(Ignored);
+    }
+}
+
+void bm_get_style(benchmark::State &State, const Sample &S) {
+    for (auto _ : State) {
+        auto Style = clang::format::getStyle("file", S.Path, "LLVM", S.Code);
+        if (!Style)
+            llvm::consumeError(Style.takeError());
+        benchmark::DoNotOptimize(Style);
+    }
+}
+
+void bm_sort_includes(benchmark::State &State, const Sample &S) {
+    const FormatStyle Style = style_for(S);
+    const std::vector<Range> Ranges{Range(0, S.Code.size())};
+    for (auto _ : State) {
+        auto Replaces =
+            clang::format::sortIncludes(Style, S.Code, Ranges, S.Path);
+        benchmark::DoNotOptimize(Replaces);
+    }
+    set_bytes(State, S);
+}
+
+void bm_reformat(benchmark::State &State, const Sample &S) {
+    const FormatStyle Style = style_for(S);
+    const std::string Code = reformat_input(Style, S.Code);
+    const std::vector<Range> Ranges{Range(0, Code.size())};
+    for (auto _ : State) {
+        auto Replaces = clang::format::reformat(Style, Code, Ranges, S.Path);
+        benchmark::DoNotOptimize(Replaces);
+    }
+    set_bytes(State, S);
+}
+
+void bm_apply(benchmark::State &State, const Sample &S) {
+    const FormatStyle Style = style_for(S);
+    const std::string Code = reformat_input(Style, S.Code);
+    const Replacements Replaces = clang::format::reformat(
+        Style, Code, {Range(0, Code.size())}, S.Path);
+    State.counters["replacements"] = static_cast<double>(Replaces.size());
+    for (auto _ : State) {
+        auto Formatted = clang::format::apply_replacements(Code, Replaces);
+        benchmark::DoNotOptimize(Formatted);
+    }
+    set_bytes(State, S);
+}
+
+void bm_encode(benchmark::State &State, const Sample &S) {
+    FormatContext Ctx;
+    set_result_cache(Ctx, 0, "");
+    const Result Formatted = format(Ctx, S.Code, S.Path, "file");
+    for (auto _ : State) {
+        nlohmann::json Response{{"format-status", "success"},
+                                {"formatted-content", Formatted.content}};
+        auto Bytes = Response.dump();
+        benchmark::DoNotOptimize(Bytes);
+    }
+    set_bytes(State, S);
+}
+
+} // namespace
+
+// Registers the corpus benchmarks; they read the corpus from `Dir`.
+void register_plugin_benchmarks(const std::string &Dir) {
+    using Stage = void (*)(benchmark::State &, const Sample &);
+    struct {
+        const char *Name;
+        Stage Run;
+        bool Scaled; // Whether the input size matters.
+    } const Stages[] = {
+        {"ForoMain", bm_foro_main, true},
+        {"JsonDecode", bm_json_decode, true},
+        {"IsIgnored", bm_is_ignored, false},
+        {"GetStyle", bm_get_style, false},
+        {"SortIncludes", bm_sort_includes, true},
+        {"Reformat", bm_reformat, true},
+        {"Apply", bm_apply, true},
+        {"Encode", bm_encode, true},
+    };
+
+    for (const char *File : corpus::Files) {
+        const std::string Path = Dir + "/" + File;
+        const std::string Code = corpus::read_file(Path);
+        if (Code.empty())
+            continue;
+
+        for (const int Times : Repeats) {
+            const Sample S{File, Path, corpus::repeat(File, Code, Times)};
+            for (const auto &Stage : Stages) {
+                if (!Stage.Scaled && Times > 1)
+                    continue;
+                const std::string Name = std::string(Stage.Name) + "/" +
+                                         File + "/x" + std::to_string(Times);
+                auto *B = benchmark::RegisterBenchmark(
+                    Name, [Run = Stage.Run, S](benchmark::State &State) {
+                        Run(State, S);
+                        if (State.thread_index() == 0) {
+                            State.counters["peak_rss"] = benchmark::Counter(
+                                peak_rss(), benchmark::Counter::kDefaults,
+                                benchmark::Counter::kIs1024);
+                        }
+                    });
+                if (Stage.Run == bm_foro_main)
+                    B->Threads(1)->Threads(4);
+            }
+        }
+    }
+}
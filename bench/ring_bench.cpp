@@ -0,0 +1,381 @@
+// Messages per second through the request ring of `foro_ring_open` and
+// through the jobs of `foro_submit` against one `foro_main` call per file, for
+// every file of `bench/corpus` as is (small) and repeated 64 times (large).
+// All send binary-protocol format requests, in batches of `Batch` messages
+// per iteration.
+//
+// Benchmarks are named `<Transport>/<file>/x<repeats>`:
+//
+//   CallPerFile   `foro_malloc`, `foro_main`, `foro_free` per message, on one
+//                 and on four host threads
+//   Ring          one host thread keeping a ring of `Batch` slots full, served
+//                 by one and by four workers (`/workers:N`)
+//   Submit        one host thread submitting `Batch` jobs, then waiting for
+//                 each
+//
+// Before anything is measured, `check_transports` makes sure every request
+// sent through a ring comes back once, under its own tag, with the result
+// `foro_main` gives it, and that jobs do the same, cancelled and superseded
+// ones included.
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "binary_protocol.h"
+#include "check.h"
+#include "corpus.h"
+
+extern "C" {
+uint64_t foro_malloc(uint64_t size, uint64_t alignment);
+uint64_t foro_main(uint64_t ptr, uint64_t len);
+void foro_free(uint64_t ptr, uint64_t size, uint64_t alignment);
+
+uint64_t foro_submit(uint64_t ptr, uint64_t len, uint64_t key);
+uint64_t foro_poll(uint64_t ticket);
+uint64_t foro_wait(uint64_t ticket, uint64_t timeout_ms);
+uint64_t foro_cancel(uint64_t ticket);
+
+uint64_t foro_ring_size(uint64_t slots, uint64_t request_capacity,
+                        uint64_t result_capacity);
+uint64_t foro_ring_open(uint64_t ptr, uint64_t size, uint64_t slots,
+                        uint64_t request_capacity, uint64_t result_capacity,
+                        uint64_t threads);
+void foro_ring_close(uint64_t ring);
+uint64_t foro_ring_acquire(uint64_t ring);
+uint64_t foro_ring_request(uint64_t ring, uint64_t slot);
+void foro_ring_submit(uint64_t ring, uint64_t slot, uint64_t len,
+                      uint64_t tag);
+uint64_t foro_ring_take(uint64_t ring, uint64_t wait);
+uint64_t foro_ring_result(uint64_t ring, uint64_t slot);
+uint64_t foro_ring_tag(uint64_t ring, uint64_t slot);
+void foro_ring_release(uint64_t ring, uint64_t slot);
+}
+
+namespace {
+
+constexpr int Batch = 64;
+
+const int Repeats[] = {1, 64};
+
+void append_le(std::string &Out, uint64_t Value, int Bytes) {
+    for (int I = 0; I < Bytes; ++I)
+        Out += static_cast<char>(Value >> (8 * I));
+}
+
+// A binary-protocol `Format` request for `Code` at `Path`.
+auto format_request(const std::string &Path, const std::string &Code)
+    -> std::string {
+    std::string Out(binary_protocol::magic, sizeof(binary_protocol::magic));
+    Out += static_cast<char>(binary_protocol::version);
+    Out += static_cast<char>(binary_protocol::Mode::Format);
+    append_le(Out, 0, 2);
+    append_le(Out, Path.size(), 4);
+    Out += Path;
+    append_le(Out, Code.size(), 8);
+    return Out + Code;
+}
+
+auto result_size(uint64_t Result) -> uint64_t {
+    uint64_t Size;
+    std::memcpy(&Size, reinterpret_cast<const void *>(Result), 8);
+    return Size;
+}
+
+void bm_call_per_file(benchmark::State &State, const std::string &Request) {
+    for (auto _ : State) {
+        for (int I = 0; I < Batch; ++I) {
+            const uint64_t Input = foro_malloc(Request.size(), 1);
+            std::memcpy(reinterpret_cast<void *>(Input), Request.data(),
+                        Request.size());
+            const uint64_t Result = foro_main(Input, Request.size());
+            foro_free(Input, Request.size(), 1);
+            foro_free(Result, 8 + result_size(Result), 8);
+        }
+    }
+    State.SetItemsProcessed(State.iterations() * Batch);
+}
+
+void bm_ring(benchmark::State &State, const std::string &Request,
+             size_t CodeSize) {
+    // Room for results somewhat larger than the input, as formatting can add
+    // a little; larger ones spill.
+    const uint64_t ResultCapacity = CodeSize + CodeSize / 4 + 4096;
+    const uint64_t Size =
+        foro_ring_size(Batch, Request.size(), ResultCapacity);
+    void *Memory = std::aligned_alloc(64, (Size + 63) / 64 * 64);
+    const uint64_t Ring =
+        foro_ring_open(reinterpret_cast<uint64_t>(Memory), Size, Batch,
+                       Request.size(), ResultCapacity, State.range(0));
+    if (!Ring) {
+        std::free(Memory);
+        State.SkipWithError("foro_ring_open failed");
+        return;
+    }
+
+    uint64_t Spilled = 0;
+    for (auto _ : State) {
+        int Submitted = 0;
+        int Taken = 0;
+        while (Taken < Batch) {
+            if (Submitted < Batch) {
+                const uint64_t Slot = foro_ring_acquire(Ring);
+                if (Slot != UINT64_MAX) {
+                    std::memcpy(reinterpret_cast<void *>(
+                                    foro_ring_request(Ring, Slot)),
+                                Request.data(), Request.size());
+                    foro_ring_submit(Ring, Slot, Request.size(), Submitted);
+                    ++Submitted;
+                    continue;
+                }
+            }
+            const uint64_t Slot = foro_ring_take(Ring, 1);
+            if (result_size(foro_ring_result(Ring, Slot)) > ResultCapacity)
+                ++Spilled;
+            foro_ring_release(Ring, Slot);
+            ++Taken;
+        }
+    }
+    State.SetItemsProcessed(State.iterations() * Batch);
+    State.counters["spilled"] = static_cast<double>(Spilled);
+
+    foro_ring_close(Ring);
+    std::free(Memory);
+}
+
+void bm_submit(benchmark::State &State, const std::string &Request) {
+    std::vector<uint64_t> Tickets(Batch);
+    for (auto _ : State) {
+        for (auto &Ticket : Tickets) {
+            Ticket = foro_submit(reinterpret_cast<uint64_t>(Request.data()),
+                                 Request.size(), 0);
+        }
+        for (const uint64_t Ticket : Tickets) {
+            const uint64_t Result = foro_wait(Ticket, UINT64_MAX);
+            foro_free(Result, 8 + result_size(Result), 8);
+        }
+    }
+    State.SetItemsProcessed(State.iterations() * Batch);
+}
+
+// The payload of a result in the form `foro_main` returns it.
+auto result_bytes(uint64_t Result) -> std::string {
+    return {reinterpret_cast<const char *>(Result) + 8,
+            static_cast<size_t>(result_size(Result))};
+}
+
+auto call_foro_main(const std::string &Request) -> std::string {
+    const uint64_t Input = foro_malloc(Request.size(), 1);
+    std::memcpy(reinterpret_cast<void *>(Input), Request.data(),
+                Request.size());
+    const uint64_t Result = foro_main(Input, Request.size());
+    foro_free(Input, Request.size(), 1);
+    std::string Bytes = result_bytes(Result);
+    foro_free(Result, 8 + Bytes.size(), 8);
+    return Bytes;
+}
+
+// Sends `Requests` through a ring of a few slots from `Hosts` host threads at
+// once, each submitting its share and taking whatever is done, and checks
+// every result against `Expected`.
+void check_round_trip(const std::vector<std::string> &Requests,
+                      const std::vector<std::string> &Expected,
+                      uint64_t ResultCapacity, unsigned Hosts,
+                      uint64_t Workers) {
+    constexpr uint64_t Slots = 8;
+    uint64_t RequestCapacity = 0;
+    for (const auto &Request : Requests)
+        RequestCapacity = std::max<uint64_t>(RequestCapacity, Request.size());
+
+    const uint64_t Size =
+        foro_ring_size(Slots, RequestCapacity, ResultCapacity);
+    void *Memory = std::aligned_alloc(64, (Size + 63) / 64 * 64);
+    const uint64_t Ring =
+        foro_ring_open(reinterpret_cast<uint64_t>(Memory), Size, Slots,
+                       RequestCapacity, ResultCapacity, Workers);
+    if (!Ring)
+        fail("foro_ring_open");
+
+    const size_t Count = Requests.size();
+    std::vector<std::atomic<int>> Seen(Count);
+    std::atomic<size_t> Taken{0};
+    std::vector<std::thread> Threads;
+    for (unsigned Host = 0; Host < Hosts; ++Host) {
+        Threads.emplace_back([&, Host] {
+            size_t Mine = Host;
+            while (Taken.load() < Count) {
+                if (Mine < Count) {
+                    const uint64_t Slot = foro_ring_acquire(Ring);
+                    if (Slot != UINT64_MAX) {
+                        const auto &Request = Requests[Mine];
+                        std::memcpy(reinterpret_cast<void *>(
+                                        foro_ring_request(Ring, Slot)),
+                                    Request.data(), Request.size());
+                        foro_ring_submit(Ring, Slot, Request.size(), Mine);
+                        Mine += Hosts;
+                        continue;
+                    }
+                }
+                const uint64_t Slot = foro_ring_take(Ring, 0);
+                if (Slot == UINT64_MAX) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                const uint64_t Tag = foro_ring_tag(Ring, Slot);
+                if (Tag >= Count || Seen[Tag].fetch_add(1) != 0)
+                    fail("ring tag " + std::to_string(Tag) + " taken twice");
+                if (result_bytes(foro_ring_result(Ring, Slot)) != Expected[Tag])
+                    fail("ring result for tag " + std::to_string(Tag));
+                foro_ring_release(Ring, Slot);
+                Taken.fetch_add(1);
+            }
+        });
+    }
+    for (auto &Thread : Threads)
+        Thread.join();
+
+    foro_ring_close(Ring);
+    std::free(Memory);
+}
+
+// The payload of a result from `foro_poll` or `foro_wait`, which is freed.
+auto take_result(uint64_t Result) -> std::string {
+    std::string Bytes = result_bytes(Result);
+    foro_free(Result, 8 + Bytes.size(), 8);
+    return Bytes;
+}
+
+// The reply to an unknown or cancelled ticket.
+auto is_panic(const std::string &Bytes) -> bool {
+    return Bytes.find("\"plugin-panic\"") != std::string::npos;
+}
+
+// Whether `foro_poll` no longer knows `Ticket`.
+auto is_gone(uint64_t Ticket) -> bool {
+    const uint64_t Result = foro_poll(Ticket);
+    return Result && is_panic(take_result(Result));
+}
+
+auto submit(const std::string &Request, uint64_t Key) -> uint64_t {
+    return foro_submit(reinterpret_cast<uint64_t>(Request.data()),
+                       Request.size(), Key);
+}
+
+// Aborts unless jobs give the results `foro_main` gives, whether waited for
+// or polled, and unless a ticket is gone once it is collected or cancelled.
+// Of jobs superseded under one key, each either finishes or is cancelled,
+// and the last one always finishes.
+void check_jobs(const std::vector<std::string> &Requests,
+                const std::vector<std::string> &Expected) {
+    const size_t Count = Requests.size();
+    std::vector<uint64_t> Tickets(Count);
+    for (size_t I = 0; I < Count; ++I)
+        Tickets[I] = submit(Requests[I], 0);
+    // Half of them with a timeout, which they finish well within.
+    for (size_t I = 0; I < Count; ++I) {
+        const uint64_t Result = I % 2 ? foro_wait(Tickets[I], UINT64_MAX)
+                                      : foro_wait(Tickets[I], 60000);
+        if (!Result || take_result(Result) != Expected[I])
+            fail("result of job " + std::to_string(I));
+        if (!is_gone(Tickets[I]))
+            fail("job " + std::to_string(I) + " collected twice");
+    }
+
+    for (size_t I = 0; I < Count; I += 16) {
+        const uint64_t Ticket = submit(Requests[I], 0);
+        uint64_t Result;
+        while (!(Result = foro_poll(Ticket)))
+            std::this_thread::yield();
+        if (take_result(Result) != Expected[I])
+            fail("polled result of job " + std::to_string(I));
+    }
+
+    for (size_t I = 0; I < Count; I += 16) {
+        const uint64_t Ticket = submit(Requests[I], 0);
+        foro_cancel(Ticket);
+        if (!is_gone(Ticket))
+            fail("cancelled job " + std::to_string(I) + " collected");
+    }
+    if (foro_cancel(UINT64_MAX - 1) != 0)
+        fail("cancelling an unknown ticket");
+
+    constexpr uint64_t Key = 7;
+    for (size_t I = 0; I < Count; ++I)
+        Tickets[I] = submit(Requests[I], Key);
+    for (size_t I = 0; I < Count; ++I) {
+        const std::string Bytes =
+            take_result(foro_wait(Tickets[I], UINT64_MAX));
+        const bool Finished = Bytes == Expected[I];
+        if (!Finished && (I + 1 == Count || !is_panic(Bytes)))
+            fail("superseded job " + std::to_string(I));
+    }
+}
+
+} // namespace
+
+// Aborts unless requests come through a ring and as jobs as they come out of
+// `foro_main`: through a ring with one host and one worker, with several of
+// each, and with every result too large for its slot.
+void check_transports(const std::string &Dir) {
+    std::vector<std::string> Requests;
+    std::vector<std::string> Expected;
+    for (int I = 0; I < 256; ++I) {
+        const std::string N = std::to_string(I);
+        Requests.push_back(format_request(
+            Dir + "/sample.cpp", "int   value_" + N + " =" + N + ";\n"));
+        Expected.push_back(call_foro_main(Requests.back()));
+    }
+
+    check_round_trip(Requests, Expected, 4096, 1, 1);
+    check_round_trip(Requests, Expected, 4096, 4, 4);
+    check_round_trip(Requests, Expected, 8, 4, 4);
+    check_jobs(Requests, Expected);
+}
+
+// Registers the transport benchmarks; they read the corpus from `Dir`.
+void register_ring_benchmarks(const std::string &Dir) {
+    for (const char *File : corpus::Files) {
+        const std::string Path = Dir + "/" + File;
+        const std::string Code = corpus::read_file(Path);
+        if (Code.empty())
+            continue;
+
+        for (const int Times : Repeats) {
+            const std::string Input = corpus::repeat(File, Code, Times);
+            const std::string Request = format_request(Path, Input);
+            const std::string Suffix =
+                std::string("/") + File + "/x" + std::to_string(Times);
+
+            benchmark::RegisterBenchmark(
+                "CallPerFile" + Suffix,
+                [Request](benchmark::State &State) {
+                    bm_call_per_file(State, Request);
+                })
+                ->Threads(1)
+                ->Threads(4)
+                ->UseRealTime();
+            benchmark::RegisterBenchmark(
+                "Submit" + Suffix,
+                [Request](benchmark::State &State) {
+                    bm_submit(State, Request);
+                })
+                ->UseRealTime();
+            benchmark::RegisterBenchmark(
+                "Ring" + Suffix,
+                [Request, Size = Input.size()](benchmark::State &State) {
+                    bm_ring(State, Request, Size);
+                })
+                ->ArgName("workers")
+                ->Arg(1)
+                ->Arg(4)
+                ->UseRealTime();
+        }
+    }
+}
@@ -0,0 +1,199 @@
+// Measures what a short-lived foro invocation pays for the plugin: the time
+// from `dlopen` to the first formatted file. Every run happens in a fresh
+// process, so the loader, relocations and static initializers are paid each
+// time, as they are in practice.
+//
+//   foro-clang-format-startup <plugin> <file> [runs]
+//
+// Prints one JSON object with the minimum and median over `runs` (default 20)
+// of the time `dlopen` took, the time of the first `foro_main` call, and
+// their sum.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <dlfcn.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Set in the environment of the processes that do the actual runs.
+const char *const ChildVariable = "FORO_CLANG_FORMAT_STARTUP_CHILD";
+
+struct Sample {
+    uint64_t LoadNs;
+    uint64_t FormatNs;
+};
+
+uint64_t since(Clock::time_point Start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                                Start)
+        .count();
+}
+
+std::string json_string(const std::string &Text) {
+    std::string Out = "\"";
+    for (const char C : Text) {
+        if (C == '"' || C == '\\')
+            Out += '\\';
+        Out += C;
+    }
+    return Out + "\"";
+}
+
+// Loads the plugin and formats `File` once, through a request that has the
+// plugin read the file itself. Prints the two durations.
+int run_once(const char *Plugin, const char *File) {
+    using ForoMain = uint64_t (*)(uint64_t, uint64_t);
+    using ForoFree = void (*)(uint64_t, uint64_t, uint64_t);
+
+    const auto Start = Clock::now();
+    void *Handle = dlopen(Plugin, RTLD_NOW | RTLD_LOCAL);
+    if (!Handle) {
+        std::fprintf(stderr, "dlopen: %s\n", dlerror());
+        return 1;
+    }
+    auto Main = reinterpret_cast<ForoMain>(dlsym(Handle, "foro_main"));
+    auto Free = reinterpret_cast<ForoFree>(dlsym(Handle, "foro_free"));
+    const uint64_t LoadNs = since(Start);
+    if (!Main || !Free) {
+        std::fprintf(stderr, "missing foro_main or foro_free\n");
+        return 1;
+    }
+
+    char *Absolute = realpath(File, nullptr);
+    if (!Absolute) {
+        std::perror(File);
+        return 1;
+    }
+    const std::string Request =
+        "{\"os-target\":" + json_string(Absolute) + "}";
+    std::free(Absolute);
+
+    const auto FormatStart = Clock::now();
+    const uint64_t Result =
+        Main(reinterpret_cast<uint64_t>(Request.data()), Request.size());
+    const uint64_t FormatNs = since(FormatStart);
+
+    uint64_t Size;
+    std::memcpy(&Size, reinterpret_cast<const void *>(Result), 8);
+    const std::string Reply(reinterpret_cast<const char *>(Result) + 8, Size);
+    Free(Result, 8 + Size, 8);
+    if (Reply.find("\"success\"") == std::string::npos) {
+        std::fprintf(stderr, "formatting failed: %s\n", Reply.c_str());
+        return 1;
+    }
+
+    std::printf("%llu %llu\n", static_cast<unsigned long long>(LoadNs),
+                static_cast<unsigned long long>(FormatNs));
+    return 0;
+}
+
+// Runs this program again as a child and reads back its sample.
+bool run_child(char **Argv, Sample &S) {
+    int Pipe[2];
+    if (pipe(Pipe) != 0)
+        return false;
+
+    posix_spawn_file_actions_t Actions;
+    posix_spawn_file_actions_init(&Actions);
+    posix_spawn_file_actions_adddup2(&Actions, Pipe[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&Actions, Pipe[0]);
+
+    std::vector<char *> Env;
+    std::string Flag = std::string(ChildVariable) + "=1";
+    Env.push_back(Flag.data());
+    for (char **E = environ; *E; ++E)
+        Env.push_back(*E);
+    Env.push_back(nullptr);
+
+    pid_t Pid;
+    const int Error =
+        posix_spawnp(&Pid, Argv[0], &Actions, nullptr, Argv, Env.data());
+    posix_spawn_file_actions_destroy(&Actions);
+    close(Pipe[1]);
+    if (Error != 0) {
+        close(Pipe[0]);
+        return false;
+    }
+
+    std::string Output;
+    char Buffer[256];
+    ssize_t N;
+    while ((N = read(Pipe[0], Buffer, sizeof(Buffer))) > 0)
+        Output.append(Buffer, N);
+    close(Pipe[0]);
+
+    int Status;
+    waitpid(Pid, &Status, 0);
+    if (!WIFEXITED(Status) || WEXITSTATUS(Status) != 0)
+        return false;
+
+    unsigned long long Load, Format;
+    if (std::sscanf(Output.c_str(), "%llu %llu", &Load, &Format) != 2)
+        return false;
+    S = {Load, Format};
+    return true;
+}
+
+uint64_t median(std::vector<uint64_t> Values) {
+    std::sort(Values.begin(), Values.end());
+    return Values[Values.size() / 2];
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    if (argc < 3 || argc > 4) {
+        std::fprintf(stderr, "usage: %s <plugin> <file> [runs]\n", argv[0]);
+        return 2;
+    }
+    if (std::getenv(ChildVariable))
+        return run_once(argv[1], argv[2]);
+
+    const int Runs = argc == 4 ? std::atoi(argv[3]) : 20;
+    if (Runs <= 0) {
+        std::fprintf(stderr, "runs must be positive\n");
+        return 2;
+    }
+
+    std::vector<uint64_t> Load, Format, Total;
+    for (int I = 0; I < Runs; ++I) {
+        Sample S;
+        if (!run_child(argv, S)) {
+            std::fprintf(stderr, "run %d failed\n", I);
+            return 1;
+        }
+        Load.push_back(S.LoadNs);
+        Format.push_back(S.FormatNs);
+        Total.push_back(S.LoadNs + S.FormatNs);
+    }
+
+    auto Report = [](const char *Name, const std::vector<uint64_t> &Values,
+                     bool Last) {
+        std::printf("  \"%s\": {\"min-ns\": %llu, \"median-ns\": %llu}%s\n",
+                    Name,
+                    static_cast<unsigned long long>(
+                        *std::min_element(Values.begin(), Values.end())),
+                    static_cast<unsigned long long>(median(Values)),
+                    Last ? "" : ",");
+    };
+    std::printf("{\n  \"runs\": %d,\n", Runs);
+    Report("dlopen", Load, false);
+    Report("first-format", Format, false);
+    Report("total", Total, true);
+    std::printf("}\n");
+    return 0;
+}
@@ -0,0 +1,78 @@
+# Builds the plugin with profile-guided optimization:
+#
+#   1. an instrumented build in build-pgo,
+#   2. a training run of it over a corpus, through `foro_main`,
+#   3. the final build in build, optimized with the merged profile,
+#   4. with BOLT=1 (ELF only), an llvm-bolt pass over the result, trained the
+#      same way.
+#
+# usage: sh pgo-build.sh [corpus-dir] [cmake args...]
+#
+# The corpus defaults to bench/corpus, which is small; a checkout of the
+# code the plugin will mostly format trains better. PGO_PASSES (default 3)
+# sets how often it is formatted. Needs clang and llvm-profdata, and llvm-bolt
+# for BOLT=1.
+
+set -e
+
+ROOT=$(cd "$(dirname "$0")" && pwd)
+CORPUS=$ROOT/bench/corpus
+if [ $# -gt 0 ] && [ "${1#-}" = "$1" ]; then
+    CORPUS=$(cd "$1" && pwd)
+    shift
+fi
+PASSES=${PGO_PASSES:-3}
+LLVM_PROFDATA=${LLVM_PROFDATA:-llvm-profdata}
+LLVM_BOLT=${LLVM_BOLT:-llvm-bolt}
+
+GEN=$ROOT/build-pgo
+OUT=$ROOT/build
+PROFILES=$GEN/profiles
+PROFILE=$GEN/foro-clang-format.profdata
+
+plugin() {
+    find "$1" -maxdepth 1 -name 'libforo-clang-format.*' -type f | head -n 1
+}
+
+train() {
+    FORO_CLANG_FORMAT_CACHE_SIZE=0 "$GEN/foro-clang-format-train" "$1" \
+        "$CORPUS" "$PASSES"
+}
+
+cmake -G Ninja -S "$ROOT" -B "$GEN" \
+    -DCMAKE_BUILD_TYPE=Release \
+    -DCMAKE_C_COMPILER=clang -DCMAKE_CXX_COMPILER=clang++ \
+    -DFORO_CLANG_FORMAT_PGO=generate \
+    -DFORO_CLANG_FORMAT_PGO_DIR="$PROFILES" "$@"
+ninja -C "$GEN" foro-clang-format foro-clang-format-train
+
+# Building ran instrumented tools such as tablegen; only the training counts.
+rm -rf "$PROFILES"
+train "$(plugin "$GEN")"
+"$LLVM_PROFDATA" merge -o "$PROFILE" "$PROFILES"
+
+BOLT_FLAG=OFF
+if [ "${BOLT:-0}" = 1 ]; then
+    BOLT_FLAG=ON
+fi
+
+cmake -G Ninja -S "$ROOT" -B "$OUT" \
+    -DCMAKE_BUILD_TYPE=Release \
+    -DCMAKE_C_COMPILER=clang -DCMAKE_CXX_COMPILER=clang++ \
+    -DFORO_CLANG_FORMAT_PGO=use \
+    -DFORO_CLANG_FORMAT_PGO_PROFILE="$PROFILE" \
+    -DFORO_CLANG_FORMAT_BOLT=$BOLT_FLAG "$@"
+ninja -C "$OUT" foro-clang-format
+
+if [ "$BOLT_FLAG" = ON ]; then
+    LIB=$(plugin "$OUT")
+    "$LLVM_BOLT" "$LIB" -instrument -o "$GEN/instrumented.so" \
+        -instrumentation-file="$GEN/bolt.fdata"
+    train "$GEN/instrumented.so"
+    "$LLVM_BOLT" "$LIB" -o "$LIB.bolt" -data="$GEN/bolt.fdata" \
+        -reorder-blocks=ext-tsp -reorder-functions=cdsort \
+        -split-functions -split-all-cold -icf=1 -dyno-stats
+    mv "$LIB.bolt" "$LIB"
+fi
+
+echo "Optimized plugin: $(plugin "$OUT")"
@@ -0,0 +1,80 @@
+#include "binary_protocol.h"
+
+#include <cstring>
+
+namespace binary_protocol {
+
+auto read_le(const uint8_t *in, size_t bytes) -> uint64_t {
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; ++i) {
+        value |= (uint64_t)in[i] << (8 * i);
+    }
+    return value;
+}
+
+auto write_le(uint8_t *out, uint64_t value, size_t bytes) -> void {
+    for (size_t i = 0; i < bytes; ++i) {
+        out[i] = (uint8_t)((value >> (8 * i)) & 0xFF);
+    }
+}
+
+auto is_binary(const uint8_t *data, size_t len) -> bool {
+    return len >= sizeof(magic) && std::memcmp(data, magic, sizeof(magic)) == 0;
+}
+
+auto parse_request(const uint8_t *data, size_t len, Request &request)
+    -> const char * {
+    size_t pos = 0;
+    auto take = [&](size_t bytes) -> const uint8_t * {
+        if (len - pos < bytes) {
+            return nullptr;
+        }
+        const uint8_t *at = data + pos;
+        pos += bytes;
+        return at;
+    };
+
+    const uint8_t *header = take(8);
+    if (!header || std::memcmp(header, magic, sizeof(magic)) != 0) {
+        return "Truncated binary request header";
+    }
+    if (header[4] != version) {
+        return "Unsupported binary request version";
+    }
+    if (header[5] > (uint8_t)Mode::FormatFileInPlace) {
+        return "Unknown binary request mode";
+    }
+    request.mode = (Mode)header[5];
+
+    const uint8_t *target_len = take(4);
+    if (!target_len) {
+        return "Truncated binary request target";
+    }
+    const size_t target_size = read_le(target_len, 4);
+    const uint8_t *target = take(target_size);
+    if (!target) {
+        return "Truncated binary request target";
+    }
+    request.target = std::string_view((const char *)target, target_size);
+
+    const uint8_t *content_len = take(8);
+    if (!content_len) {
+        return "Truncated binary request content";
+    }
+    const uint64_t content_size = read_le(content_len, 8);
+    if (content_size > len - pos) {
+        return "Truncated binary request content";
+    }
+    request.content =
+        std::string_view((const char *)take(content_size), content_size);
+
+    return nullptr;
+}
+
+auto write_response_header(uint8_t *out, Status status) -> void {
+    std::memcpy(out, magic, sizeof(magic));
+    out[4] = (uint8_t)status;
+    out[5] = out[6] = out[7] = 0;
+}
+
+} // namespace binary_protocol
@@ -0,0 +1,91 @@
+#ifndef FORO_CLANG_FORMAT_BINARY_PROTOCOL_H_
+#define FORO_CLANG_FORMAT_BINARY_PROTOCOL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Binary framing for `foro_main`, an alternative to JSON for hosts that want
+// to hand over large sources without copies. A request is recognised by its
+// leading magic; everything else is parsed as JSON as before. All integers are
+// little-endian.
+//
+// Request:
+//   char[4]  magic "FCFB"
+//   u8       version (1)
+//   u8       mode
+//   u16      reserved, 0
+//   u32      target length, then the target path
+//   u64      content length, then the content
+//
+// Response, after the 8-byte length prefix every `foro_main` result has:
+//   char[4]  magic "FCFB"
+//   u8       status
+//   u8[3]    reserved, 0
+//   ...      payload, up to the end of the result
+//
+// The content is read in place from the host's buffer, and for `Success` the
+// payload is the formatted content, written directly into the result buffer.
+// For `Error` and `Panic` it is the message, and it is empty for `Ignored`.
+// `Timeout` is an `Error` that says formatting ran out of its budget.
+//
+// A `Check` request only asks whether formatting would change the content. It
+// is answered with `Unchanged`, with no payload, or with `Changed` and a
+// payload of two u32: the number of edits and the offset of the first one.
+//
+// An `Edits` request is answered with `Success` and the edits that format the
+// content rather than the formatted content:
+//   u32      edit count, then for each edit, sorted by offset:
+//   u32      offset into the original content
+//   u32      length of the replaced bytes
+//   u32      text length, then the text
+//
+// `FormatFile` and `FormatFileInPlace` requests name a file as the target and
+// leave the content empty; the plugin reads the file itself. `FormatFile` is
+// answered like `Format`. `FormatFileInPlace` replaces the file atomically if
+// formatting changes it, and is answered with `Changed` or `Unchanged`, with
+// no payload either way.
+namespace binary_protocol {
+
+inline constexpr char magic[4] = {'F', 'C', 'F', 'B'};
+inline constexpr uint8_t version = 1;
+inline constexpr size_t response_header_size = 8;
+
+enum class Mode : uint8_t {
+    Format = 0,
+    Check = 1,
+    Edits = 2,
+    FormatFile = 3,
+    FormatFileInPlace = 4,
+};
+
+enum class Status : uint8_t {
+    Success = 0,
+    Ignored = 1,
+    Error = 2,
+    Panic = 3,
+    Unchanged = 4,
+    Changed = 5,
+    Timeout = 6,
+};
+
+struct Request {
+    Mode mode;
+    std::string_view target;
+    std::string_view content; // Points into the request buffer.
+};
+
+auto is_binary(const uint8_t *data, size_t len) -> bool;
+
+// Returns nullptr on success, or a description of what is wrong.
+auto parse_request(const uint8_t *data, size_t len, Request &request)
+    -> const char *;
+
+auto write_response_header(uint8_t *out, Status status) -> void;
+
+auto read_le(const uint8_t *in, size_t bytes) -> uint64_t;
+auto write_le(uint8_t *out, uint64_t value, size_t bytes) -> void;
+
+} // namespace binary_protocol
+
+#endif
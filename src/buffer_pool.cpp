@@ -0,0 +1,247 @@
+#include "buffer_pool.h"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+namespace buffer_pool {
+
+namespace {
+
+constexpr unsigned MinShift = 6;  // 64 bytes.
+constexpr unsigned MaxShift = 26; // 64 MiB.
+constexpr unsigned Classes = MaxShift - MinShift + 1;
+
+// Every block is preceded by a header saying how to free it, which also keeps
+// what follows aligned to `HeaderSize`. Pooled blocks serve alignments up to
+// that.
+constexpr size_t HeaderSize = 16;
+constexpr uint32_t Magic = 0x464f524f;
+
+struct Header {
+    void *Base;    // What the system allocated.
+    int32_t Class; // -1 for a block that is not pooled.
+    uint32_t Magic;
+};
+
+static_assert(sizeof(Header) <= HeaderSize);
+
+// What a thread keeps per class, in blocks and in bytes, and what the depot
+// keeps in all.
+constexpr size_t ThreadBlocks = 32;
+constexpr size_t ThreadClassBytes = 8 << 20;
+constexpr size_t DepotBytes = 64 << 20;
+
+auto class_size(unsigned Class) -> size_t {
+    return size_t(1) << (Class + MinShift);
+}
+
+// The class serving `Size` bytes at `Alignment`, or -1 if none does.
+auto size_class(size_t Size, size_t Alignment) -> int {
+    const size_t Bytes = std::max(Size, class_size(0));
+    if (Bytes > class_size(Classes - 1) || Alignment > HeaderSize)
+        return -1;
+    return std::bit_width(Bytes - 1) - MinShift;
+}
+
+auto header(void *Ptr) -> Header * {
+    return reinterpret_cast<Header *>(static_cast<char *>(Ptr) - HeaderSize);
+}
+
+// A block of `Size` bytes at `Alignment`, with its header, from the system.
+auto system_allocate(size_t Size, size_t Alignment, int Class) -> void * {
+    const size_t Offset = std::max(Alignment, HeaderSize);
+    if (Size > SIZE_MAX - Offset)
+        return nullptr;
+    void *Base = nullptr;
+    if (posix_memalign(&Base, std::max(Offset, alignof(std::max_align_t)),
+                       Offset + Size) != 0) {
+        return nullptr;
+    }
+    void *Ptr = static_cast<char *>(Base) + Offset;
+    *header(Ptr) = {Base, Class, Magic};
+    return Ptr;
+}
+
+auto system_free(void *Ptr) -> void { std::free(header(Ptr)->Base); }
+
+auto thread_limit(unsigned Class) -> size_t {
+    return std::clamp<size_t>(ThreadClassBytes / class_size(Class), 1,
+                              ThreadBlocks);
+}
+
+// Free blocks by class. Each thread has one, locked only by that thread
+// except during `trim`, so its mutex is uncontended.
+struct Cache {
+    std::mutex Mutex;
+    std::vector<void *> Blocks[Classes];
+    size_t Bytes = 0;
+
+    auto pop(unsigned Class) -> void * {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        if (Blocks[Class].empty())
+            return nullptr;
+        void *Ptr = Blocks[Class].back();
+        Blocks[Class].pop_back();
+        Bytes -= class_size(Class);
+        return Ptr;
+    }
+
+    // Keeps `Ptr` unless that would take more than `Limit` blocks of its
+    // class or `ByteLimit` bytes in all.
+    auto push(unsigned Class, void *Ptr, size_t Limit, size_t ByteLimit)
+        -> bool {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        if (Blocks[Class].size() >= Limit ||
+            Bytes + class_size(Class) > ByteLimit) {
+            return false;
+        }
+        Blocks[Class].push_back(Ptr);
+        Bytes += class_size(Class);
+        return true;
+    }
+
+    auto release() -> size_t {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        for (auto &List : Blocks) {
+            for (void *Ptr : List)
+                system_free(Ptr);
+            List.clear();
+            List.shrink_to_fit();
+        }
+        return std::exchange(Bytes, 0);
+    }
+};
+
+// The depot and every live thread cache. Never destroyed, as threads may
+// still exit after static destructors have run.
+struct Registry {
+    std::mutex Mutex;
+    Cache Depot;
+    std::vector<Cache *> Threads;
+};
+
+auto registry() -> Registry & {
+    static Registry *R = new Registry;
+    return *R;
+}
+
+thread_local bool ThreadCacheGone = false;
+
+struct ThreadCache {
+    Cache C;
+
+    ThreadCache() {
+        Registry &R = registry();
+        std::lock_guard<std::mutex> Lock(R.Mutex);
+        R.Threads.push_back(&C);
+    }
+
+    // Hands the blocks to the depot, as far as it takes them.
+    ~ThreadCache() {
+        Registry &R = registry();
+        {
+            std::lock_guard<std::mutex> Lock(R.Mutex);
+            R.Threads.erase(
+                std::find(R.Threads.begin(), R.Threads.end(), &C));
+        }
+        for (unsigned Class = 0; Class < Classes; ++Class) {
+            for (void *Ptr : C.Blocks[Class]) {
+                if (!R.Depot.push(Class, Ptr, SIZE_MAX, DepotBytes))
+                    system_free(Ptr);
+            }
+        }
+        ThreadCacheGone = true;
+    }
+};
+
+// The calling thread's cache, or null while the thread is exiting.
+auto thread_cache() -> Cache * {
+    if (ThreadCacheGone)
+        return nullptr;
+    static thread_local ThreadCache T;
+    return &T.C;
+}
+
+} // namespace
+
+auto allocate(size_t size, size_t alignment) -> void * {
+    if (alignment == 0)
+        alignment = 1;
+    if (!std::has_single_bit(alignment))
+        return nullptr;
+
+    const int Class = size_class(size, alignment);
+    if (Class < 0)
+        return system_allocate(size, alignment, -1);
+
+    if (Cache *C = thread_cache()) {
+        if (void *Ptr = C->pop(Class))
+            return Ptr;
+    }
+    if (void *Ptr = registry().Depot.pop(Class))
+        return Ptr;
+
+    return system_allocate(class_size(Class), HeaderSize, Class);
+}
+
+auto deallocate(void *ptr) -> void {
+    if (!ptr)
+        return;
+
+    const Header &H = *header(ptr);
+    assert(H.Magic == Magic && "not a block of the buffer pool");
+    const int Class = H.Class;
+    if (Class < 0) {
+        system_free(ptr);
+        return;
+    }
+
+    if (Cache *C = thread_cache()) {
+        if (C->push(Class, ptr, thread_limit(Class), SIZE_MAX))
+            return;
+    }
+    if (!registry().Depot.push(Class, ptr, SIZE_MAX, DepotBytes))
+        system_free(ptr);
+}
+
+auto trim() -> size_t {
+    Registry &R = registry();
+    size_t Released = 0;
+    {
+        std::lock_guard<std::mutex> Lock(R.Mutex);
+        for (Cache *C : R.Threads)
+            Released += C->release();
+    }
+    Released += R.Depot.release();
+
+#if defined(__GLIBC__)
+    malloc_trim(0);
+#endif
+    return Released;
+}
+
+auto cached_bytes() -> size_t {
+    Registry &R = registry();
+    size_t Bytes = 0;
+    {
+        std::lock_guard<std::mutex> Lock(R.Mutex);
+        for (Cache *C : R.Threads) {
+            std::lock_guard<std::mutex> CacheLock(C->Mutex);
+            Bytes += C->Bytes;
+        }
+    }
+    std::lock_guard<std::mutex> Lock(R.Depot.Mutex);
+    return Bytes + R.Depot.Bytes;
+}
+
+} // namespace buffer_pool
@@ -0,0 +1,30 @@
+#ifndef FORO_CLANG_FORMAT_BUFFER_POOL_H_
+#define FORO_CLANG_FORMAT_BUFFER_POOL_H_
+
+#include <cstddef>
+
+// Memory behind `foro_malloc` and `foro_free` and the result buffers, which
+// are the size of whole source files and change hands once per request.
+//
+// Requests up to 64 MiB, aligned to at most 16 bytes, are rounded up to a
+// power of two and recycled per size class, first through a cache of the
+// calling thread and then through a shared depot, both bounded; larger or
+// stranger ones go straight to the system. Each block carries a small header
+// in front with its class, so that it goes back to the right one whatever
+// size the host passes to `foro_free`. A block can be freed on any thread.
+namespace buffer_pool {
+
+auto allocate(size_t size, size_t alignment) -> void *;
+auto deallocate(void *ptr) -> void;
+
+// Frees every cached block, of all threads, and asks the C library to return
+// free memory to the system. Returns the number of bytes released from the
+// caches.
+auto trim() -> size_t;
+
+// Bytes sitting in the caches, free for reuse.
+auto cached_bytes() -> size_t;
+
+} // namespace buffer_pool
+
+#endif
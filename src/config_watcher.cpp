@@ -0,0 +1,220 @@
+#include "config_watcher.h"
+
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include <dirent.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr uint32_t Events = IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE |
+                            IN_MOVED_FROM | IN_MOVED_TO | IN_MOVE_SELF |
+                            IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+
+auto is_config(const char *Name) -> bool {
+    return std::strcmp(Name, ".clang-format") == 0 ||
+           std::strcmp(Name, "_clang-format") == 0 ||
+           std::strcmp(Name, ".clang-format-ignore") == 0;
+}
+
+auto is_skipped(const char *Name) -> bool {
+    return std::strcmp(Name, ".") == 0 || std::strcmp(Name, "..") == 0 ||
+           std::strcmp(Name, ".git") == 0 || std::strcmp(Name, ".hg") == 0 ||
+           std::strcmp(Name, ".svn") == 0;
+}
+
+} // namespace
+
+ConfigWatcher::ConfigWatcher(Callback Changed)
+    : Changed(std::move(Changed)) {
+    Fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (Fd < 0)
+        return;
+    StopFd = eventfd(0, EFD_CLOEXEC);
+    if (StopFd < 0) {
+        close(Fd);
+        Fd = -1;
+        return;
+    }
+    Thread = std::thread([this] { loop(); });
+}
+
+ConfigWatcher::~ConfigWatcher() {
+    if (Fd < 0)
+        return;
+    const uint64_t One = 1;
+    [[maybe_unused]] const ssize_t N = write(StopFd, &One, sizeof(One));
+    Thread.join();
+    close(StopFd);
+    close(Fd);
+}
+
+auto ConfigWatcher::add(const std::string &Dir, bool Recursive, bool Root)
+    -> bool {
+    const int Wd = inotify_add_watch(Fd, Dir.c_str(), Events);
+    if (Wd < 0) {
+        // Not a directory, or gone already: nothing to watch there.
+        if (errno != ENOTDIR && errno != ENOENT)
+            Incomplete.store(true, std::memory_order_relaxed);
+        return false;
+    }
+    std::lock_guard<std::mutex> Lock(Mutex);
+    // A directory watched again, after a rescan, keeps its descriptor.
+    auto &W = Watches[Wd];
+    W = {Dir, Recursive, Root || W.Root};
+    return true;
+}
+
+auto ConfigWatcher::remove_tree(const std::string &Dir) -> void {
+    const std::string Prefix = Dir + "/";
+    std::lock_guard<std::mutex> Lock(Mutex);
+    for (auto It = Watches.begin(); It != Watches.end();) {
+        if (It->second.Dir == Dir || It->second.Dir.starts_with(Prefix)) {
+            inotify_rm_watch(Fd, It->first);
+            It = Watches.erase(It);
+        } else {
+            ++It;
+        }
+    }
+}
+
+auto ConfigWatcher::watch(const std::string &Dir, bool Recursive) -> bool {
+    if (!ok())
+        return false;
+    if (!add(Dir, Recursive, /*Root=*/true))
+        return false;
+    if (Recursive)
+        watch_tree(Dir);
+    return true;
+}
+
+auto ConfigWatcher::rescan() -> bool {
+    std::vector<std::string> Roots;
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        for (const auto &[Wd, W] : Watches) {
+            if (W.Root && W.Recursive)
+                Roots.push_back(W.Dir);
+        }
+    }
+    bool HasConfig = false;
+    for (const std::string &Root : Roots)
+        HasConfig |= watch_tree(Root);
+    return HasConfig;
+}
+
+auto ConfigWatcher::watch_tree(const std::string &Dir) -> bool {
+    DIR *Stream = opendir(Dir.c_str());
+    if (!Stream)
+        return false;
+
+    bool HasConfig = false;
+    while (const dirent *Entry = readdir(Stream)) {
+        if (is_skipped(Entry->d_name))
+            continue;
+        if (Entry->d_type != DT_DIR && Entry->d_type != DT_UNKNOWN) {
+            HasConfig |= is_config(Entry->d_name);
+            continue;
+        }
+        // `add` refuses anything but a directory, which settles unknown types.
+        const std::string Sub = Dir + "/" + Entry->d_name;
+        if (add(Sub, true))
+            HasConfig |= watch_tree(Sub);
+        else
+            HasConfig |= is_config(Entry->d_name);
+    }
+    closedir(Stream);
+    return HasConfig;
+}
+
+auto ConfigWatcher::loop() -> void {
+    alignas(inotify_event) char Buffer[16 << 10];
+    pollfd Fds[2] = {{Fd, POLLIN, 0}, {StopFd, POLLIN, 0}};
+    bool ToldIncomplete = false;
+
+    for (;;) {
+        if (poll(Fds, 2, -1) < 0)
+            continue;
+        if (Fds[1].revents)
+            return;
+
+        const ssize_t Length = read(Fd, Buffer, sizeof(Buffer));
+        if (Length <= 0)
+            continue;
+
+        bool Dirty = false;
+        for (ssize_t Offset = 0; Offset < Length;) {
+            const auto *Event =
+                reinterpret_cast<const inotify_event *>(Buffer + Offset);
+            Offset += sizeof(inotify_event) + Event->len;
+
+            if (Event->mask & IN_Q_OVERFLOW) {
+                // Directories created meanwhile may have gone unwatched.
+                rescan();
+                Dirty = true;
+                continue;
+            }
+            if (Event->mask & IN_IGNORED) {
+                std::lock_guard<std::mutex> Lock(Mutex);
+                Watches.erase(Event->wd);
+                continue;
+            }
+            if (Event->mask & IN_MOVE_SELF) {
+                // Others are handled through their parent's `IN_MOVED_FROM`;
+                // a root has no watched parent to follow it to.
+                std::lock_guard<std::mutex> Lock(Mutex);
+                auto It = Watches.find(Event->wd);
+                if (It != Watches.end() && It->second.Root) {
+                    Incomplete.store(true, std::memory_order_relaxed);
+                    Dirty = true;
+                }
+                continue;
+            }
+            if (Event->len == 0)
+                continue;
+
+            const char *Name = Event->name;
+            if (!(Event->mask & IN_ISDIR)) {
+                Dirty |= is_config(Name);
+                continue;
+            }
+
+            Watch Parent;
+            {
+                std::lock_guard<std::mutex> Lock(Mutex);
+                auto It = Watches.find(Event->wd);
+                if (It == Watches.end())
+                    continue;
+                Parent = It->second;
+            }
+            if (!Parent.Recursive || is_skipped(Name))
+                continue;
+            const std::string Sub = Parent.Dir + "/" + Name;
+
+            // The watches below a directory that leaves know it by its old
+            // path; if it arrives elsewhere in the tree, it is watched anew.
+            // Either way, its config files now apply to other paths.
+            if (Event->mask & IN_MOVED_FROM) {
+                remove_tree(Sub);
+                Dirty = true;
+            }
+
+            // A directory that arrives may already hold config files, which
+            // no event will report.
+            if (Event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                if (add(Sub, true))
+                    Dirty |= watch_tree(Sub);
+            }
+        }
+
+        const bool Lost = !complete() && !ToldIncomplete;
+        ToldIncomplete |= Lost;
+        if (Dirty || Lost)
+            Changed(complete());
+    }
+}
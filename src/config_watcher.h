@@ -0,0 +1,76 @@
+#ifndef FORO_CLANG_FORMAT_CONFIG_WATCHER_H_
+#define FORO_CLANG_FORMAT_CONFIG_WATCHER_H_
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+// Watches directories with inotify for changes to the files that decide how
+// a file is formatted: `.clang-format`, `_clang-format` and
+// `.clang-format-ignore`. Creating, writing, moving or deleting one of them
+// calls `Changed`, as does a new directory that arrives with one inside, a
+// directory that moves away, and a lost event. Calls come from a thread of
+// the watcher's own.
+//
+// `Changed` is told whether the watch is still complete. It stops being so
+// for good once a directory can't be watched, such as when the inotify watch
+// limit is reached, or a directory given to `watch` moves.
+//
+// Linux only.
+class ConfigWatcher {
+  public:
+    using Callback = std::function<void(bool Complete)>;
+
+    explicit ConfigWatcher(Callback Changed);
+    ~ConfigWatcher();
+
+    ConfigWatcher(const ConfigWatcher &) = delete;
+    ConfigWatcher &operator=(const ConfigWatcher &) = delete;
+
+    // Whether inotify could be set up.
+    auto ok() const -> bool { return Fd >= 0; }
+
+    // Whether every directory that should be watched is.
+    auto complete() const -> bool {
+        return !Incomplete.load(std::memory_order_relaxed);
+    }
+
+    // Watches `Dir` and, unless `Recursive` is false, every directory below
+    // it, including those created later. Symbolic links and version control
+    // directories are not followed. Returns false if `Dir` can't be watched.
+    auto watch(const std::string &Dir, bool Recursive) -> bool;
+
+  private:
+    // Adds the watches below `Dir`. Returns whether a config file is there.
+    auto watch_tree(const std::string &Dir) -> bool;
+    // Returns false if `Dir` is not a directory or can't be watched; only the
+    // latter makes the watch incomplete.
+    auto add(const std::string &Dir, bool Recursive, bool Root = false)
+        -> bool;
+    // Drops the watches of `Dir` and everything below it.
+    auto remove_tree(const std::string &Dir) -> void;
+    // Watches every directory below the recursive roots again, after events
+    // were lost.
+    auto rescan() -> bool;
+    auto loop() -> void;
+
+    Callback Changed;
+    int Fd{-1};
+    int StopFd{-1};
+    std::atomic<bool> Incomplete{false};
+
+    std::mutex Mutex;
+    struct Watch {
+        std::string Dir;
+        bool Recursive;
+        bool Root; // Given to `watch`.
+    };
+    std::unordered_map<int, Watch> Watches;
+
+    std::thread Thread;
+};
+
+#endif
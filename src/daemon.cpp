@@ -0,0 +1,281 @@
+// A resident worker for short-lived hosts: serves `foro_main` requests over a
+// Unix socket (see `daemon_client.h` for the protocol) from a fixed set of
+// threads, whose contexts keep their resolved styles, ignore files and
+// result caches from one request to the next. Config files under the watched
+// directories, and in the directories above them, are watched with inotify,
+// so that they need not be checked on every request for files under those
+// directories.
+//
+//   foro-clang-format-daemon <socket> [--threads N] [dir...]
+//
+// Watches the current directory if no directory is given. Point the plugin at
+// it with FORO_CLANG_FORMAT_DAEMON=<socket>.
+
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <semaphore>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "config_watcher.h"
+#include "thread_pool.h"
+
+extern "C" {
+uint64_t foro_main_in(uint64_t ptr, uint64_t len, uint64_t dir_ptr,
+                      uint64_t dir_len);
+void foro_free(uint64_t ptr, uint64_t size, uint64_t alignment);
+void foro_config_watch(uint64_t ptr, uint64_t len);
+void foro_config_changed();
+}
+
+namespace {
+
+// Where the socket is, for the signal handler to remove it.
+char SocketPath[sizeof(sockaddr_un::sun_path)];
+
+extern "C" void on_signal(int) {
+    unlink(SocketPath);
+    _exit(0);
+}
+
+bool read_all(int Fd, void *Data, size_t Len) {
+    auto *Out = static_cast<uint8_t *>(Data);
+    while (Len > 0) {
+        const ssize_t N = read(Fd, Out, Len);
+        if (N <= 0)
+            return false;
+        Out += N;
+        Len -= N;
+    }
+    return true;
+}
+
+bool write_all(int Fd, const void *Data, size_t Len) {
+    const auto *In = static_cast<const uint8_t *>(Data);
+    while (Len > 0) {
+        const ssize_t N = write(Fd, In, Len);
+        if (N <= 0)
+            return false;
+        In += N;
+        Len -= N;
+    }
+    return true;
+}
+
+uint64_t read_le64(const uint8_t *In) {
+    uint64_t Value = 0;
+    for (int I = 0; I < 8; ++I)
+        Value |= static_cast<uint64_t>(In[I]) << (8 * I);
+    return Value;
+}
+
+// Requests and directories claiming to be larger are taken for garbage.
+constexpr uint64_t MaxRequestSize = uint64_t(1) << 30;
+constexpr uint64_t MaxDirSize = PATH_MAX;
+
+// Clients served at once, each on a thread of its own.
+constexpr std::ptrdiff_t MaxConnections = 256;
+// Pause before accepting again when out of descriptors or memory.
+constexpr std::chrono::milliseconds AcceptBackoff{50};
+
+// Formats `Request` from a client working in `Dir` on the pool, whose threads
+// keep their contexts warm. Returns the result, or 0 if formatting failed
+// outright.
+uint64_t format_on(WorkStealingPool &Pool, const std::string &Dir,
+                   const std::vector<uint8_t> &Request) {
+    std::promise<uint64_t> Done;
+    Pool.submit([&] {
+        // The pool swallows exceptions; the promise must be kept regardless.
+        uint64_t Result = 0;
+        try {
+            Result = foro_main_in(
+                reinterpret_cast<uint64_t>(Request.data()), Request.size(),
+                reinterpret_cast<uint64_t>(Dir.data()), Dir.size());
+        } catch (...) {
+        }
+        Done.set_value(Result);
+    });
+    return Done.get_future().get();
+}
+
+// Serves the requests of one client until it hangs up or sends something
+// that can't be served, when the connection is closed and the client
+// formats the request itself.
+void serve(int Fd, WorkStealingPool &Pool) {
+    try {
+        std::string Dir;
+        std::vector<uint8_t> Request;
+        uint8_t Header[8];
+        while (read_all(Fd, Header, 8)) {
+            const uint64_t DirLength = read_le64(Header);
+            if (DirLength == 0 || DirLength > MaxDirSize)
+                break;
+            Dir.resize(DirLength);
+            if (!read_all(Fd, Dir.data(), Dir.size()) || Dir[0] != '/' ||
+                !read_all(Fd, Header, 8)) {
+                break;
+            }
+
+            const uint64_t Length = read_le64(Header);
+            if (Length > MaxRequestSize)
+                break;
+            Request.resize(Length);
+            if (!read_all(Fd, Request.data(), Request.size()))
+                break;
+
+            const uint64_t Result = format_on(Pool, Dir, Request);
+            if (Result == 0)
+                break;
+
+            // The result already starts with its length.
+            const uint64_t Size =
+                read_le64(reinterpret_cast<const uint8_t *>(Result));
+            const bool Sent = write_all(
+                Fd, reinterpret_cast<const void *>(Result), 8 + Size);
+            foro_free(Result, 8 + Size, 8);
+            if (!Sent)
+                break;
+        }
+    } catch (...) {
+        // Out of memory for this client; the others carry on.
+    }
+    close(Fd);
+}
+
+// Watches `Dir` and everything below it, and the directories above it, whose
+// config files apply as well. Returns the resolved path of `Dir`, or an empty
+// one if it can't be watched.
+std::string watch_root(ConfigWatcher &Watcher, const char *Dir) {
+    char Resolved[PATH_MAX];
+    if (!realpath(Dir, Resolved) || !Watcher.watch(Resolved, true))
+        return {};
+    std::string Parent = Resolved;
+    while (Parent.size() > 1) {
+        Parent.resize(Parent.rfind('/'));
+        if (!Watcher.watch(Parent.empty() ? "/" : Parent, false))
+            return {};
+    }
+    return Resolved;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        std::fprintf(stderr, "usage: %s <socket> [--threads N] [dir...]\n",
+                     argv[0]);
+        return 2;
+    }
+    if (std::strlen(argv[1]) >= sizeof(SocketPath)) {
+        std::fprintf(stderr, "socket path too long\n");
+        return 2;
+    }
+    std::strcpy(SocketPath, argv[1]);
+
+    unsigned Threads = WorkStealingPool::default_threads();
+    std::vector<const char *> Dirs;
+    for (int I = 2; I < argc; ++I) {
+        if (std::strcmp(argv[I], "--threads") == 0 && I + 1 < argc) {
+            Threads = std::strtoul(argv[++I], nullptr, 10);
+        } else {
+            Dirs.push_back(argv[I]);
+        }
+    }
+    if (Dirs.empty())
+        Dirs.push_back(".");
+
+    // Requests sent here must not come back.
+    unsetenv("FORO_CLANG_FORMAT_DAEMON");
+
+    ConfigWatcher Watcher([](bool Complete) {
+        // Without a complete watch, config files are checked as usual.
+        if (!Complete)
+            foro_config_watch(0, 0);
+        foro_config_changed();
+    });
+    // The watched roots, each followed by a NUL. Files elsewhere have their
+    // config files checked as usual.
+    std::string Roots;
+    bool Watching = Watcher.ok();
+    for (const char *Dir : Dirs) {
+        const std::string Root = watch_root(Watcher, Dir);
+        if (Root.empty()) {
+            std::fprintf(stderr, "cannot watch %s\n", Dir);
+            Watching = false;
+        }
+        Roots += Root;
+        Roots += '\0';
+    }
+    if (Watching && Watcher.complete()) {
+        foro_config_watch(reinterpret_cast<uint64_t>(Roots.data()),
+                          Roots.size());
+        // In case the watch broke just now, before trust was given.
+        if (!Watcher.complete())
+            foro_config_watch(0, 0);
+    } else {
+        std::fprintf(stderr, "config files are checked on every request\n");
+    }
+
+    const int Listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un Address{};
+    Address.sun_family = AF_UNIX;
+    std::strcpy(Address.sun_path, SocketPath);
+
+    // A socket left behind by a daemon that died is in the way.
+    struct stat Status;
+    if (lstat(SocketPath, &Status) == 0 && S_ISSOCK(Status.st_mode))
+        unlink(SocketPath);
+
+    const mode_t Mask = umask(0077);
+    const bool Bound =
+        Listener >= 0 &&
+        bind(Listener, reinterpret_cast<const sockaddr *>(&Address),
+             sizeof(Address)) == 0;
+    umask(Mask);
+    if (!Bound || listen(Listener, 64) != 0) {
+        std::perror(SocketPath);
+        return 1;
+    }
+
+    std::signal(SIGPIPE, SIG_IGN);
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+
+    WorkStealingPool Pool(Threads);
+    std::counting_semaphore<MaxConnections> Connections(MaxConnections);
+    for (;;) {
+        // Clients past the limit wait in the backlog.
+        Connections.acquire();
+        int Fd;
+        while ((Fd = accept4(Listener, nullptr, nullptr, SOCK_CLOEXEC)) < 0) {
+            // Out of descriptors or buffers, most likely: give the open
+            // connections time to close rather than spin.
+            if (errno != EINTR && errno != ECONNABORTED)
+                std::this_thread::sleep_for(AcceptBackoff);
+        }
+        try {
+            std::thread([Fd, &Pool, &Connections] {
+                serve(Fd, Pool);
+                Connections.release();
+            }).detach();
+        } catch (const std::system_error &) {
+            close(Fd);
+            Connections.release();
+            std::this_thread::sleep_for(AcceptBackoff);
+        }
+    }
+}
@@ -0,0 +1,146 @@
+#include "daemon_client.h"
+
+#include <cstring>
+#include <string_view>
+
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace daemon_client {
+
+namespace {
+
+#ifdef MSG_NOSIGNAL
+constexpr int SendFlags = MSG_NOSIGNAL;
+#else
+constexpr int SendFlags = 0;
+#endif
+
+// The connection of the calling thread, closed when the thread exits.
+struct Connection {
+    int fd = -1;
+
+    ~Connection() { close_fd(); }
+
+    void close_fd() {
+        if (fd >= 0)
+            close(fd);
+        fd = -1;
+    }
+};
+
+thread_local Connection Current;
+
+auto connect_to(const char *socket_path) -> int {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (std::strlen(socket_path) >= sizeof(address.sun_path))
+        return -1;
+    std::strcpy(address.sun_path, socket_path);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+#ifdef SO_NOSIGPIPE
+    const int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    if (connect(fd, reinterpret_cast<const sockaddr *>(&address),
+                sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+auto send_all(int fd, const uint8_t *data, size_t len) -> bool {
+    while (len > 0) {
+        const ssize_t n = send(fd, data, len, SendFlags);
+        if (n <= 0)
+            return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+auto recv_all(int fd, uint8_t *data, size_t len) -> bool {
+    while (len > 0) {
+        const ssize_t n = recv(fd, data, len, 0);
+        if (n <= 0)
+            return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+auto le64(uint64_t value, uint8_t *out) -> void {
+    for (int i = 0; i < 8; ++i)
+        out[i] = static_cast<uint8_t>(value >> (8 * i));
+}
+
+auto read_le64(const uint8_t *in) -> uint64_t {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; ++i)
+        value |= static_cast<uint64_t>(in[i]) << (8 * i);
+    return value;
+}
+
+// One exchange over `fd`. Returns nullptr if the connection failed.
+auto exchange(int fd, std::string_view dir, const uint8_t *request,
+              size_t len, alloc_fn alloc, free_fn release) -> uint8_t * {
+    uint8_t header[8];
+    le64(dir.size(), header);
+    if (!send_all(fd, header, 8) ||
+        !send_all(fd, reinterpret_cast<const uint8_t *>(dir.data()),
+                  dir.size())) {
+        return nullptr;
+    }
+    le64(len, header);
+    if (!send_all(fd, header, 8) || !send_all(fd, request, len) ||
+        !recv_all(fd, header, 8)) {
+        return nullptr;
+    }
+
+    const uint64_t size = read_le64(header);
+    uint8_t *result = alloc(size);
+    if (!recv_all(fd, result + 8, size)) {
+        release(result);
+        return nullptr;
+    }
+    return result;
+}
+
+} // namespace
+
+auto forward(const char *socket_path, const uint8_t *request, size_t len,
+             alloc_fn alloc, free_fn release) -> uint8_t * {
+    // Relative paths in the request mean nothing in the daemon's own working
+    // directory.
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd)))
+        return nullptr;
+    const std::string_view dir = cwd;
+
+    // A kept connection may have been dropped by a restarted daemon; a fresh
+    // one gets a second try.
+    const bool kept = Current.fd >= 0;
+    for (int attempt = kept ? 0 : 1; attempt < 2; ++attempt) {
+        if (Current.fd < 0)
+            Current.fd = connect_to(socket_path);
+        if (Current.fd < 0)
+            return nullptr;
+
+        if (uint8_t *result =
+                exchange(Current.fd, dir, request, len, alloc, release)) {
+            return result;
+        }
+        Current.close_fd();
+    }
+    return nullptr;
+}
+
+} // namespace daemon_client
@@ -0,0 +1,30 @@
+#ifndef FORO_CLANG_FORMAT_DAEMON_CLIENT_H_
+#define FORO_CLANG_FORMAT_DAEMON_CLIENT_H_
+
+#include <cstddef>
+#include <cstdint>
+
+// Hands `foro_main` requests to a resident daemon over a Unix socket, so that
+// short-lived hosts get its warm caches. Over a stream connection, the
+// client sends the absolute path of its working directory, against which
+// relative paths in the request resolve, and then the request bytes, exactly
+// what `foro_main` takes, each as a u64 length, little-endian, followed by
+// the bytes. The daemon answers with a result as `foro_main` returns it, a
+// u64 length followed by that many bytes. A connection carries any number of
+// requests, one at a time.
+namespace daemon_client {
+
+using alloc_fn = uint8_t *(*)(size_t size);
+using free_fn = void (*)(uint8_t *result);
+
+// Sends `request` to the daemon at `socket_path` and returns its reply, in a
+// result from `alloc`, which gets the size without the length prefix and
+// writes that prefix. Returns nullptr if the daemon can't be reached or hangs
+// up, or if the working directory is unknown, for the caller to format the
+// request itself. Each thread keeps its connection open between calls.
+auto forward(const char *socket_path, const uint8_t *request, size_t len,
+             alloc_fn alloc, free_fn release) -> uint8_t *;
+
+} // namespace daemon_client
+
+#endif
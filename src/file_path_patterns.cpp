@@ -0,0 +1,335 @@
+#include "file_path_patterns.h"
+
+#include <string>
+
+namespace clang {
+namespace format {
+
+constexpr auto Separator = '/';
+
+static auto set_char(uint64_t *Chars, char C) -> void {
+    const auto Byte = static_cast<unsigned char>(C);
+    Chars[Byte / 64] |= uint64_t{1} << (Byte % 64);
+}
+
+static auto has_char(const uint64_t *Chars, unsigned Byte) -> bool {
+    return Chars[Byte / 64] >> (Byte % 64) & 1;
+}
+
+// `Out = In << 1` across word boundaries.
+static auto shift_left(const uint64_t *In, uint64_t *Out, unsigned Words)
+    -> void {
+    uint64_t Carry = 0;
+    for (unsigned W = 0; W < Words; ++W) {
+        const uint64_t Word = In[W];
+        Out[W] = Word << 1 | Carry;
+        Carry = Word >> 63;
+    }
+}
+
+// Adds every state reachable from `States` through stars in `Mask` that match
+// the empty string.
+static auto close_over(uint64_t *States, const uint64_t *Mask, unsigned Words)
+    -> void {
+    SmallVector<uint64_t, 8> From(Words), To(Words);
+    for (;;) {
+        for (unsigned W = 0; W < Words; ++W)
+            From[W] = States[W] & Mask[W];
+        shift_left(From.data(), To.data(), Words);
+
+        bool Changed = false;
+        for (unsigned W = 0; W < Words; ++W) {
+            if (To[W] & ~States[W]) {
+                States[W] |= To[W];
+                Changed = true;
+            }
+        }
+        if (!Changed)
+            return;
+    }
+}
+
+// Translates `Pattern` the way `matchFilePath` interprets it.
+auto FilePathPatterns::add(StringRef Pattern, bool Negated) -> void {
+    std::vector<State> Chain;
+
+    auto Literal = [](char C) {
+        State S{};
+        set_char(S.Chars, C);
+        return S;
+    };
+    auto AnyButSeparator = [] {
+        State S{};
+        for (auto &Word : S.Chars)
+            Word = ~uint64_t{0};
+        S.Chars[Separator / 64] &= ~(uint64_t{1} << (Separator % 64));
+        return S;
+    };
+
+    const auto EOP = Pattern.size(); // End of `Pattern`.
+    unsigned I = 0;                  // Index to `Pattern`.
+    bool Matchable = !Pattern.empty();
+
+    while (Matchable && I < EOP) {
+        switch (Pattern[I]) {
+        case '\\':
+            if (++I == EOP) {
+                Matchable = false; // A lone trailing backslash.
+                break;
+            }
+            Chain.push_back(Literal(Pattern[I++]));
+            break;
+        case '?':
+            Chain.push_back(AnyButSeparator());
+            ++I;
+            break;
+        case '*': {
+            while (++I < EOP && Pattern[I] == '*') { // Skip consecutive stars.
+            }
+            State Star{};
+            Star.Star = true;
+            Star.Skip = true;
+            // `matchFilePath` drops a backslash right after a star and matches
+            // the rest of the pattern, unescaped, against what follows each
+            // non-slash character.
+            if (I < EOP && Pattern[I] == '\\') {
+                if (++I == EOP) {
+                    Matchable = false;
+                    break;
+                }
+                if (Pattern[I] != Separator) {
+                    Star.Skip = false;
+                    Star.SkipIfMore = true;
+                }
+            }
+            Chain.push_back(Star);
+            break;
+        }
+        case '[':
+            // Skip e.g. `[!]`.
+            if (I + 3 < EOP || (I + 3 == EOP && Pattern[I + 1] != '!')) {
+                // Skip unpaired `[`, brackets containing slashes, and `[]`.
+                if (const auto K = Pattern.find_first_of("]/", I + 1);
+                    K != StringRef::npos && Pattern[K] == ']' && K > I + 1) {
+                    State Class{};
+                    ++I; // After the `[`.
+                    bool IsNegated = false;
+                    if (Pattern[I] == '!') {
+                        IsNegated = true;
+                        ++I; // After the `!`.
+                    }
+                    do {
+                        if (I + 2 < K && Pattern[I + 1] == '-') {
+                            for (unsigned Byte = 0; Byte < 256; ++Byte) {
+                                const auto F = static_cast<char>(Byte);
+                                if (Pattern[I] <= F && F <= Pattern[I + 2])
+                                    set_char(Class.Chars, F);
+                            }
+                            I += 3; // After the range, e.g. `A-Z`.
+                        } else {
+                            set_char(Class.Chars, Pattern[I++]);
+                        }
+                    } while (I < K);
+                    if (IsNegated) {
+                        for (auto &Word : Class.Chars)
+                            Word = ~Word;
+                    }
+                    Class.Chars[Separator / 64] &=
+                        ~(uint64_t{1} << (Separator % 64));
+                    Chain.push_back(Class);
+                    I = K + 1; // After the `]`.
+                    break;
+                }
+            }
+            [[fallthrough]]; // Match `[` literally.
+        default:
+            Chain.push_back(Literal(Pattern[I++]));
+        }
+    }
+
+    if (!Matchable) {
+        Patterns.push_back({Dead, Dead, Negated});
+        if (Negated)
+            AlwaysIgnored = true;
+        return;
+    }
+
+    Chain.push_back(State{}); // Accepting state, with no way out.
+
+    const auto First = static_cast<unsigned>(States.size());
+    Starts.push_back(First);
+    States.insert(States.end(), Chain.begin(), Chain.end());
+    Patterns.push_back(
+        {First, static_cast<unsigned>(States.size() - 1), Negated});
+}
+
+auto FilePathPatterns::compile() -> void {
+    Words = (States.size() + 63) / 64;
+    if (Words == 0)
+        Words = 1;
+
+    Start.assign(Words, 0);
+    Loop.assign(Words, 0);
+    Skip.assign(Words, 0);
+    AnySkip.assign(Words, 0);
+    Step.assign(256 * Words, 0);
+
+    auto Set = [](std::vector<uint64_t> &Bits, size_t Offset, size_t Index) {
+        Bits[Offset + Index / 64] |= uint64_t{1} << (Index % 64);
+    };
+
+    for (const auto Index : Starts)
+        Set(Start, 0, Index);
+
+    for (size_t Index = 0; Index < States.size(); ++Index) {
+        const auto &S = States[Index];
+        if (S.Star)
+            Set(Loop, 0, Index);
+        if (S.Skip)
+            Set(Skip, 0, Index);
+        if (S.Skip || S.SkipIfMore)
+            Set(AnySkip, 0, Index);
+        for (unsigned Byte = 0; Byte < 256; ++Byte) {
+            if (has_char(S.Chars, Byte))
+                Set(Step, Byte * Words, Index);
+        }
+    }
+
+    close_over(Start.data(), Skip.data(), Words);
+    reset_dfa();
+}
+
+auto FilePathPatterns::reset_dfa() const -> void {
+    DfaIds.clear();
+    DfaSets.clear();
+    DfaNext.clear();
+    DfaIgnored.clear();
+
+    const std::vector<uint64_t> Empty(Words, 0);
+    intern(Empty.data());
+    StartState = intern(Start.data());
+}
+
+auto FilePathPatterns::intern(const uint64_t *Set) const -> unsigned {
+    const StringRef Key(reinterpret_cast<const char *>(Set),
+                        Words * sizeof(uint64_t));
+    const auto [It, Inserted] = DfaIds.try_emplace(Key, DfaIgnored.size());
+    if (Inserted) {
+        DfaSets.insert(DfaSets.end(), Set, Set + Words);
+        DfaNext.resize(DfaNext.size() + 256, ~uint32_t{0});
+        DfaIgnored.push_back(-1);
+    }
+    return It->second;
+}
+
+auto FilePathPatterns::step(const uint64_t *From, char C, uint64_t *To) const
+    -> void {
+    SmallVector<uint64_t, 8> Current(From, From + Words), Advanced(Words);
+
+    // A star followed by an escape only skips ahead of a non-slash byte.
+    const bool IsSeparator = C == Separator;
+    if (!IsSeparator)
+        close_over(Current.data(), AnySkip.data(), Words);
+
+    const uint64_t *Table = &Step[static_cast<unsigned char>(C) * Words];
+    for (unsigned W = 0; W < Words; ++W)
+        Advanced[W] = Current[W] & Table[W];
+    shift_left(Advanced.data(), To, Words);
+    if (!IsSeparator) {
+        for (unsigned W = 0; W < Words; ++W)
+            To[W] |= Current[W] & Loop[W];
+    }
+
+    close_over(To, Skip.data(), Words);
+}
+
+auto FilePathPatterns::run(StringRef FilePath) const -> unsigned {
+    SmallVector<uint64_t, 8> Next(Words);
+    unsigned Current = StartState;
+
+    for (const char C : FilePath) {
+        if (Current == 0)
+            break; // Nothing can match any more.
+
+        const auto Byte = static_cast<unsigned char>(C);
+        if (const auto Known = DfaNext[Current * 256 + Byte]; Known != ~0U) {
+            Current = Known;
+            continue;
+        }
+
+        step(&DfaSets[Current * Words], C, Next.data());
+        if (DfaIgnored.size() >= MaxDfaStates) {
+            reset_dfa();
+            Current = intern(Next.data());
+            continue;
+        }
+        const unsigned Target = intern(Next.data());
+        DfaNext[Current * 256 + Byte] = Target;
+        Current = Target;
+    }
+
+    return Current;
+}
+
+auto FilePathPatterns::match(StringRef FilePath) const -> std::vector<bool> {
+    std::vector<bool> Matched(Patterns.size(), false);
+    if (FilePath.empty())
+        return Matched;
+
+    const uint64_t *Final = &DfaSets[run(FilePath) * Words];
+    for (size_t I = 0; I < Patterns.size(); ++I) {
+        const auto Accept = Patterns[I].Accept;
+        Matched[I] = Accept != Dead && (Final[Accept / 64] >> (Accept % 64) & 1);
+    }
+    return Matched;
+}
+
+auto FilePathPatterns::is_ignored(StringRef FilePath) const -> bool {
+    if (AlwaysIgnored)
+        return true;
+    if (Patterns.empty() || FilePath.empty())
+        return false;
+
+    const unsigned Final = run(FilePath);
+    if (DfaIgnored[Final] < 0) {
+        const uint64_t *Set = &DfaSets[Final * Words];
+        bool Ignored = false;
+        for (const auto &P : Patterns) {
+            const bool Matched =
+                P.Accept != Dead && (Set[P.Accept / 64] >> (P.Accept % 64) & 1);
+            if (Matched != P.Negated) {
+                Ignored = true;
+                break;
+            }
+        }
+        DfaIgnored[Final] = Ignored;
+    }
+    return DfaIgnored[Final];
+}
+
+auto FilePathPatterns::ignores_all_below(StringRef Dir) const -> bool {
+    if (AlwaysIgnored)
+        return true;
+    if (Patterns.empty() || Dir.empty())
+        return false;
+
+    std::string Prefix = Dir.str();
+    if (Prefix.back() != Separator)
+        Prefix += Separator;
+
+    // A pattern none of whose states survive the prefix can't match below it.
+    const uint64_t *Set = &DfaSets[run(Prefix) * Words];
+    for (const auto &P : Patterns) {
+        if (!P.Negated || P.Accept == Dead)
+            continue;
+        bool Live = false;
+        for (unsigned S = P.First; S <= P.Accept && !Live; ++S)
+            Live = Set[S / 64] >> (S % 64) & 1;
+        if (!Live)
+            return true;
+    }
+    return false;
+}
+
+} // namespace format
+} // namespace clang
@@ -0,0 +1,100 @@
+#ifndef FORO_CLANG_FORMAT_FILE_PATH_PATTERNS_H_
+#define FORO_CLANG_FORMAT_FILE_PATH_PATTERNS_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "clang/Basic/LLVM.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+namespace clang {
+namespace format {
+
+// A set of `matchFilePath` patterns compiled into one automaton. Every pattern
+// becomes a chain of NFA states, one per character class or star, and the sets
+// of NFA states that paths actually reach are turned into DFA states on first
+// use. After warming up, checking a path against the whole set costs one table
+// lookup per path character, whatever the patterns look like; the DFA is
+// bounded and simply rebuilt when it grows too large.
+//
+// Matching follows `matchFilePath` exactly, including its treatment of an
+// escape right after a star, so a compiled set always agrees with the
+// pattern-by-pattern loop it replaces.
+//
+// The DFA is built during lookups, so a set must not be shared between threads.
+class FilePathPatterns {
+  public:
+    auto add(StringRef Pattern, bool Negated = false) -> void;
+
+    // Builds the transition tables; call once after the last `add`.
+    auto compile() -> void;
+
+    auto size() const -> size_t { return Patterns.size(); }
+
+    // Whether each pattern, in the order added, matches `FilePath`.
+    auto match(StringRef FilePath) const -> std::vector<bool>;
+
+    // The `.clang-format-ignore` rule: `FilePath` is ignored if it matches a
+    // pattern or fails to match a negated one. Any such pattern decides the
+    // outcome on its own, so the order of the patterns does not matter.
+    auto is_ignored(StringRef FilePath) const -> bool;
+
+    // Whether `is_ignored` holds for every path below the directory `Dir`,
+    // because a negated pattern can't match anything that starts with
+    // `Dir` and a slash. False when that can't be told from the prefix.
+    auto ignores_all_below(StringRef Dir) const -> bool;
+
+  private:
+    struct State {
+        uint64_t Chars[4]; // Bytes that advance to the next state.
+        bool Star;         // Loops on any byte but a slash.
+        bool Skip;         // A star that may match the empty string.
+        bool SkipIfMore;   // Ditto, but only if a byte other than a slash
+                           // follows.
+    };
+
+    struct Pattern {
+        unsigned First;  // First state of the chain, or `Dead`.
+        unsigned Accept; // Final state, or `Dead` if it can never match.
+        bool Negated;
+    };
+
+    static constexpr unsigned Dead = ~0U;
+    static constexpr unsigned MaxDfaStates = 1024;
+
+    // The DFA state reached after the whole of `FilePath`.
+    auto run(StringRef FilePath) const -> unsigned;
+
+    // One NFA step over `C`, including the empty matches of stars.
+    auto step(const uint64_t *From, char C, uint64_t *To) const -> void;
+
+    auto intern(const uint64_t *Set) const -> unsigned;
+    auto reset_dfa() const -> void;
+
+    std::vector<State> States; // The chains of all patterns, back to back.
+    std::vector<Pattern> Patterns;
+    std::vector<unsigned> Starts;
+
+    // Bit sets over `States`, `Words` 64-bit words each.
+    unsigned Words{0};
+    std::vector<uint64_t> Start;
+    std::vector<uint64_t> Loop;
+    std::vector<uint64_t> Skip;
+    std::vector<uint64_t> AnySkip; // `Skip` or `SkipIfMore`.
+    std::vector<uint64_t> Step;    // One set per byte value.
+
+    bool AlwaysIgnored{false}; // A negated pattern can never match.
+
+    // The lazily built DFA. State 0 is the empty set.
+    mutable unsigned StartState{0};
+    mutable llvm::StringMap<unsigned> DfaIds; // NFA state set -> DFA state.
+    mutable std::vector<uint64_t> DfaSets;    // `Words` per DFA state.
+    mutable std::vector<uint32_t> DfaNext;    // 256 per DFA state.
+    mutable std::vector<int8_t> DfaIgnored;   // -1 until computed.
+};
+
+} // namespace format
+} // namespace clang
+
+#endif
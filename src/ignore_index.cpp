@@ -0,0 +1,184 @@
+#include "ignore_index.h"
+
+#include <algorithm>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+
+using namespace llvm;
+
+namespace clang {
+namespace format {
+
+static auto modification_time(StringRef Dir) -> sys::TimePoint<> {
+    sys::fs::file_status Status;
+    if (sys::fs::status(Dir, Status))
+        return {};
+    return Status.getLastModificationTime();
+}
+
+auto IgnoreIndex::governing_file(StringRef Dir) -> const std::string & {
+    // An ignore file may have been created in the chain since it was listed.
+    if (!trusted(Dir) && !chain_fresh(Dir))
+        Dirs.clear();
+    return lookup(Dir);
+}
+
+auto IgnoreIndex::lookup(StringRef Dir) -> const std::string & {
+    if (auto It = Dirs.find(Dir); It != Dirs.end())
+        return It->second.File;
+
+    // Taken before looking, so that a file created meanwhile makes the entry
+    // stale rather than silently wrong.
+    const sys::TimePoint<> ModTime = modification_time(Dir);
+
+    std::string File;
+    SmallString<128> Path(Dir);
+    sys::path::append(Path, ".clang-format-ignore");
+    if (sys::fs::is_regular_file(Path)) {
+        File = Path.str().str();
+    } else if (StringRef Parent = sys::path::parent_path(Dir);
+               !Parent.empty() && Parent != Dir) {
+        File = lookup(Parent);
+    }
+
+    DirEntry &Listed = Dirs[Dir];
+    Listed = {std::move(File), ModTime};
+    return Listed.File;
+}
+
+auto IgnoreIndex::chain_fresh(StringRef Dir) const -> bool {
+    for (;;) {
+        if (auto It = Dirs.find(Dir);
+            It != Dirs.end() && modification_time(Dir) != It->second.ModTime)
+            return false;
+        const StringRef Parent = sys::path::parent_path(Dir);
+        if (Parent.empty() || Parent == Dir)
+            return true;
+        Dir = Parent;
+    }
+}
+
+auto IgnoreIndex::trusted(StringRef Dir) const -> bool {
+    if (InPass)
+        return true;
+    return std::any_of(
+        TrustedRoots.begin(), TrustedRoots.end(), [&](const std::string &Root) {
+            return Dir.starts_with(Root) &&
+                   (Dir.size() == Root.size() || Root.ends_with("/") ||
+                    sys::path::is_separator(Dir[Root.size()]));
+        });
+}
+
+auto IgnoreIndex::load(const std::string &Path) -> const IgnoreFile * {
+    sys::fs::file_status Status;
+    if (sys::fs::status(Path, Status) ||
+        Status.type() != sys::fs::file_type::regular_file) {
+        Files.erase(Path);
+        return nullptr;
+    }
+
+    if (auto It = Files.find(Path);
+        It != Files.end() &&
+        It->second.ModTime == Status.getLastModificationTime() &&
+        It->second.Size == Status.getSize()) {
+        return &It->second;
+    }
+
+    IgnoreFile File{Status.getLastModificationTime(), Status.getSize(), {}};
+
+    if (auto Buffer = MemoryBuffer::getFile(Path, /*IsText=*/true)) {
+        using namespace llvm::sys::path;
+        const auto IgnoreDir{convert_to_slash(parent_path(Path))};
+
+        SmallVector<StringRef> Lines;
+        (*Buffer)->getBuffer().split(Lines, '\n');
+
+        for (StringRef Line : Lines) {
+            auto Pattern{Line.trim()};
+            // Skip empty and comment lines.
+            if (Pattern.empty() || Pattern[0] == '#')
+                continue;
+
+            const bool IsNegated = Pattern[0] == '!';
+            if (IsNegated)
+                Pattern = Pattern.drop_front();
+
+            if (Pattern.empty())
+                continue;
+
+            Pattern = Pattern.ltrim();
+
+            // `Pattern` is relative to `IgnoreDir` unless it starts with a
+            // slash. This doesn't support patterns containing drive names
+            // (e.g. `C:`).
+            SmallString<128> Glob;
+            if (Pattern[0] == '/') {
+                Glob = Pattern;
+            } else {
+                Glob = IgnoreDir;
+                append(Glob, Style::posix, Pattern);
+                remove_dots(Glob, /*remove_dot_dot=*/true, Style::posix);
+            }
+
+            File.Patterns.add(Glob, IsNegated);
+        }
+    }
+    File.Patterns.compile();
+
+    return &Files.insert_or_assign(Path, std::move(File)).first->second;
+}
+
+auto IgnoreIndex::is_ignored(StringRef FilePath) -> bool {
+    using namespace llvm::sys::fs;
+    if (!is_regular_file(FilePath))
+        return false;
+
+    SmallString<128> AbsPath{FilePath};
+
+    using namespace llvm::sys::path;
+    make_absolute(AbsPath);
+    remove_dots(AbsPath, /*remove_dot_dot=*/true);
+
+    return is_ignored_file(AbsPath);
+}
+
+auto IgnoreIndex::is_ignored_file(StringRef AbsPath) -> bool {
+    using namespace llvm::sys::path;
+    const std::string &IgnorePath = governing_file(parent_path(AbsPath));
+    if (IgnorePath.empty())
+        return false;
+
+    const IgnoreFile *File = load(IgnorePath);
+    if (!File) {
+        // The ignore file went away; every directory mapped to it is stale.
+        Dirs.clear();
+        return is_ignored_file(AbsPath);
+    }
+
+    return File->Patterns.is_ignored(convert_to_slash(AbsPath));
+}
+
+auto IgnoreIndex::ignores_all_below(StringRef Dir) -> bool {
+    const std::string &IgnorePath = governing_file(Dir);
+    if (IgnorePath.empty())
+        return false;
+
+    const IgnoreFile *File = load(IgnorePath);
+    if (!File) {
+        Dirs.clear();
+        return ignores_all_below(Dir);
+    }
+
+    return File->Patterns.ignores_all_below(sys::path::convert_to_slash(Dir));
+}
+
+auto IgnoreIndex::clear() -> void {
+    Dirs.clear();
+    Files.clear();
+}
+
+} // namespace format
+} // namespace clang
@@ -0,0 +1,80 @@
+#ifndef FORO_CLANG_FORMAT_IGNORE_INDEX_H_
+#define FORO_CLANG_FORMAT_IGNORE_INDEX_H_
+
+#include <string>
+#include <vector>
+
+#include "file_path_patterns.h"
+#include "clang/Basic/LLVM.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Chrono.h"
+
+namespace clang {
+namespace format {
+
+// Answers `.clang-format-ignore` queries. Every directory is mapped to the
+// ignore file that governs it (the nearest one in it or its ancestors), and
+// every ignore file is parsed once into absolute patterns compiled into a
+// single matcher, so the cost of a lookup does not depend on the order in
+// which files are queried. An ignore file is re-read when its modification
+// time or size changes, and a directory's mapping is redone when the
+// modification time of a directory from it up says an ignore file may have
+// been created there since.
+class IgnoreIndex {
+  public:
+    auto is_ignored(StringRef FilePath) -> bool;
+
+    // `is_ignored` for a path that is known to be a regular file and is
+    // already absolute and free of dots, as a directory walk produces them.
+    auto is_ignored_file(StringRef AbsPath) -> bool;
+
+    // Whether the ignore file governing the absolute directory `Dir` ignores
+    // every path below it. A directory further down may still have an ignore
+    // file of its own, which then governs instead.
+    auto ignores_all_below(StringRef Dir) -> bool;
+
+    // As for `StyleCache`: between these, and for paths under one of `Roots`,
+    // directories are not checked for new ignore files.
+    auto begin_pass() -> void { InPass = true; }
+    auto end_pass() -> void { InPass = false; }
+    auto trust_under(std::vector<std::string> Roots) -> void {
+        TrustedRoots = std::move(Roots);
+    }
+
+    auto clear() -> void;
+
+  private:
+    struct IgnoreFile {
+        llvm::sys::TimePoint<> ModTime;
+        uint64_t Size;
+        FilePathPatterns Patterns; // Absolute, with forward slashes.
+    };
+
+    // The ignore file governing a directory, and when the directory itself
+    // was last modified as it was looked for.
+    struct DirEntry {
+        std::string File;
+        llvm::sys::TimePoint<> ModTime;
+    };
+
+    // Path of the ignore file governing `Dir`, or an empty string. Unless
+    // trusted, the mapping is checked first.
+    auto governing_file(StringRef Dir) -> const std::string &;
+    auto lookup(StringRef Dir) -> const std::string &;
+    // Whether no listed directory from `Dir` up has changed since `lookup`
+    // looked at it.
+    auto chain_fresh(StringRef Dir) const -> bool;
+    auto trusted(StringRef Dir) const -> bool;
+    auto load(const std::string &Path) -> const IgnoreFile *;
+
+    llvm::StringMap<DirEntry> Dirs;
+    llvm::StringMap<IgnoreFile> Files;
+
+    bool InPass{false};
+    std::vector<std::string> TrustedRoots;
+};
+
+} // namespace format
+} // namespace clang
+
+#endif
@@ -0,0 +1,126 @@
+#include "job_queue.h"
+
+JobQueue::JobQueue(unsigned Threads, Runner Run, Releaser Release)
+    : Run(std::move(Run)), Release(std::move(Release)), Pool(Threads) {}
+
+auto JobQueue::submit(std::string Request, uint64_t Key) -> uint64_t {
+    auto J = std::make_shared<Job>();
+    J->Request = std::move(Request);
+    J->Key = Key;
+
+    uint64_t Ticket;
+    bool Superseded = false;
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        if (Key != 0) {
+            // A finished job's result stays for its ticket to collect.
+            if (auto It = Latest.find(Key); It != Latest.end()) {
+                auto Previous = Jobs.find(It->second);
+                if (Previous != Jobs.end() && !Previous->second->Done)
+                    Superseded = cancel_locked(It->second);
+            }
+        }
+        Ticket = NextTicket++;
+        Jobs.emplace(Ticket, J);
+        if (Key != 0)
+            Latest[Key] = Ticket;
+    }
+    if (Superseded)
+        Finished.notify_all();
+
+    Pool.submit([this, J] { run(J); });
+    return Ticket;
+}
+
+auto JobQueue::run(const std::shared_ptr<Job> &J) -> void {
+    uint8_t *Result = nullptr;
+    if (!J->Cancelled.load(std::memory_order_relaxed)) {
+        try {
+            Result = Run(J->Request, J->Cancelled);
+        } catch (...) {
+            // Reported as a job without a result.
+        }
+    }
+    J->Request = std::string();
+
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        if (!J->Cancelled.load(std::memory_order_relaxed)) {
+            J->Done = true;
+            J->Result = Result;
+            Result = nullptr;
+        }
+    }
+    Finished.notify_all();
+    if (Result)
+        Release(Result);
+}
+
+auto JobQueue::forget(uint64_t Ticket, const Job &J) -> void {
+    if (J.Key != 0) {
+        if (auto It = Latest.find(J.Key);
+            It != Latest.end() && It->second == Ticket) {
+            Latest.erase(It);
+        }
+    }
+    Jobs.erase(Ticket);
+}
+
+auto JobQueue::collect(uint64_t Ticket) -> Outcome {
+    auto It = Jobs.find(Ticket);
+    if (It == Jobs.end())
+        return {State::Unknown, nullptr};
+    if (!It->second->Done)
+        return {State::Pending, nullptr};
+
+    const std::shared_ptr<Job> J = It->second;
+    forget(Ticket, *J);
+    return {State::Done, J->Result};
+}
+
+auto JobQueue::poll(uint64_t Ticket) -> Outcome {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    return collect(Ticket);
+}
+
+auto JobQueue::wait(uint64_t Ticket,
+                    std::optional<std::chrono::milliseconds> Timeout)
+    -> Outcome {
+    std::unique_lock<std::mutex> Lock(Mutex);
+    auto Settled = [&] {
+        auto It = Jobs.find(Ticket);
+        return It == Jobs.end() || It->second->Done;
+    };
+    if (Timeout)
+        Finished.wait_for(Lock, *Timeout, Settled);
+    else
+        Finished.wait(Lock, Settled);
+    return collect(Ticket);
+}
+
+auto JobQueue::cancel_locked(uint64_t Ticket) -> bool {
+    auto It = Jobs.find(Ticket);
+    if (It == Jobs.end())
+        return false;
+
+    const std::shared_ptr<Job> J = It->second;
+    forget(Ticket, *J);
+    if (J->Done) {
+        if (J->Result)
+            Release(J->Result);
+        return false;
+    }
+    J->Cancelled.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+auto JobQueue::cancel(uint64_t Ticket) -> bool {
+    bool Cancelled;
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        Cancelled = cancel_locked(Ticket);
+    }
+    // Wakes waiters on the ticket, which is gone now.
+    Finished.notify_all();
+    return Cancelled;
+}
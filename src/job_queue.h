@@ -0,0 +1,91 @@
+#ifndef FORO_CLANG_FORMAT_JOB_QUEUE_H_
+#define FORO_CLANG_FORMAT_JOB_QUEUE_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include "thread_pool.h"
+
+// Requests run in the background, behind `foro_submit`. Each job gets a
+// ticket, and its result waits under that ticket until it is collected.
+//
+// A job can be cancelled by its ticket, or superseded by a newer job with the
+// same key, such as a later version of the same buffer. A cancelled job that
+// hasn't started never runs; one that is running sees its `Cancelled` flag
+// set and is expected to stop early. Either way its ticket is forgotten at
+// once and its result, if one still comes, is released unseen.
+class JobQueue {
+  public:
+    // Runs a request and returns its result, which the queue owns until it is
+    // collected.
+    using Runner = std::function<uint8_t *(const std::string &Request,
+                                           const std::atomic<bool> &Cancelled)>;
+    using Releaser = std::function<void(uint8_t *Result)>;
+
+    JobQueue(unsigned Threads, Runner Run, Releaser Release);
+
+    JobQueue(const JobQueue &) = delete;
+    JobQueue &operator=(const JobQueue &) = delete;
+
+    // Queues `Request` and returns its ticket, which is never 0. Unless `Key`
+    // is 0, the unfinished jobs submitted with the same key are cancelled;
+    // finished ones keep their results until they are collected.
+    auto submit(std::string Request, uint64_t Key) -> uint64_t;
+
+    enum class State { Pending, Done, Unknown };
+
+    struct Outcome {
+        State Status;
+        uint8_t *Result; // Handed over to the caller, for `Done`.
+    };
+
+    // Collects the result of `Ticket` if it is done, which forgets the ticket.
+    auto poll(uint64_t Ticket) -> Outcome;
+
+    // `poll`, after waiting up to `Timeout`, or as long as it takes without
+    // one, for the job to finish.
+    auto wait(uint64_t Ticket,
+              std::optional<std::chrono::milliseconds> Timeout) -> Outcome;
+
+    // Returns whether the job was cancelled before it finished. A finished
+    // job's result is released.
+    auto cancel(uint64_t Ticket) -> bool;
+
+  private:
+    struct Job {
+        std::string Request;
+        uint64_t Key;
+        std::atomic<bool> Cancelled{false};
+        bool Done{false};
+        uint8_t *Result{nullptr};
+    };
+
+    auto run(const std::shared_ptr<Job> &J) -> void;
+
+    // The caller holds `Mutex`.
+    auto collect(uint64_t Ticket) -> Outcome;
+    auto cancel_locked(uint64_t Ticket) -> bool;
+    auto forget(uint64_t Ticket, const Job &J) -> void;
+
+    Runner Run;
+    Releaser Release;
+
+    std::mutex Mutex;
+    std::condition_variable Finished;
+    std::unordered_map<uint64_t, std::shared_ptr<Job>> Jobs;
+    std::unordered_map<uint64_t, uint64_t> Latest; // Key -> ticket.
+    uint64_t NextTicket{1};
+
+    // Last, so that its workers are joined before anything they use goes.
+    WorkStealingPool Pool;
+};
+
+#endif
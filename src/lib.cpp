@@ -19,50 +19,63 @@
 // https://github.com/wasm-fmt/clang-format/blob/80aa6c2fa728927dcc21d4fb7bee1e2c2c6853ed/LICENSE
 // ----------------------------------------------------------------------------
 
-#include <fstream>
-
 #include "lib.h"
-#include "match_file_path.cpp"
-#include "clang/Basic/FileManager.h"
+#include "ignore_index.h"
+#include "line_table.h"
+#include "parallel_format.h"
+#include "replacements.h"
+#include "result_cache.h"
+#include "stats.h"
+#include "style_cache.h"
+#include "thread_pool.h"
+#include "top_level_scanner.h"
+#include "tree_walk.h"
+#include "unified_diff.h"
 #include "clang/Basic/SourceManager.h"
 #include "clang/Basic/Version.h"
 #include "clang/Format/Format.h"
-#include "clang/Rewrite/Core/Rewriter.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
 
 using namespace llvm;
 using clang::tooling::Replacements;
 
-static std::string FallbackStyle{clang::format::DefaultFallbackStyle};
-
-static unsigned Cursor{0};
-
-static bool SortIncludes{false};
+FormatContext::FormatContext()
+    : FallbackStyle{clang::format::DefaultFallbackStyle},
+      Ignores{std::make_unique<clang::format::IgnoreIndex>()},
+      Styles{std::make_unique<clang::format::StyleCache>()},
+      Results{std::make_unique<clang::format::ResultCache>()},
+      Lines{std::make_unique<clang::format::LineTable>()},
+      Stats{std::make_unique<clang::format::StatsCollector>()} {}
 
-static std::string QualifierAlignment{""};
+FormatContext::~FormatContext() = default;
+FormatContext::FormatContext(FormatContext &&) noexcept = default;
+FormatContext &FormatContext::operator=(FormatContext &&) noexcept = default;
 
-static auto Ok(const std::string content) -> Result {
+static auto Ok(std::string content) -> Result {
     return {false, std::move(content)};
 }
 
-static auto Err(const std::string content) -> Result {
+static auto Err(std::string content) -> Result {
     return {true, std::move(content)};
 }
 
 namespace clang {
 namespace format {
 
-static FileID createInMemoryFile(StringRef FileName, MemoryBufferRef Source,
-                                 SourceManager &Sources, FileManager &Files,
-                                 llvm::vfs::InMemoryFileSystem *MemFS) {
-    MemFS->addFileNoOwn(FileName, 0, Source);
-    auto File = Files.getOptionalFileRef(FileName);
-    assert(File && "File not added to MemFS?");
-    return Sources.createFileID(*File, SourceLocation(), SrcMgr::C_User);
-}
-
-static auto fillRanges(MemoryBuffer *Code, std::vector<tooling::Range> &Ranges)
+static auto fillRanges(StringRef Code, std::vector<tooling::Range> &Ranges)
     -> void {
-    Ranges.push_back(tooling::Range(0, Code->getBuffer().size()));
+    Ranges.push_back(tooling::Range(0, Code.size()));
 }
 
 static auto isPredefinedStyle(StringRef style) -> bool {
@@ -72,36 +85,63 @@ static auto isPredefinedStyle(StringRef style) -> bool {
         .Default(false);
 }
 
-static auto format_range(const std::unique_ptr<llvm::MemoryBuffer> code,
-                         const std::string assumedFileName,
-                         const std::string style,
-                         std::vector<tooling::Range> ranges) -> Result {
-    StringRef BufStr = code->getBuffer();
+static auto make_string_error(const Twine &Message) -> llvm::Error {
+    return llvm::make_error<llvm::StringError>(Message,
+                                               llvm::inconvertibleErrorCode());
+}
 
-    const char *InvalidBOM = SrcMgr::ContentCache::getInvalidBOM(BufStr);
+// `apply_replacements`, timed as `Stage::Apply`.
+static auto apply(FormatContext &Ctx, StringRef Code,
+                  const Replacements &Replaces) -> std::string {
+    StageTimer Timer(*Ctx.Stats, Stage::Apply);
+    return apply_replacements(Code, Replaces);
+}
 
-    if (InvalidBOM) {
-        std::stringstream err;
-        err << "encoding with unsupported byte order mark \"" << InvalidBOM
-            << "\" detected.";
+static auto assumed_file_name(StringRef Name) -> StringRef {
+    return Name.empty() ? "<stdin>" : Name;
+}
 
-        return Err(err.str());
-    }
+// Hashes everything besides the code that decides the formatted output, for
+// the result cache.
+static auto settings_fingerprint(const FormatContext &Ctx,
+                                 uint64_t StyleFingerprint,
+                                 StringRef AssumedFileName) -> uint64_t {
+    static const std::string Version = getClangToolFullVersion("clang-format");
+
+    std::string Settings;
+    raw_string_ostream OS(Settings);
+    OS << Version << '\0' << StyleFingerprint << '\0' << Ctx.QualifierAlignment
+       << '\0' << Ctx.SortIncludes;
+    // Include sorting tells the main header apart by the file name.
+    if (Ctx.SortIncludes)
+        OS << '\0' << sys::path::filename(AssumedFileName);
+    OS.flush();
+
+    return xxh3_64bits(arrayRefFromStringRef(Settings));
+}
 
-    StringRef AssumedFileName = assumedFileName;
-    if (AssumedFileName.empty()) {
-        AssumedFileName = "<stdin>";
-    }
+// Resolves `style` for `AssumedFileName` and applies the context's overrides.
+// If `Settings` is given, it receives the fingerprint the result cache keys
+// on.
+static auto resolve_style(FormatContext &Ctx, StringRef AssumedFileName,
+                          StringRef style, uint64_t *Settings = nullptr)
+    -> llvm::Expected<FormatStyle> {
+    StageTimer Timer(*Ctx.Stats, Stage::Style);
 
+    uint64_t StyleFingerprint = 0;
     llvm::Expected<FormatStyle> FormatStyle =
-        getStyle(style, AssumedFileName, FallbackStyle);
+        Ctx.Styles->get(style, AssumedFileName, Ctx.FallbackStyle, "",
+                        Settings ? &StyleFingerprint : nullptr);
+    if (Ctx.Stats->enabled()) {
+        const auto Counts = Ctx.Styles->stats();
+        Ctx.Stats->set_style_counts(Counts.Hits, Counts.Misses);
+    }
 
     if (!FormatStyle) {
-        std::string err = llvm::toString(FormatStyle.takeError());
-        return Err(err);
+        return FormatStyle.takeError();
     }
 
-    StringRef QualifierAlignmentOrder = QualifierAlignment;
+    StringRef QualifierAlignmentOrder = Ctx.QualifierAlignment;
 
     FormatStyle->QualifierAlignment =
         StringSwitch<FormatStyle::QualifierAlignmentStyle>(
@@ -122,84 +162,353 @@ static auto format_range(const std::unique_ptr<llvm::MemoryBuffer> code,
         FormatStyle->QualifierOrder = {Qualifiers.begin(), Qualifiers.end()};
     }
 
-    if (SortIncludes)
+    if (Ctx.SortIncludes)
         FormatStyle->SortIncludes = FormatStyle::SI_CaseSensitive;
     else
         FormatStyle->SortIncludes = FormatStyle::SI_Never;
 
-    unsigned CursorPosition = Cursor;
-    Replacements Replaces =
-        sortIncludes(*FormatStyle, code->getBuffer(), ranges, AssumedFileName,
-                     &CursorPosition);
+    if (Settings) {
+        *Settings =
+            settings_fingerprint(Ctx, StyleFingerprint, AssumedFileName);
+    }
+
+    return FormatStyle;
+}
+
+// The error of a call that ran out of its budget.
+constexpr StringLiteral TimeoutMessage =
+    "formatting took longer than its budget";
+
+static auto cancelled(const FormatContext &Ctx) -> bool {
+    return Ctx.Cancelled && Ctx.Cancelled->load(std::memory_order_relaxed);
+}
+
+// Whether `Ranges` is a single range over all `Size` bytes of the code.
+static auto covers_whole(ArrayRef<tooling::Range> Ranges, size_t Size)
+    -> bool {
+    return Ranges.size() == 1 && Ranges[0].getOffset() == 0 &&
+           Ranges[0].getLength() >= Size;
+}
+
+// `reformat`, in chunks if `Code` is at least `ParallelThreshold` bytes of
+// C-family code formatted whole; see `set_parallel_format`.
+static auto reformat_code(const FormatStyle &Style, StringRef Code,
+                          ArrayRef<tooling::Range> Ranges, StringRef FileName,
+                          size_t ParallelThreshold, unsigned ParallelThreads)
+    -> Replacements {
+    if (ParallelThreshold > 0 && Code.size() >= ParallelThreshold &&
+        Style.isCpp() && covers_whole(Ranges, Code.size())) {
+        if (auto Chunked =
+                reformat_in_chunks(Style, Code, FileName, ParallelThreads)) {
+            return *Chunked;
+        }
+    }
+    return reformat(Style, Code, Ranges, FileName);
+}
+
+// Budgeted `reformat` calls run on a fixed set of workers, so that their
+// callers can stop waiting at the deadline. `reformat` can't be interrupted,
+// so a call that runs past its deadline keeps its worker until it is done;
+// once every worker is taken by such a call, budgeted work is refused at once
+// rather than queued behind them. The workers are never joined.
+class BudgetRunner {
+  public:
+    explicit BudgetRunner(unsigned Threads)
+        : MaxOverdue(Threads), Pool(Threads) {}
+
+    // The result of `Work`, or nothing if it didn't finish by `Deadline` or
+    // was refused.
+    auto run(std::chrono::steady_clock::time_point Deadline,
+             std::function<Replacements()> Work)
+        -> std::optional<Replacements> {
+        if (Overdue.load(std::memory_order_relaxed) >= MaxOverdue)
+            return std::nullopt;
+
+        auto J = std::make_shared<Job>();
+        J->Work = std::move(Work);
+        Pool.submit([this, J] { execute(*J); });
+
+        std::unique_lock<std::mutex> Lock(J->Mutex);
+        if (J->Finished.wait_until(Lock, Deadline, [&] { return J->Done; }))
+            return std::move(J->Result);
+        J->Abandoned = true;
+        if (J->Started)
+            Overdue.fetch_add(1, std::memory_order_relaxed);
+        return std::nullopt;
+    }
+
+  private:
+    struct Job {
+        std::function<Replacements()> Work;
+        std::mutex Mutex;
+        std::condition_variable Finished;
+        bool Started = false;
+        bool Abandoned = false;
+        bool Done = false;
+        std::optional<Replacements> Result;
+    };
+
+    auto execute(Job &J) -> void {
+        {
+            std::lock_guard<std::mutex> Lock(J.Mutex);
+            if (J.Abandoned)
+                return;
+            J.Started = true;
+        }
+
+        std::optional<Replacements> Result;
+        try {
+            Result = J.Work();
+        } catch (...) {
+            // Reported like a call that ran out.
+        }
+
+        bool WasAbandoned;
+        {
+            std::lock_guard<std::mutex> Lock(J.Mutex);
+            J.Done = true;
+            J.Result = std::move(Result);
+            WasAbandoned = J.Abandoned;
+        }
+        if (WasAbandoned)
+            Overdue.fetch_sub(1, std::memory_order_relaxed);
+        else
+            J.Finished.notify_one();
+    }
+
+    // Calls whose callers gave up on them while they ran.
+    std::atomic<unsigned> Overdue{0};
+    const unsigned MaxOverdue;
+
+    // Last, so that its workers are joined before anything they use goes.
+    WorkStealingPool Pool;
+};
+
+static auto budget_runner() -> BudgetRunner & {
+    // Never destroyed, so that unloading the library doesn't wait for
+    // searches that ran past their deadline; its workers are abandoned.
+    static BudgetRunner *Runner =
+        new BudgetRunner(WorkStealingPool::default_threads());
+    return *Runner;
+}
+
+// `reformat_code` on a budget worker, or nothing if that is still running at
+// `Deadline` or there is no worker to spare. The worker may outlive the
+// caller, so it holds on to `Code` and copies the rest, which is small.
+static auto reformat_within(std::chrono::steady_clock::time_point Deadline,
+                            const FormatStyle &Style,
+                            std::shared_ptr<const std::string> Code,
+                            ArrayRef<tooling::Range> Ranges,
+                            StringRef FileName, size_t ParallelThreshold,
+                            unsigned ParallelThreads)
+    -> std::optional<Replacements> {
+    return budget_runner().run(
+        Deadline, [Style, Code = std::move(Code), Ranges = Ranges.vec(),
+                   FileName = FileName.str(), ParallelThreshold,
+                   ParallelThreads] {
+            return reformat_code(Style, *Code, Ranges, FileName,
+                                 ParallelThreshold, ParallelThreads);
+        });
+}
+
+// Runs include sorting and `reformat` with `Style` over `ranges` of `Code` and
+// returns the combined replacements, relative to `Code`.
+static auto format_replacements(FormatContext &Ctx, StringRef Code,
+                                StringRef AssumedFileName,
+                                const FormatStyle &Style,
+                                std::vector<tooling::Range> ranges)
+    -> llvm::Expected<Replacements> {
+    const auto Start = std::chrono::steady_clock::now();
+    Ctx.Degraded = false;
+
+    const char *InvalidBOM = SrcMgr::ContentCache::getInvalidBOM(Code);
+
+    if (InvalidBOM) {
+        std::stringstream err;
+        err << "encoding with unsupported byte order mark \"" << InvalidBOM
+            << "\" detected.";
+
+        return make_string_error(err.str());
+    }
+
+    if (cancelled(Ctx))
+        return make_string_error("cancelled");
+
+    Replacements Replaces;
+    if (Style.SortIncludes != FormatStyle::SI_Never) {
+        StageTimer Timer(*Ctx.Stats, Stage::SortIncludes);
+        unsigned CursorPosition = Ctx.Cursor;
+        Replaces =
+            sortIncludes(Style, Code, ranges, AssumedFileName, &CursorPosition);
+    }
 
     // To format JSON insert a variable to trick the code into thinking its
     // JavaScript.
-    if (FormatStyle->isJson() && !FormatStyle->DisableFormat) {
+    if (Style.isJson() && !Style.DisableFormat) {
         auto err = Replaces.add(tooling::Replacement(
             tooling::Replacement(AssumedFileName, 0, 0, "x = ")));
-        if (err)
-            return Err("Bad Json variable insertion");
+        if (err) {
+            llvm::consumeError(std::move(err));
+            return make_string_error("Bad Json variable insertion");
+        }
+    }
+
+    // Without include changes `reformat` can work on `Code` itself.
+    std::string SortedCode;
+    StringRef ChangedCode = Code;
+    if (!Replaces.empty()) {
+        SortedCode = apply(Ctx, Code, Replaces);
+        ChangedCode = SortedCode;
     }
 
-    auto ChangedCode =
-        cantFail(tooling::applyAllReplacements(code->getBuffer(), Replaces));
+    if (cancelled(Ctx))
+        return make_string_error("cancelled");
 
     // Get new affected ranges after sorting `#includes`.
     ranges = tooling::calculateRangesAfterReplacements(Replaces, ranges);
-    FormattingAttemptStatus Status;
-    Replacements FormatChanges =
-        reformat(*FormatStyle, ChangedCode, ranges, AssumedFileName, &Status);
-    Replaces = Replaces.merge(FormatChanges);
+    StageTimer Timer(*Ctx.Stats, Stage::Reformat);
+    const Budget &Limit = Ctx.ReformatBudget;
+    if (Limit.milliseconds == 0) {
+        return Replaces.merge(reformat_code(Style, ChangedCode, ranges,
+                                            AssumedFileName,
+                                            Ctx.ParallelThreshold,
+                                            Ctx.ParallelThreads));
+    }
 
-    return Ok(
-        cantFail(tooling::applyAllReplacements(code->getBuffer(), Replaces)));
+    // One buffer for the search and its fallback to share; the sorted code
+    // already is one of ours.
+    const auto Input = std::make_shared<const std::string>(
+        Replaces.empty() ? Code.str() : std::move(SortedCode));
+    const std::chrono::milliseconds Allowed(Limit.milliseconds);
+    if (auto FormatChanges = reformat_within(
+            Start + Allowed, Style, Input, ranges, AssumedFileName,
+            Ctx.ParallelThreshold, Ctx.ParallelThreads)) {
+        return Replaces.merge(*FormatChanges);
+    }
+    if (!Limit.fallback)
+        return make_string_error(TimeoutMessage);
+
+    // Without a column limit `reformat` keeps the line breaks of the input
+    // and takes linear time, but it gets a budget of its own all the same.
+    FormatStyle Unlimited = Style;
+    Unlimited.ColumnLimit = 0;
+    auto FallbackChanges =
+        reformat_within(std::chrono::steady_clock::now() + Allowed, Unlimited,
+                        Input, ranges, AssumedFileName, 0, 0);
+    if (!FallbackChanges)
+        return make_string_error(TimeoutMessage);
+    Ctx.Degraded = true;
+    return Replaces.merge(*FallbackChanges);
 }
 
-static auto format_range(const std::string str,
-                         const std::string assumedFileName,
-                         const std::string style, const bool is_line_range,
-                         const std::vector<unsigned> ranges) -> Result {
-    ErrorOr<std::unique_ptr<MemoryBuffer>> CodeOrErr =
-        MemoryBuffer::getMemBuffer(str);
+// As above, with the style resolved from `style`.
+static auto format_replacements(FormatContext &Ctx, StringRef Code,
+                                StringRef assumedFileName, StringRef style,
+                                std::vector<tooling::Range> ranges)
+    -> llvm::Expected<Replacements> {
+    const StringRef AssumedFileName = assumed_file_name(assumedFileName);
 
-    if (std::error_code EC = CodeOrErr.getError()) {
-        return Err(EC.message());
+    llvm::Expected<FormatStyle> Style =
+        resolve_style(Ctx, AssumedFileName, style);
+    if (!Style)
+        return Style.takeError();
+
+    return format_replacements(Ctx, Code, AssumedFileName, *Style,
+                               std::move(ranges));
+}
+
+// The style for formatting a whole file, and what the result cache has on it.
+struct WholeFile {
+    FormatStyle Style;
+    std::optional<ResultCache::Key> Key; // Unless the cache is disabled.
+    std::optional<ResultCache::Found> Hit;
+};
+
+static auto prepare_whole_file(FormatContext &Ctx, StringRef Code,
+                               StringRef AssumedFileName, StringRef style)
+    -> llvm::Expected<WholeFile> {
+    ResultCache &Cache = *Ctx.Results;
+
+    uint64_t Settings = 0;
+    llvm::Expected<FormatStyle> Style = resolve_style(
+        Ctx, AssumedFileName, style, Cache.enabled() ? &Settings : nullptr);
+    if (!Style)
+        return Style.takeError();
+
+    WholeFile File{std::move(*Style), std::nullopt, std::nullopt};
+    if (Cache.enabled()) {
+        File.Key = ResultCache::key(Code, Settings);
+        File.Hit = Cache.lookup(*File.Key);
+        if (Ctx.Stats->enabled()) {
+            const auto Counts = Cache.stats();
+            Ctx.Stats->set_result_counts(Counts.Hits, Counts.Misses);
+        }
+    }
+    return File;
+}
+
+// The merged set may contain replacements that put back the text they
+// replace, e.g. around the variable inserted to format JSON.
+static auto is_noop(StringRef Code, const tooling::Replacement &R) -> bool {
+    return R.getReplacementText() == Code.substr(R.getOffset(), R.getLength());
+}
+
+// Number of replacements that actually change `Code`, and the offset of the
+// first one.
+static auto count_changes(StringRef Code, const Replacements &Replaces,
+                          unsigned &FirstOffset) -> unsigned {
+    unsigned Changes = 0;
+    for (const auto &R : Replaces) {
+        if (is_noop(Code, R))
+            continue;
+        if (Changes++ == 0)
+            FirstOffset = R.getOffset();
     }
-    std::unique_ptr<llvm::MemoryBuffer> Code = std::move(CodeOrErr.get());
-    if (Code->getBufferSize() == 0)
+    return Changes;
+}
+
+static auto format_range(FormatContext &Ctx, StringRef Code,
+                         StringRef assumedFileName, StringRef style,
+                         std::vector<tooling::Range> ranges) -> Result {
+    auto Replaces = format_replacements(Ctx, Code, assumedFileName, style,
+                                        std::move(ranges));
+    if (!Replaces)
+        return Err(llvm::toString(Replaces.takeError()));
+
+    return Ok(apply(Ctx, Code, *Replaces));
+}
+
+static auto format_range(FormatContext &Ctx, StringRef Code,
+                         StringRef assumedFileName, StringRef style,
+                         const bool is_line_range,
+                         const std::vector<unsigned> &ranges) -> Result {
+    if (Code.empty())
         return Ok(""); // Empty files are formatted correctly.
 
     std::vector<tooling::Range> Ranges;
 
     if (ranges.empty()) {
-        fillRanges(Code.get(), Ranges);
-        return format_range(std::move(Code), assumedFileName, style,
+        fillRanges(Code, Ranges);
+        return format_range(Ctx, Code, assumedFileName, style,
                             std::move(Ranges));
     }
 
-    IntrusiveRefCntPtr<llvm::vfs::InMemoryFileSystem> InMemoryFileSystem(
-        new llvm::vfs::InMemoryFileSystem);
-    FileManager Files(FileSystemOptions(), InMemoryFileSystem);
-    DiagnosticsEngine Diagnostics(
-        IntrusiveRefCntPtr<DiagnosticIDs>(new DiagnosticIDs),
-        new DiagnosticOptions);
-    SourceManager Sources(Diagnostics, Files);
-    FileID ID = createInMemoryFile("<irrelevant>", *Code, Sources, Files,
-                                   InMemoryFileSystem.get());
-
     if (is_line_range) {
+        if (ranges.size() % 2 != 0) {
+            return Err("number of first and last lines must match");
+        }
+
+        LineTable &Lines = *Ctx.Lines;
+        Lines.reset(Code);
         for (auto FromLine = begin(ranges); FromLine < end(ranges);
              FromLine += 2) {
             auto ToLine = FromLine + 1;
 
-            SourceLocation Start = Sources.translateLineCol(ID, *FromLine, 1);
-            SourceLocation End =
-                Sources.translateLineCol(ID, *ToLine, UINT_MAX);
-            if (Start.isInvalid() || End.isInvalid()) {
+            if (*FromLine == 0 || *ToLine == 0) {
                 return Err("invalid line number");
             }
-            unsigned Offset = Sources.getFileOffset(Start);
-            unsigned Length = Sources.getFileOffset(End) - Offset;
+            unsigned Offset = Lines.offset(*FromLine, 1);
+            unsigned Length = Lines.offset(*ToLine, UINT_MAX) - Offset;
             Ranges.push_back(tooling::Range(Offset, Length));
         }
     } else {
@@ -209,17 +518,13 @@ static auto format_range(const std::string str,
 
         if (ranges.size() == 1) {
             auto offset = begin(ranges);
-            if (*offset >= Code->getBufferSize()) {
+            if (*offset >= Code.size()) {
                 std::stringstream err;
                 err << "offset " << *offset << " is outside the file";
                 return Err(err.str());
             }
-            SourceLocation Start =
-                Sources.getLocForStartOfFile(ID).getLocWithOffset(*offset);
-            SourceLocation End = Sources.getLocForEndOfFile(ID);
-
-            unsigned Offset = Sources.getFileOffset(Start);
-            unsigned Length = Sources.getFileOffset(End) - Offset;
+            unsigned Offset = *offset;
+            unsigned Length = Code.size() - Offset;
 
             Ranges.push_back(tooling::Range(Offset, Length));
         } else {
@@ -227,131 +532,311 @@ static auto format_range(const std::string str,
                  offset += 2) {
                 auto length = offset + 1;
 
-                if (*offset >= Code->getBufferSize()) {
+                if (*offset >= Code.size()) {
                     std::stringstream err;
                     err << "offset " << *offset << " is outside the file";
                     return Err(err.str());
                 }
 
                 unsigned end = *offset + *length;
-                if (end > Code->getBufferSize()) {
+                if (end > Code.size()) {
                     std::stringstream err;
                     err << "invalid length " << *length << ", offset + length ("
                         << end << ") is outside the file.";
                     return Err(err.str());
                 }
 
-                SourceLocation Start =
-                    Sources.getLocForStartOfFile(ID).getLocWithOffset(*offset);
-                SourceLocation End = Start.getLocWithOffset(*length);
-
-                unsigned Offset = Sources.getFileOffset(Start);
-                unsigned Length = Sources.getFileOffset(End) - Offset;
-
-                Ranges.push_back(tooling::Range(Offset, Length));
+                Ranges.push_back(tooling::Range(*offset, *length));
             }
         }
     }
 
-    return format_range(std::move(Code), assumedFileName, style,
-                        std::move(Ranges));
+    return format_range(Ctx, Code, assumedFileName, style, std::move(Ranges));
 }
 
-static auto format(const std::string str, const std::string assumedFileName,
-                   const std::string style) -> Result {
-    ErrorOr<std::unique_ptr<MemoryBuffer>> CodeOrErr =
-        MemoryBuffer::getMemBuffer(str);
-
-    if (std::error_code EC = CodeOrErr.getError()) {
-        return Err(EC.message());
-    }
-    std::unique_ptr<llvm::MemoryBuffer> Code = std::move(CodeOrErr.get());
-    if (Code->getBufferSize() == 0)
+static auto format(FormatContext &Ctx, StringRef Code,
+                   StringRef assumedFileName, StringRef style) -> Result {
+    if (Code.empty())
         return Ok(""); // Empty files are formatted correctly.
 
-    std::vector<tooling::Range> Ranges;
-    fillRanges(Code.get(), Ranges);
-
-    return format_range(std::move(Code), assumedFileName, style,
-                        std::move(Ranges));
+    const StringRef AssumedFileName = assumed_file_name(assumedFileName);
+    auto File = prepare_whole_file(Ctx, Code, AssumedFileName, style);
+    if (!File)
+        return Err(llvm::toString(File.takeError()));
+    if (File->Hit)
+        return Ok((File->Hit->Unchanged ? Code : File->Hit->Formatted).str());
+
+    auto Replaces = format_replacements(Ctx, Code, AssumedFileName,
+                                        File->Style,
+                                        {tooling::Range(0, Code.size())});
+    if (!Replaces)
+        return Err(llvm::toString(Replaces.takeError()));
+
+    std::string Formatted = apply(Ctx, Code, *Replaces);
+    if (File->Key && !Ctx.Degraded)
+        Ctx.Results->insert(*File->Key, Code, Formatted);
+    return Ok(std::move(Formatted));
 }
 
-using String = SmallString<128>;
-static String IgnoreDir;
-static String PrevDir;
-static SmallVector<String> Patterns;
-
-static bool is_ignored(StringRef FilePath) {
-    using namespace llvm::sys::fs;
-    if (!is_regular_file(FilePath))
-        return false;
-
-    String Path;
-    String AbsPath{FilePath};
+static auto format_into(FormatContext &Ctx, StringRef Code,
+                        StringRef assumedFileName, StringRef style,
+                        const std::function<char *(size_t)> &alloc) -> Result {
+    if (Code.empty()) {
+        alloc(0);
+        return Ok(""); // Empty files are formatted correctly.
+    }
 
-    using namespace llvm::sys::path;
-    make_absolute(AbsPath);
-    remove_dots(AbsPath, /*remove_dot_dot=*/true);
+    const StringRef AssumedFileName = assumed_file_name(assumedFileName);
+    auto File = prepare_whole_file(Ctx, Code, AssumedFileName, style);
+    if (!File)
+        return Err(llvm::toString(File.takeError()));
+    if (File->Hit) {
+        const StringRef Formatted =
+            File->Hit->Unchanged ? Code : File->Hit->Formatted;
+        std::copy(Formatted.begin(), Formatted.end(), alloc(Formatted.size()));
+        return Ok("");
+    }
 
-    if (StringRef Dir{parent_path(AbsPath)}; PrevDir != Dir) {
-        PrevDir = Dir;
+    auto Replaces = format_replacements(Ctx, Code, AssumedFileName,
+                                        File->Style,
+                                        {tooling::Range(0, Code.size())});
+    if (!Replaces)
+        return Err(llvm::toString(Replaces.takeError()));
+
+    const size_t Size = formatted_size(Code, *Replaces);
+    char *Out = alloc(Size);
+    {
+        StageTimer Timer(*Ctx.Stats, Stage::Apply);
+        apply_into(Code, *Replaces, Out);
+    }
+    if (File->Key && !Ctx.Degraded)
+        Ctx.Results->insert(*File->Key, Code, StringRef(Out, Size));
+    return Ok("");
+}
 
-        for (;;) {
-            Path = Dir;
-            append(Path, ".clang-format-ignore");
-            if (is_regular_file(Path))
-                break;
-            Dir = parent_path(Dir);
-            if (Dir.empty())
-                return false;
-        }
+static auto check(FormatContext &Ctx, StringRef Code,
+                  StringRef assumedFileName, StringRef style) -> CheckResult {
+    if (Code.empty())
+        return {false, "", 0, 0};
+
+    const StringRef AssumedFileName = assumed_file_name(assumedFileName);
+    auto File = prepare_whole_file(Ctx, Code, AssumedFileName, style);
+    if (!File)
+        return {true, llvm::toString(File.takeError()), 0, 0};
+    if (File->Hit && File->Hit->Unchanged)
+        return {false, "", 0, 0};
+
+    auto Replaces = format_replacements(Ctx, Code, AssumedFileName,
+                                        File->Style,
+                                        {tooling::Range(0, Code.size())});
+    if (!Replaces)
+        return {true, llvm::toString(Replaces.takeError()), 0, 0};
+
+    unsigned FirstOffset = 0;
+    const unsigned Changes = count_changes(Code, *Replaces, FirstOffset);
+    // Only an unchanged result is known without applying the replacements.
+    if (Changes == 0 && File->Key && !Ctx.Degraded && !File->Hit)
+        Ctx.Results->insert(*File->Key, Code, Code);
+    return {false, "", Changes, FirstOffset};
+}
 
-        IgnoreDir = convert_to_slash(Dir);
+// Replaces the file at `Path` with `Contents` through a temporary file in the
+// same directory, so that readers see either the old or the new file.
+static auto write_atomically(StringRef Path, StringRef Contents)
+    -> llvm::Error {
+    sys::fs::file_status Status;
+    if (std::error_code EC = sys::fs::status(Path, Status))
+        return make_string_error("cannot stat " + Path + ": " + EC.message());
+
+    int FD;
+    SmallString<128> TempPath;
+    if (std::error_code EC = sys::fs::createUniqueFile(
+            Path + "-%%%%%%%%.tmp", FD, TempPath)) {
+        return make_string_error("cannot create a file next to " + Path +
+                                 ": " + EC.message());
+    }
 
-        std::ifstream IgnoreFile{Path.c_str()};
-        if (!IgnoreFile.good())
-            return false;
+    raw_fd_ostream OS(FD, /*shouldClose=*/true);
+    OS << Contents;
+    OS.close();
+    if (OS.has_error()) {
+        const std::error_code EC = OS.error();
+        OS.clear_error();
+        sys::fs::remove(TempPath);
+        return make_string_error("cannot write " + TempPath.str() + ": " +
+                                 EC.message());
+    }
 
-        Patterns.clear();
+    sys::fs::setPermissions(TempPath, Status.permissions());
+    if (std::error_code EC = sys::fs::rename(TempPath, Path)) {
+        sys::fs::remove(TempPath);
+        return make_string_error("cannot replace " + Path + ": " +
+                                 EC.message());
+    }
+    return llvm::Error::success();
+}
 
-        for (std::string Line; std::getline(IgnoreFile, Line);) {
-            if (const auto Pattern{StringRef{Line}.trim()};
-                // Skip empty and comment lines.
-                !Pattern.empty() && Pattern[0] != '#') {
-                Patterns.push_back(Pattern);
-            }
-        }
+static auto format_file(FormatContext &Ctx, StringRef Path, StringRef style,
+                        bool WriteBack) -> FileResult {
+    // Large files are mapped rather than read.
+    auto Buffer = MemoryBuffer::getFile(Path, /*IsText=*/false,
+                                        /*RequiresNullTerminator=*/false);
+    if (!Buffer) {
+        return {true,
+                ("cannot read " + Path + ": " + Buffer.getError().message())
+                    .str(),
+                false};
+    }
+    const StringRef Code = (*Buffer)->getBuffer();
+    if (Code.empty())
+        return {false, "", false}; // Empty files are formatted correctly.
+
+    auto File = prepare_whole_file(Ctx, Code, Path, style);
+    if (!File)
+        return {true, llvm::toString(File.takeError()), false};
+
+    std::string Formatted;
+    bool Changed;
+    if (File->Hit) {
+        Changed = !File->Hit->Unchanged;
+        if (Changed)
+            Formatted = File->Hit->Formatted.str();
+    } else {
+        auto Replaces = format_replacements(Ctx, Code, Path, File->Style,
+                                            {tooling::Range(0, Code.size())});
+        if (!Replaces)
+            return {true, llvm::toString(Replaces.takeError()), false};
+
+        Formatted = apply(Ctx, Code, *Replaces);
+        Changed = Formatted != Code;
+        if (File->Key && !Ctx.Degraded)
+            Ctx.Results->insert(*File->Key, Code, Formatted);
     }
 
-    if (IgnoreDir.empty())
-        return false;
+    if (!WriteBack)
+        return {false, Changed ? std::move(Formatted) : Code.str(), Changed};
+    if (!Changed)
+        return {false, "", false};
 
-    const auto Pathname{convert_to_slash(AbsPath)};
-    for (const auto &Pat : Patterns) {
-        const bool IsNegated = Pat[0] == '!';
-        StringRef Pattern{Pat};
-        if (IsNegated)
-            Pattern = Pattern.drop_front();
+    if (llvm::Error E = write_atomically(Path, Formatted))
+        return {true, llvm::toString(std::move(E)), false};
+    return {false, "", true};
+}
+
+static auto format_file_lines(FormatContext &Ctx, StringRef Path,
+                              StringRef style,
+                              const std::vector<unsigned> &Lines,
+                              bool WriteBack) -> FileResult {
+    auto Buffer = MemoryBuffer::getFile(Path, /*IsText=*/false,
+                                        /*RequiresNullTerminator=*/false);
+    if (!Buffer) {
+        return {true,
+                ("cannot read " + Path + ": " + Buffer.getError().message())
+                    .str(),
+                false};
+    }
+    const StringRef Code = (*Buffer)->getBuffer();
+    // No lines would mean the whole file to `format_range`.
+    if (Code.empty() || Lines.empty())
+        return {false, WriteBack ? "" : Code.str(), false};
+
+    Result Formatted = format_range(Ctx, Code, Path, style,
+                                    /*is_line_range=*/true, Lines);
+    if (Formatted.error)
+        return {true, std::move(Formatted.content), false};
+
+    const bool Changed = Formatted.content != Code;
+    if (!WriteBack)
+        return {false, std::move(Formatted.content), Changed};
+    if (!Changed)
+        return {false, "", false};
+
+    if (llvm::Error E = write_atomically(Path, Formatted.content))
+        return {true, llvm::toString(std::move(E)), false};
+    return {false, "", true};
+}
 
-        if (Pattern.empty())
+static auto format_edits(FormatContext &Ctx, StringRef Code,
+                         StringRef assumedFileName, StringRef style)
+    -> EditsResult {
+    if (Code.empty())
+        return {false, "", {}};
+
+    const StringRef AssumedFileName = assumed_file_name(assumedFileName);
+    auto File = prepare_whole_file(Ctx, Code, AssumedFileName, style);
+    if (!File)
+        return {true, llvm::toString(File.takeError()), {}};
+    if (File->Hit && File->Hit->Unchanged)
+        return {false, "", {}};
+
+    auto Replaces = format_replacements(Ctx, Code, AssumedFileName,
+                                        File->Style,
+                                        {tooling::Range(0, Code.size())});
+    if (!Replaces)
+        return {true, llvm::toString(Replaces.takeError()), {}};
+
+    std::vector<Edit> Edits;
+    Edits.reserve(Replaces->size());
+    for (const auto &R : *Replaces) {
+        if (is_noop(Code, R))
             continue;
+        Edits.push_back(
+            {R.getOffset(), R.getLength(), R.getReplacementText().str()});
+    }
+    if (Edits.empty() && File->Key && !Ctx.Degraded && !File->Hit)
+        Ctx.Results->insert(*File->Key, Code, Code);
+    return {false, "", std::move(Edits)};
+}
 
-        Pattern = Pattern.ltrim();
+static auto format_incremental(FormatContext &Ctx, StringRef Previous,
+                               const std::vector<Edit> &Edits,
+                               StringRef assumedFileName, StringRef style)
+    -> Result {
+    // Apply the edits, noting where their text ends up.
+    std::string Code;
+    std::vector<tooling::Range> Changed;
+    size_t Pos = 0;
+    for (const auto &E : Edits) {
+        if (E.offset < Pos || E.offset + size_t{E.length} > Previous.size())
+            return Err("edits must be sorted, disjoint and within the file");
+        Code.append(Previous.data() + Pos, E.offset - Pos);
+        Changed.push_back(tooling::Range(Code.size(), E.text.size()));
+        Code += E.text;
+        Pos = E.offset + E.length;
+    }
+    Code.append(Previous.data() + Pos, Previous.size() - Pos);
 
-        // `Pattern` is relative to `IgnoreDir` unless it starts with a slash.
-        // This doesn't support patterns containing drive names (e.g. `C:`).
-        if (Pattern[0] != '/') {
-            Path = IgnoreDir;
-            append(Path, Style::posix, Pattern);
-            remove_dots(Path, /*remove_dot_dot=*/true, Style::posix);
-            Pattern = Path;
+    if (Code.empty())
+        return Ok(""); // Empty files are formatted correctly.
+    if (Changed.empty())
+        return Ok(std::move(Code));
+
+    // Widen every edit to the top-level declarations it touches, including
+    // the one right before it, which a deletion may have joined with the next.
+    const auto Boundaries = top_level_boundaries(Code);
+    std::vector<unsigned> Ranges; // Offset and length pairs.
+    for (const auto &R : Changed) {
+        const unsigned First = R.getOffset() == 0 ? 0 : R.getOffset() - 1;
+        const unsigned Begin =
+            *std::prev(std::upper_bound(Boundaries.begin(), Boundaries.end(),
+                                        First));
+        const unsigned Last = R.getOffset() + std::max(R.getLength(), 1U);
+        const auto After =
+            std::lower_bound(Boundaries.begin(), Boundaries.end(), Last);
+        const unsigned End =
+            After == Boundaries.end() ? Code.size() : *After;
+
+        if (!Ranges.empty() &&
+            Begin <= Ranges[Ranges.size() - 2] + Ranges.back()) {
+            Ranges.back() = End - Ranges[Ranges.size() - 2];
+        } else {
+            Ranges.push_back(Begin);
+            Ranges.push_back(End - Begin);
         }
-
-        if (clang::format::matchFilePath(Pattern, Pathname) == !IsNegated)
-            return true;
     }
 
-    return false;
+    return format_range(Ctx, Code, assumedFileName, style,
+                        /*is_line_range=*/false, Ranges);
 }
 
 } // namespace format
@@ -361,44 +846,188 @@ auto version() -> std::string {
     return clang::getClangToolFullVersion("clang-format");
 }
 
-auto format(const std::string str, const std::string assumedFileName,
-            const std::string style) -> Result {
-    return clang::format::format(str, assumedFileName, style);
+auto format(FormatContext &ctx, std::string_view str,
+            std::string_view assumedFileName, std::string_view style)
+    -> Result {
+    return clang::format::format(ctx, str, assumedFileName, style);
 }
 
-auto format_byte(const std::string str, const std::string assumedFileName,
-                 const std::string style, const std::vector<unsigned> ranges)
-    -> Result {
-    return clang::format::format_range(str, assumedFileName, style, false,
-                                       std::move(ranges));
+auto format_byte(FormatContext &ctx, std::string_view str,
+                 std::string_view assumedFileName, std::string_view style,
+                 const std::vector<unsigned> &ranges) -> Result {
+    return clang::format::format_range(ctx, str, assumedFileName, style, false,
+                                       ranges);
 }
 
-auto format_line(const std::string str, const std::string assumedFileName,
-                 const std::string style, const std::vector<unsigned> ranges)
-    -> Result {
-    return clang::format::format_range(str, assumedFileName, style, true,
-                                       std::move(ranges));
+auto format_line(FormatContext &ctx, std::string_view str,
+                 std::string_view assumedFileName, std::string_view style,
+                 const std::vector<unsigned> &ranges) -> Result {
+    return clang::format::format_range(ctx, str, assumedFileName, style, true,
+                                       ranges);
+}
+
+auto format_into(FormatContext &ctx, std::string_view code,
+                 std::string_view assumedFileName, std::string_view style,
+                 const std::function<char *(size_t)> &alloc) -> Result {
+    return clang::format::format_into(ctx, code, assumedFileName, style, alloc);
 }
 
-auto set_fallback_style(const std::string style) -> void {
-    FallbackStyle = style;
+auto check(FormatContext &ctx, std::string_view code,
+           std::string_view assumedFileName, std::string_view style)
+    -> CheckResult {
+    return clang::format::check(ctx, code, assumedFileName, style);
 }
 
-auto set_sort_includes(const bool sort) -> void { SortIncludes = sort; }
+auto format_edits(FormatContext &ctx, std::string_view code,
+                  std::string_view assumedFileName, std::string_view style)
+    -> EditsResult {
+    return clang::format::format_edits(ctx, code, assumedFileName, style);
+}
+
+auto format_incremental(FormatContext &ctx, std::string_view previous,
+                        const std::vector<Edit> &edits,
+                        std::string_view assumedFileName,
+                        std::string_view style) -> Result {
+    return clang::format::format_incremental(ctx, previous, edits,
+                                             assumedFileName, style);
+}
+
+auto format_file(FormatContext &ctx, std::string_view path,
+                 std::string_view style, bool write_back) -> FileResult {
+    return clang::format::format_file(ctx, path, style, write_back);
+}
 
-auto dump_config(const std::string style, const std::string FileName,
-                 const std::string code) -> Result {
+auto format_file_lines(FormatContext &ctx, std::string_view path,
+                       std::string_view style,
+                       const std::vector<unsigned> &lines, bool write_back)
+    -> FileResult {
+    return clang::format::format_file_lines(ctx, path, style, lines,
+                                            write_back);
+}
+
+auto changed_lines(std::string_view diff, unsigned strip) -> DiffResult {
+    auto Files = clang::format::changed_lines(diff, strip);
+    if (!Files)
+        return {true, llvm::toString(Files.takeError()), {}};
+    return {false, "", std::move(*Files)};
+}
+
+auto format_tree(const WorkerRunner &run, unsigned threads,
+                 std::string_view root,
+                 const std::vector<std::string> &extensions,
+                 std::string_view style, bool write_back,
+                 const std::function<void(const TreeEntry &)> &emit)
+    -> TreeResult {
+    return clang::format::format_tree(run, threads, root, extensions, style,
+                                      write_back, emit);
+}
+
+auto set_cancel_flag(FormatContext &ctx, const std::atomic<bool> *flag)
+    -> void {
+    ctx.Cancelled = flag;
+}
+
+auto set_budget(FormatContext &ctx, Budget budget) -> void {
+    ctx.ReformatBudget = budget;
+}
+
+auto get_budget(const FormatContext &ctx) -> Budget {
+    return ctx.ReformatBudget;
+}
+
+auto is_timeout(std::string_view message) -> bool {
+    return message == clang::format::TimeoutMessage;
+}
+
+auto clear_config_caches(FormatContext &ctx) -> void {
+    ctx.Styles->clear();
+    ctx.Ignores->clear();
+}
+
+auto set_trusted_roots(FormatContext &ctx, std::vector<std::string> roots)
+    -> void {
+    ctx.Ignores->trust_under(roots);
+    ctx.Styles->trust_under(std::move(roots));
+}
+
+auto set_fallback_style(FormatContext &ctx, std::string_view style) -> void {
+    ctx.FallbackStyle = style;
+}
+
+auto set_sort_includes(FormatContext &ctx, const bool sort) -> void {
+    ctx.SortIncludes = sort;
+}
+
+auto set_result_cache(FormatContext &ctx, size_t capacity,
+                      std::string_view directory) -> void {
+    ctx.Results->set_capacity(capacity);
+    ctx.Results->set_directory(directory);
+}
+
+auto result_cache_stats(const FormatContext &ctx) -> CacheStats {
+    const auto Stats = ctx.Results->stats();
+    return {Stats.Hits, Stats.DiskHits, Stats.Misses, Stats.Entries,
+            Stats.Bytes};
+}
+
+auto set_parallel_format(FormatContext &ctx, size_t threshold,
+                         unsigned threads) -> void {
+    ctx.ParallelThreshold = threshold;
+    ctx.ParallelThreads = threads;
+}
+
+auto dump_config(FormatContext &ctx, std::string_view style,
+                 std::string_view FileName, std::string_view code) -> Result {
     llvm::Expected<clang::format::FormatStyle> FormatStyle =
-        clang::format::getStyle(style, FileName, FallbackStyle, code);
+        clang::format::getStyle(style, FileName, ctx.FallbackStyle, code);
     if (!FormatStyle) {
         return Err(llvm::toString(FormatStyle.takeError()));
     }
     std::string Config = clang::format::configurationAsText(*FormatStyle);
-    return Ok(Config);
+    return Ok(std::move(Config));
+}
+
+auto set_stats(FormatContext &ctx, bool enabled) -> void {
+    ctx.Stats->set_enabled(enabled);
+}
+
+auto stats_enabled(const FormatContext &ctx) -> bool {
+    return ctx.Stats->enabled();
+}
+
+auto format_stats(const FormatContext &ctx) -> FormatStats {
+    return ctx.Stats->snapshot();
+}
+
+auto record_request(FormatContext &ctx, uint64_t nanoseconds, uint64_t bytes_in,
+                    uint64_t bytes_out) -> void {
+    if (!ctx.Stats->enabled())
+        return;
+    ctx.Stats->record(Stage::Request, nanoseconds);
+    ctx.Stats->add_bytes(bytes_in, bytes_out);
+}
+
+auto stage_name(Stage stage) -> const char * {
+    switch (stage) {
+    case Stage::Request:
+        return "request";
+    case Stage::Ignore:
+        return "ignore";
+    case Stage::Style:
+        return "style";
+    case Stage::SortIncludes:
+        return "sort-includes";
+    case Stage::Reformat:
+        return "reformat";
+    case Stage::Apply:
+        return "apply";
+    }
+    return "unknown";
 }
 
-auto is_ignored(const std::string path) -> bool {
-    return clang::format::is_ignored(path);
+auto is_ignored(FormatContext &ctx, std::string_view path) -> bool {
+    clang::format::StageTimer Timer(*ctx.Stats, Stage::Ignore);
+    return ctx.Ignores->is_ignored(path);
 }
 
 auto defaultFormatStyle() -> std::string {
@@ -1,27 +1,304 @@
 #ifndef FORO_CLANG_FORMA_LIB_H_
 #define FORO_CLANG_FORMA_LIB_H_
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <sstream>
+#include <string_view>
 #include <vector>
 
+namespace clang {
+namespace format {
+class IgnoreIndex;
+class LineTable;
+class ResultCache;
+class StatsCollector;
+class StyleCache;
+} // namespace format
+} // namespace clang
+
 struct Result {
   bool error;
   std::string content;
 };
 
+struct CheckResult {
+  bool error;
+  std::string content;   // The error message, if any.
+  unsigned changes;      // Number of edits formatting would make.
+  unsigned first_offset; // Offset of the first of them.
+};
+
+// Replaces `length` bytes at `offset` of the original code with `text`.
+struct Edit {
+  unsigned offset;
+  unsigned length;
+  std::string text;
+};
+
+struct EditsResult {
+  bool error;
+  std::string content;     // The error message, if any.
+  std::vector<Edit> edits; // Sorted by offset, not overlapping.
+};
+
+struct CacheStats {
+  uint64_t hits;
+  uint64_t disk_hits; // Also counted in `hits`.
+  uint64_t misses;
+  uint64_t entries;
+  uint64_t bytes;
+};
+
+// The stages of a request that `set_stats` times.
+enum class Stage : unsigned {
+  Request,      // A whole call, as reported through `record_request`.
+  Ignore,       // `.clang-format-ignore` matching.
+  Style,        // Finding and resolving the style.
+  SortIncludes, // `sortIncludes`.
+  Reformat,     // `reformat`.
+  Apply,        // Splicing the replacements into the code.
+};
+constexpr unsigned stage_count = 6;
+constexpr unsigned stats_buckets = 24;
+
+// How long the runs of one stage took. `buckets[i]` counts the runs that took
+// less than 2^i microseconds but not less than 2^(i-1); the last one also
+// counts everything longer.
+struct StageStats {
+  uint64_t count;
+  uint64_t total_ns;
+  uint64_t max_ns;
+  uint64_t buckets[stats_buckets];
+};
+
+struct FormatStats {
+  StageStats stages[stage_count]; // Indexed by `Stage`.
+  uint64_t bytes_in;              // Request and response sizes, as passed
+  uint64_t bytes_out;             // to `record_request`.
+  uint64_t style_hits;
+  uint64_t style_misses;
+  uint64_t result_hits;
+  uint64_t result_misses;
+};
+
+// Lines of the file at `path` to format, as `format_line` takes them.
+struct FileLines {
+  std::string path;
+  std::vector<unsigned> lines;
+};
+
+struct DiffResult {
+  bool error;
+  std::string content;          // The error message, if any.
+  std::vector<FileLines> files; // In the order the diff has them.
+};
+
+// How long `reformat` may take per call. See `set_budget`.
+struct Budget {
+  uint64_t milliseconds; // 0 for no limit.
+  bool fallback;         // Format without a column limit when it runs out.
+};
+
+struct FileResult {
+  bool error;
+  std::string content; // The formatted code, or the error message.
+  bool changed;        // Formatting changed the file.
+};
+
+struct FormatContext;
+
+// Runs `work` on `threads` workers at once, each with a context that no other
+// thread uses meanwhile, and returns once every one of them has. The host
+// decides where the workers and their contexts come from.
+using WorkerRunner = std::function<void(
+    unsigned threads, const std::function<void(FormatContext &)> &work)>;
+
+// One file `format_tree` formatted, or a directory it failed to list.
+struct TreeEntry {
+  std::string path;
+  FileResult result;
+};
+
+struct TreeResult {
+  bool error;          // The root could not be walked at all.
+  std::string message; // Why, if so.
+  uint64_t directories;
+  uint64_t pruned; // Directories whose files were all ignored unseen,
+                   // listed or not.
+  uint64_t files;  // Files formatted, whether or not they changed.
+  uint64_t changed;
+  uint64_t ignored; // Files skipped for `.clang-format-ignore`.
+  uint64_t errors;  // Entries reported with an error.
+};
+
+// Settings and caches of one formatting session. Nothing in the library is
+// shared between contexts, so threads that each use their own context can
+// format concurrently without any locking.
+struct FormatContext {
+  FormatContext();
+  ~FormatContext();
+  FormatContext(FormatContext &&) noexcept;
+  FormatContext &operator=(FormatContext &&) noexcept;
+
+  std::string FallbackStyle;
+  unsigned Cursor{0};
+  bool SortIncludes{false};
+  std::string QualifierAlignment;
+  // See `set_parallel_format`.
+  size_t ParallelThreshold{0};
+  unsigned ParallelThreads{0};
+  // See `set_cancel_flag`.
+  const std::atomic<bool> *Cancelled{nullptr};
+  // See `set_budget`.
+  Budget ReformatBudget{0, false};
+  // Whether the last call fell back to formatting without a column limit.
+  bool Degraded{false};
+
+  // Parsed `.clang-format-ignore` files, keyed by the directories they govern.
+  std::unique_ptr<clang::format::IgnoreIndex> Ignores;
+
+  // Resolved `FormatStyle`s, keyed by the config file that applies.
+  std::unique_ptr<clang::format::StyleCache> Styles;
+
+  // Formatted code, keyed by content and style. See `set_result_cache`.
+  std::unique_ptr<clang::format::ResultCache> Results;
+
+  // Scratch for translating line ranges, reused across calls.
+  std::unique_ptr<clang::format::LineTable> Lines;
+
+  // Stage timings and counters. See `set_stats`.
+  std::unique_ptr<clang::format::StatsCollector> Stats;
+};
+
 auto version() -> std::string;
-auto format(const std::string str, const std::string assumedFileName,
-            const std::string style) -> Result;
-auto format_byte(const std::string str, const std::string assumedFileName,
-                 const std::string style, const std::vector<unsigned> ranges)
-    -> Result;
-auto format_line(const std::string str, const std::string assumedFileName,
-                 const std::string style, const std::vector<unsigned> ranges)
+// Inputs are only read during the call and need not be null-terminated.
+auto format(FormatContext &ctx, std::string_view str,
+            std::string_view assumedFileName, std::string_view style)
     -> Result;
-auto set_fallback_style(const std::string style) -> void;
-auto set_sort_includes(const bool sort) -> void;
-auto dump_config(const std::string style, const std::string FileName,
-                 const std::string code) -> Result;
-auto is_ignored(const std::string path) -> bool;
+auto format_byte(FormatContext &ctx, std::string_view str,
+                 std::string_view assumedFileName, std::string_view style,
+                 const std::vector<unsigned> &ranges) -> Result;
+auto format_line(FormatContext &ctx, std::string_view str,
+                 std::string_view assumedFileName, std::string_view style,
+                 const std::vector<unsigned> &ranges) -> Result;
+// Formats `code` straight into the buffer returned by `alloc`, which is called
+// exactly once, with the size of the formatted code, unless formatting fails.
+// On success the result's content is empty.
+auto format_into(FormatContext &ctx, std::string_view code,
+                 std::string_view assumedFileName, std::string_view style,
+                 const std::function<char *(size_t)> &alloc) -> Result;
+// Reports whether formatting would change `code`, without producing the
+// formatted code.
+auto check(FormatContext &ctx, std::string_view code,
+           std::string_view assumedFileName, std::string_view style)
+    -> CheckResult;
+// Returns the edits that format `code`, instead of the formatted code.
+auto format_edits(FormatContext &ctx, std::string_view code,
+                  std::string_view assumedFileName, std::string_view style)
+    -> EditsResult;
+// Formats the code that `edits`, sorted and disjoint, make of `previous`,
+// which should be formatted already. Only the top-level declarations the edits
+// touch are reformatted, so the cost follows the size of the edits rather than
+// of the file.
+auto format_incremental(FormatContext &ctx, std::string_view previous,
+                        const std::vector<Edit> &edits,
+                        std::string_view assumedFileName,
+                        std::string_view style) -> Result;
+// Formats the file at `path`, which is read through a read-only mapping when
+// it is large. With `write_back` a file that formatting changes is replaced
+// atomically and the content is left empty; an unchanged file is not touched.
+auto format_file(FormatContext &ctx, std::string_view path,
+                 std::string_view style, bool write_back) -> FileResult;
+// `format_line` for the file at `path`, read and written back like
+// `format_file` does. Without any `lines` the file is left as it is.
+auto format_file_lines(FormatContext &ctx, std::string_view path,
+                       std::string_view style,
+                       const std::vector<unsigned> &lines, bool write_back)
+    -> FileResult;
+// The lines a unified diff adds to each file, for `format_file_lines`. Paths
+// are those of the diff's `+++` lines without their first `strip` components.
+auto changed_lines(std::string_view diff, unsigned strip) -> DiffResult;
+// Formats every regular file below the directory `root` whose extension
+// (without the dot) is in `extensions`, as `format_file` does, on `threads`
+// workers that `run` provides. Directories are listed in parallel as well,
+// and symbolic links and version control directories are not followed. Files
+// that `.clang-format-ignore` ignores are skipped, and in a directory whose
+// files it ignores all, only the subdirectories with an ignore file of their
+// own are looked into; ignore files further down are not looked for. A file
+// or directory whose task throws is reported as an error. Config files are
+// checked once per worker instead of once per file. `emit` is called for
+// each file formatted and each directory that can't be listed, from the
+// worker that handled it, one call at a time.
+auto format_tree(const WorkerRunner &run, unsigned threads,
+                 std::string_view root,
+                 const std::vector<std::string> &extensions,
+                 std::string_view style, bool write_back,
+                 const std::function<void(const TreeEntry &)> &emit)
+    -> TreeResult;
+// While `*flag` is set, formatting on `ctx` fails with "cancelled" at the next
+// stage instead of going on. Another thread may set it at any time; pass
+// nullptr to stop looking at it.
+auto set_cancel_flag(FormatContext &ctx, const std::atomic<bool> *flag)
+    -> void;
+// Bounds the time formatting on `ctx` spends in `reformat`, whose line
+// breaking search can take seconds on pathological input. A call that runs
+// out fails with an error for which `is_timeout` holds, or with
+// `budget.fallback` formats again with no column limit, which keeps the line
+// breaks of the input and takes linear time; such output is not cached. The
+// fallback has a budget of the same length, and fails the same way if it
+// runs out as well.
+// Budgeted searches run on a fixed set of workers, one per hardware thread.
+// One that runs out can't be stopped and holds its worker until it is done;
+// while every worker is held so, budgeted calls run out at once.
+auto set_budget(FormatContext &ctx, Budget budget) -> void;
+auto get_budget(const FormatContext &ctx) -> Budget;
+// Whether `message`, the content of an error result, says the budget ran out.
+auto is_timeout(std::string_view message) -> bool;
+// Forgets the resolved styles and parsed ignore files of `ctx`, so that config
+// files, new ones included, are looked for again.
+auto clear_config_caches(FormatContext &ctx) -> void;
+// For files under one of `roots`, absolute directories, the config files
+// behind a style are checked the first time it is used and trusted from then
+// on, and directories are not searched again for new ignore files; for hosts
+// that watch the config files there, and those of the directories above, and
+// call `clear_config_caches` on changes. Pass no roots to check config files
+// on every use again.
+auto set_trusted_roots(FormatContext &ctx, std::vector<std::string> roots)
+    -> void;
+auto set_fallback_style(FormatContext &ctx, std::string_view style) -> void;
+auto set_sort_includes(FormatContext &ctx, const bool sort) -> void;
+// Keeps up to `capacity` bytes of formatted code in memory, keyed by content
+// and style, and, unless `directory` is empty, every result in files under
+// `directory` as well. Whole-file formatting that hits the cache skips include
+// sorting and `reformat`. The cache is off by default.
+auto set_result_cache(FormatContext &ctx, size_t capacity,
+                      std::string_view directory) -> void;
+auto result_cache_stats(const FormatContext &ctx) -> CacheStats;
+// Formats C-family files of at least `threshold` bytes in chunks, cut between
+// top-level declarations for `threads` threads (0 for one per hardware
+// thread). The chunks of all contexts share one pool with a thread per
+// hardware thread. The result is the same as formatting the whole file;
+// where that can't be shown cheaply, the file is formatted whole. A threshold
+// of 0, the default, turns this off.
+auto set_parallel_format(FormatContext &ctx, size_t threshold,
+                         unsigned threads) -> void;
+// Times the stages of every call on `ctx` and counts cache hits, adding to
+// what `format_stats` returns. Off by default, when it costs a load and a
+// branch per stage.
+auto set_stats(FormatContext &ctx, bool enabled) -> void;
+auto stats_enabled(const FormatContext &ctx) -> bool;
+// Unlike everything else here, safe to call from any thread while another one
+// uses `ctx`.
+auto format_stats(const FormatContext &ctx) -> FormatStats;
+// Adds a call made by the caller to `Stage::Request`, if stats are enabled.
+auto record_request(FormatContext &ctx, uint64_t nanoseconds, uint64_t bytes_in,
+                    uint64_t bytes_out) -> void;
+auto stage_name(Stage stage) -> const char *;
+auto dump_config(FormatContext &ctx, std::string_view style,
+                 std::string_view FileName, std::string_view code) -> Result;
+auto is_ignored(FormatContext &ctx, std::string_view path) -> bool;
 
 auto defaultFormatStyle() -> std::string;
 
@@ -0,0 +1,68 @@
+#include "line_table.h"
+
+#include <cassert>
+
+#include "llvm/ADT/bit.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace clang {
+namespace format {
+
+auto LineTable::reset(StringRef Buffer) -> void {
+    Code = Buffer;
+    Starts.clear();
+    Starts.push_back(0);
+
+    const char *Data = Code.data();
+    const size_t Size = Code.size();
+
+    // Line breaks are `\n`, `\r` and `\r\n`, as for `SourceManager`.
+    auto Break = [&](size_t At) {
+        if (Data[At] == '\r' && At + 1 < Size && Data[At + 1] == '\n')
+            return; // The line ends after the `\n`.
+        Starts.push_back(At + 1);
+    };
+
+    size_t I = 0;
+#if defined(__SSE2__)
+    const __m128i LF = _mm_set1_epi8('\n');
+    const __m128i CR = _mm_set1_epi8('\r');
+    for (; I + 16 <= Size; I += 16) {
+        const __m128i Chunk =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(Data + I));
+        unsigned Mask = _mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(Chunk, LF), _mm_cmpeq_epi8(Chunk, CR)));
+        for (; Mask; Mask &= Mask - 1)
+            Break(I + llvm::countr_zero(Mask));
+    }
+#endif
+    for (; I < Size; ++I) {
+        if (Data[I] == '\n' || Data[I] == '\r')
+            Break(I);
+    }
+}
+
+auto LineTable::offset(unsigned Line, unsigned Col) const -> unsigned {
+    assert(Line > 0 && "Lines start from 1");
+
+    if (Line > Starts.size())
+        return Code.empty() ? 0 : Code.size() - 1;
+
+    const unsigned Pos = Starts[Line - 1];
+    const unsigned Length = Code.size() - Pos;
+    if (Length == 0)
+        return Pos;
+
+    unsigned I = 0;
+    while (I < Length - 1 && I < Col - 1 && Code[Pos + I] != '\n' &&
+           Code[Pos + I] != '\r') {
+        ++I;
+    }
+    return Pos + I;
+}
+
+} // namespace format
+} // namespace clang
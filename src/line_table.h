@@ -0,0 +1,37 @@
+#ifndef FORO_CLANG_FORMAT_LINE_TABLE_H_
+#define FORO_CLANG_FORMAT_LINE_TABLE_H_
+
+#include <vector>
+
+#include "clang/Basic/LLVM.h"
+#include "llvm/ADT/StringRef.h"
+
+namespace clang {
+namespace format {
+
+// Start offsets of the lines of a buffer, found with one vectorized scan for
+// line breaks. Translates line and column numbers exactly like
+// `SourceManager::translateLineCol`, without the `FileManager`, diagnostics
+// and `SourceManager` that would take to set up. The table keeps its storage
+// across `reset`s, so a context reuses it for every ranged request.
+class LineTable {
+  public:
+    // Indexes `Code`, which must outlive the following lookups.
+    auto reset(StringRef Code) -> void;
+
+    auto lines() const -> unsigned { return Starts.size(); }
+
+    // Offset of column `Col` of line `Line`, both 1-based. A line past the end
+    // maps to the last byte, and a column past the end of its line to the
+    // line break.
+    auto offset(unsigned Line, unsigned Col) const -> unsigned;
+
+  private:
+    StringRef Code;
+    std::vector<unsigned> Starts;
+};
+
+} // namespace format
+} // namespace clang
+
+#endif
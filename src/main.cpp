@@ -1,11 +1,24 @@
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
+#include <functional>
+#include <latch>
+#include <mutex>
 #include <nlohmann/json.hpp>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+#include "binary_protocol.h"
+#include "buffer_pool.h"
+#include "daemon_client.h"
+#include "job_queue.h"
 #include "lib.h"
+#include "request_ring.h"
+#include "thread_pool.h"
 
 struct FormatResult {
     enum class Status { Success, Ignored, Error };
@@ -20,36 +33,402 @@ struct FormatResult {
 };
 
 extern "C" {
+// Requests and results go through `buffer_pool`. Results are allocated with
+// an alignment of 8 and take `8 + length` bytes, the length being their
+// prefix; `foro_free` need not be given the same size and alignment, which
+// the pool keeps track of itself.
 __attribute__((visibility("default"))) uint64_t
 foro_malloc(uint64_t size, uint64_t alignment) {
-    void *ptr = std::malloc((size_t)size);
-    return (uint64_t)ptr;
+    return (uint64_t)buffer_pool::allocate((size_t)size, (size_t)alignment);
 }
 
 __attribute__((visibility("default"))) void
 foro_free(uint64_t ptr, uint64_t size, uint64_t alignment) {
-    std::free((void *)ptr);
+    buffer_pool::deallocate((void *)ptr);
+}
+
+// Frees the memory cached for reuse by `foro_malloc` and the results, of all
+// threads, and returns the number of bytes released.
+__attribute__((visibility("default"))) uint64_t foro_trim() {
+    return buffer_pool::trim();
 }
 }
 
-static uint8_t *to_array_result(const std::vector<uint8_t> &arr) {
-    size_t total_size = 8 + arr.size();
-    uint8_t *buffer = (uint8_t *)std::malloc(total_size);
+// Where the results of the calling thread go while it answers a request from
+// a ring: the slot's own result area, as long as it is free and large enough.
+struct ResultTarget {
+    uint8_t *data;
+    size_t capacity;
+    bool taken;
+};
+
+static thread_local ResultTarget *result_target = nullptr;
+
+// A result of `size` bytes after the length prefix, which is filled in.
+static uint8_t *alloc_result(size_t size) {
+    ResultTarget *target = result_target;
+    if (target && !target->taken && size <= target->capacity - 8) {
+        target->taken = true;
+        binary_protocol::write_le(target->data, size, 8);
+        return target->data;
+    }
+
+    uint8_t *buffer = (uint8_t *)buffer_pool::allocate(8 + size, 8);
     if (!buffer) {
         throw std::bad_alloc();
     }
+    binary_protocol::write_le(buffer, size, 8);
+    return buffer;
+}
 
-    uint64_t len_le = (uint64_t)arr.size();
-    for (int i = 0; i < 8; ++i) {
-        buffer[i] = (uint8_t)((len_le >> (8 * i)) & 0xFF);
+static void free_result(uint8_t *result) {
+    if (result_target && result == result_target->data) {
+        result_target->taken = false;
+    } else {
+        buffer_pool::deallocate(result);
     }
+}
 
+static uint8_t *to_array_result(const std::vector<uint8_t> &arr) {
+    uint8_t *buffer = alloc_result(arr.size());
     std::memcpy(buffer + 8, arr.data(), arr.size());
+    return buffer;
+}
+
+// Allocates a binary-protocol result with room for `payload_size` bytes of
+// payload, which start `8 + binary_protocol::response_header_size` bytes in.
+static uint8_t *alloc_binary_result(binary_protocol::Status status,
+                                    size_t payload_size) {
+    uint8_t *buffer =
+        alloc_result(binary_protocol::response_header_size + payload_size);
+    binary_protocol::write_response_header(buffer + 8, status);
+
+    return buffer;
+}
+
+static uint8_t *binary_payload(uint8_t *result) {
+    return result + 8 + binary_protocol::response_header_size;
+}
 
+static uint8_t *binary_result(binary_protocol::Status status,
+                              std::string_view payload) {
+    uint8_t *buffer = alloc_binary_result(status, payload.size());
+    std::memcpy(binary_payload(buffer), payload.data(), payload.size());
     return buffer;
 }
 
-static nlohmann::json foro_main_with_json(const nlohmann::json &input) {
+// "timeout" for an error that says the budget ran out, "error" otherwise.
+static const char *error_status(const std::string &message) {
+    return is_timeout(message) ? "timeout" : "error";
+}
+
+static binary_protocol::Status error_code(const std::string &message) {
+    return is_timeout(message) ? binary_protocol::Status::Timeout
+                               : binary_protocol::Status::Error;
+}
+
+// Sets up the result cache from the environment. FORO_CLANG_FORMAT_CACHE_SIZE
+// is the in-memory budget of each context in bytes (16 MiB by default, 0
+// turns it off), and FORO_CLANG_FORMAT_CACHE_DIR, if set, the directory of the
+// persistent store, which all contexts and processes share. Setting
+// FORO_CLANG_FORMAT_STATS to anything but 0 turns on the statistics that
+// `foro_stats` reports. If FORO_CLANG_FORMAT_PARALLEL_THRESHOLD is set to more
+// than 0, C-family files of that many bytes or more are formatted in chunks
+// on FORO_CLANG_FORMAT_PARALLEL_THREADS threads (one per core by default).
+// FORO_CLANG_FORMAT_BUDGET_MS bounds the time `reformat` may take per request,
+// after which the request fails with a "timeout" status, or, with
+// FORO_CLANG_FORMAT_BUDGET_FALLBACK set to anything but 0, is formatted
+// again without a column limit.
+static void configure_context(FormatContext &context) {
+    size_t capacity = 16 << 20;
+    if (const char *size = std::getenv("FORO_CLANG_FORMAT_CACHE_SIZE")) {
+        capacity = std::strtoull(size, nullptr, 10);
+    }
+    const char *dir = std::getenv("FORO_CLANG_FORMAT_CACHE_DIR");
+    set_result_cache(context, capacity, dir ? dir : "");
+
+    const char *stats = std::getenv("FORO_CLANG_FORMAT_STATS");
+    set_stats(context, stats && *stats && std::strcmp(stats, "0") != 0);
+
+    size_t threshold = 0;
+    if (const char *t = std::getenv("FORO_CLANG_FORMAT_PARALLEL_THRESHOLD")) {
+        threshold = std::strtoull(t, nullptr, 10);
+    }
+    unsigned threads = 0;
+    if (const char *t = std::getenv("FORO_CLANG_FORMAT_PARALLEL_THREADS")) {
+        threads = std::strtoul(t, nullptr, 10);
+    }
+    set_parallel_format(context, threshold, threads);
+
+    Budget budget{0, false};
+    if (const char *ms = std::getenv("FORO_CLANG_FORMAT_BUDGET_MS")) {
+        budget.milliseconds = std::strtoull(ms, nullptr, 10);
+    }
+    const char *fallback = std::getenv("FORO_CLANG_FORMAT_BUDGET_FALLBACK");
+    budget.fallback = fallback && *fallback && std::strcmp(fallback, "0") != 0;
+    set_budget(context, budget);
+}
+
+static void add_stats(FormatStats &into, const FormatStats &stats) {
+    for (unsigned i = 0; i < stage_count; ++i) {
+        StageStats &to = into.stages[i];
+        const StageStats &from = stats.stages[i];
+        to.count += from.count;
+        to.total_ns += from.total_ns;
+        to.max_ns = std::max(to.max_ns, from.max_ns);
+        for (unsigned b = 0; b < stats_buckets; ++b) {
+            to.buckets[b] += from.buckets[b];
+        }
+    }
+    into.bytes_in += stats.bytes_in;
+    into.bytes_out += stats.bytes_out;
+    into.style_hits += stats.style_hits;
+    into.style_misses += stats.style_misses;
+    into.result_hits += stats.result_hits;
+    into.result_misses += stats.result_misses;
+}
+
+// Statistics of every context the exports have used, for `foro_stats`: the
+// thread contexts still alive, read as they run, and the totals of the others.
+class StatsRegistry {
+  public:
+    void add(const FormatContext &context) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        live_.push_back(&context);
+    }
+
+    void remove(const FormatContext &context) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        live_.erase(std::find(live_.begin(), live_.end(), &context));
+        add_stats(retired_, format_stats(context));
+    }
+
+    FormatStats total() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        FormatStats total = retired_;
+        for (const FormatContext *context : live_) {
+            add_stats(total, format_stats(*context));
+        }
+        return total;
+    }
+
+  private:
+    std::mutex mutex_;
+    std::vector<const FormatContext *> live_;
+    FormatStats retired_{};
+};
+
+static StatsRegistry &stats_registry() {
+    // Never destroyed, as host threads may still exit after static
+    // destructors have run.
+    static StatsRegistry *registry = new StatsRegistry;
+    return *registry;
+}
+
+// Bumped by `foro_config_changed`. Thread contexts that saw an older value
+// drop what they know about config files.
+static std::atomic<uint64_t> config_epoch{0};
+// Set by `foro_config_watch`, which bumps the epoch as well.
+static std::mutex watched_roots_mutex;
+static std::vector<std::string> watched_roots;
+
+struct ThreadContext {
+    FormatContext context;
+    uint64_t epoch{0};
+
+    ThreadContext() {
+        configure_context(context);
+        stats_registry().add(context);
+    }
+    ~ThreadContext() { stats_registry().remove(context); }
+};
+
+// Context for requests that arrive through `foro_main`. The host may call in
+// from several threads, so each thread keeps its own.
+static FormatContext &thread_context() {
+    static thread_local ThreadContext thread;
+
+    const uint64_t epoch = config_epoch.load(std::memory_order_acquire);
+    if (thread.epoch != epoch) {
+        clear_config_caches(thread.context);
+        std::lock_guard<std::mutex> lock(watched_roots_mutex);
+        set_trusted_roots(thread.context, watched_roots);
+        thread.epoch = epoch;
+    }
+    return thread.context;
+}
+
+// The working directory of the host a request came from, set by
+// `foro_main_in`; relative targets are taken from there instead of from the
+// working directory of this process.
+static thread_local const std::string *request_dir = nullptr;
+
+struct RequestDirReset {
+    ~RequestDirReset() { request_dir = nullptr; }
+};
+
+static std::string resolve_target(std::string_view target) {
+    if (!request_dir || target.empty() || target.front() == '/') {
+        return std::string(target);
+    }
+    std::string path = *request_dir;
+    if (path.back() != '/') {
+        path += '/';
+    }
+    path += target;
+    return path;
+}
+
+static uint64_t elapsed_ns(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - start)
+        .count();
+}
+
+static nlohmann::json stats_json(const FormatStats &stats) {
+    nlohmann::json stages = nlohmann::json::object();
+    for (unsigned i = 0; i < stage_count; ++i) {
+        const StageStats &s = stats.stages[i];
+        // Element `i` counts the runs under 2^i microseconds; trailing empty
+        // buckets are left out.
+        unsigned used = stats_buckets;
+        while (used > 0 && s.buckets[used - 1] == 0) {
+            --used;
+        }
+        stages[stage_name(static_cast<Stage>(i))] = {
+            {"count", s.count},
+            {"total-ns", s.total_ns},
+            {"max-ns", s.max_ns},
+            {"histogram-us", std::vector<uint64_t>(s.buckets, s.buckets + used)}};
+    }
+    return nlohmann::json{
+        {"stages", std::move(stages)},
+        {"bytes-in", stats.bytes_in},
+        {"bytes-out", stats.bytes_out},
+        {"style-cache",
+         {{"hits", stats.style_hits}, {"misses", stats.style_misses}}},
+        {"result-cache",
+         {{"hits", stats.result_hits}, {"misses", stats.result_misses}}}};
+}
+
+// What one request spent in each stage, from the statistics before and after.
+static nlohmann::json timings_json(const FormatStats &before,
+                                   const FormatStats &after,
+                                   uint64_t total_ns) {
+    nlohmann::json timings{{"total-ns", total_ns}};
+    for (unsigned i = 0; i < stage_count; ++i) {
+        const Stage stage = static_cast<Stage>(i);
+        if (stage == Stage::Request) {
+            continue;
+        }
+        timings[std::string(stage_name(stage)) + "-ns"] =
+            after.stages[i].total_ns - before.stages[i].total_ns;
+    }
+    timings["style-cache-hits"] = after.style_hits - before.style_hits;
+    timings["result-cache-hits"] = after.result_hits - before.result_hits;
+    return timings;
+}
+
+static nlohmann::json cache_stats_json(const CacheStats &stats) {
+    return nlohmann::json{{"hits", stats.hits},
+                          {"disk-hits", stats.disk_hits},
+                          {"misses", stats.misses},
+                          {"entries", stats.entries},
+                          {"bytes", stats.bytes}};
+}
+
+// Format-on-type: instead of "target-content" the request has the formatted
+// "previous-content" and the "edits" made to it since, each an object with
+// "offset", "length" and "text", sorted and disjoint. Only the declarations
+// the edits touch are reformatted; the reply is the same as for a full format.
+static nlohmann::json foro_incremental_with_json(FormatContext &context,
+                                                 const nlohmann::json &input) {
+    if (!input["previous-content"].is_string()) {
+        return nlohmann::json{
+            {"plugin-panic", "Invalid 'previous-content' field"}};
+    }
+    if (!input.contains("edits") || !input["edits"].is_array()) {
+        return nlohmann::json{
+            {"plugin-panic", "Missing or invalid 'edits' field"}};
+    }
+
+    std::vector<Edit> edits;
+    for (const auto &e : input["edits"]) {
+        if (!e.is_object() || !e.contains("offset") ||
+            !e["offset"].is_number_unsigned() || !e.contains("length") ||
+            !e["length"].is_number_unsigned() || !e.contains("text") ||
+            !e["text"].is_string()) {
+            return nlohmann::json{{"plugin-panic", "Invalid edit"}};
+        }
+        edits.push_back({e["offset"].get<unsigned>(),
+                         e["length"].get<unsigned>(),
+                         e["text"].get<std::string>()});
+    }
+
+    const std::string target =
+        resolve_target(input["os-target"].get_ref<const std::string &>());
+
+    if (is_ignored(context, target)) {
+        return nlohmann::json{{"format-status", "ignored"}};
+    }
+
+    Result r = format_incremental(
+        context, input["previous-content"].get_ref<const std::string &>(),
+        edits, target, defaultFormatStyle());
+
+    nlohmann::json result;
+    if (!r.error) {
+        result["format-status"] = "success";
+        result["formatted-content"] = std::move(r.content);
+    } else {
+        result["format-status"] = error_status(r.content);
+        result["format-error"] = std::move(r.content);
+    }
+
+    return result;
+}
+
+// A request with only "os-target" has the plugin read the file itself. With
+// `"write-back": true` a file that formatting changes is replaced atomically,
+// and the reply carries `"written": true|false` instead of the content.
+static nlohmann::json foro_path_with_json(FormatContext &context,
+                                          const nlohmann::json &input) {
+    const std::string target =
+        resolve_target(input["os-target"].get_ref<const std::string &>());
+
+    bool write_back = false;
+    if (input.contains("write-back")) {
+        if (!input["write-back"].is_boolean()) {
+            return nlohmann::json{
+                {"plugin-panic", "Invalid 'write-back' field"}};
+        }
+        write_back = input["write-back"].get<bool>();
+    }
+
+    if (is_ignored(context, target)) {
+        return nlohmann::json{{"format-status", "ignored"}};
+    }
+
+    FileResult r =
+        format_file(context, target, defaultFormatStyle(), write_back);
+
+    nlohmann::json result;
+    if (r.error) {
+        result["format-status"] = error_status(r.content);
+        result["format-error"] = std::move(r.content);
+    } else if (write_back) {
+        result["format-status"] = "success";
+        result["written"] = r.changed;
+    } else {
+        result["format-status"] = "success";
+        result["formatted-content"] = std::move(r.content);
+    }
+
+    return result;
+}
+
+static nlohmann::json foro_request_with_json(FormatContext &context,
+                                             const nlohmann::json &input) {
     // If compile target is WASM, we should read "wasm-target" instead of
     // "os-target".
 
@@ -60,59 +439,1036 @@ static nlohmann::json foro_main_with_json(const nlohmann::json &input) {
         return nlohmann::json{
             {"plugin-panic", "Missing or invalid 'target' field"}};
     }
-    if (!input.contains("target-content") ||
-        !input["target-content"].is_string()) {
+    if (input.contains("previous-content")) {
+        return foro_incremental_with_json(context, input);
+    }
+    if (!input.contains("target-content")) {
+        return foro_path_with_json(context, input);
+    }
+    if (!input["target-content"].is_string()) {
         return nlohmann::json{
             {"plugin-panic", "Missing or invalid 'target-content' field"}};
     }
 
-    std::string target = input["os-target"].get<std::string>();
-    std::string target_content = input["target-content"].get<std::string>();
+    const std::string target =
+        resolve_target(input["os-target"].get_ref<const std::string &>());
+    const std::string &target_content =
+        input["target-content"].get_ref<const std::string &>();
 
-    if (is_ignored(target)) {
+    if (is_ignored(context, target)) {
         return nlohmann::json{{"format-status", "ignored"}};
     }
 
-    Result r = ::format(target_content, target, defaultFormatStyle());
+    // With `"check": true` only report whether the content would change.
+    if (input.contains("check") && input["check"].is_boolean() &&
+        input["check"].get<bool>()) {
+        CheckResult r =
+            check(context, target_content, target, defaultFormatStyle());
+
+        nlohmann::json result;
+        if (r.error) {
+            result["format-status"] = error_status(r.content);
+            result["format-error"] = std::move(r.content);
+        } else if (r.changes == 0) {
+            result["format-status"] = "unchanged";
+        } else {
+            result["format-status"] = "changed";
+            result["change-count"] = r.changes;
+            result["first-change-offset"] = r.first_offset;
+        }
+        return result;
+    }
+
+    // With `"output": "replacements"` return the edits instead of the
+    // formatted content.
+    if (input.contains("output") && input["output"].is_string() &&
+        input["output"].get<std::string>() == "replacements") {
+        EditsResult r =
+            format_edits(context, target_content, target, defaultFormatStyle());
+
+        nlohmann::json result;
+        if (r.error) {
+            result["format-status"] = error_status(r.content);
+            result["format-error"] = std::move(r.content);
+            return result;
+        }
+
+        nlohmann::json replacements = nlohmann::json::array();
+        for (Edit &e : r.edits) {
+            replacements.push_back({{"offset", e.offset},
+                                    {"length", e.length},
+                                    {"text", std::move(e.text)}});
+        }
+        result["format-status"] = "success";
+        result["replacements"] = std::move(replacements);
+        return result;
+    }
+
+    Result r =
+        ::format(context, target_content, target, defaultFormatStyle());
 
     nlohmann::json result;
     if (!r.error) {
         result["format-status"] = "success";
-        result["formatted-content"] = r.content;
+        result["formatted-content"] = std::move(r.content);
     } else {
-        result["format-status"] = "error";
-        result["format-error"] = r.content;
+        result["format-status"] = error_status(r.content);
+        result["format-error"] = std::move(r.content);
     }
 
     return result;
 }
 
+// Puts back the statistics setting of a context when a timed request is done.
+struct StatsOverride {
+    FormatContext &context;
+    bool saved;
+
+    ~StatsOverride() { set_stats(context, saved); }
+};
+
+// With `"timings": true` the reply also has "timings", the nanoseconds the
+// request spent in each stage and the cache hits it had. Such a request is
+// timed even if statistics are off, and counts toward them.
+static nlohmann::json foro_timed_with_json(FormatContext &context,
+                                           const nlohmann::json &input) {
+    if (!input.contains("timings") || !input["timings"].is_boolean() ||
+        !input["timings"].get<bool>()) {
+        return foro_request_with_json(context, input);
+    }
+
+    const StatsOverride restore{context, stats_enabled(context)};
+    set_stats(context, true);
+    const FormatStats before = format_stats(context);
+    const auto start = std::chrono::steady_clock::now();
+
+    nlohmann::json result = foro_request_with_json(context, input);
+
+    const uint64_t total_ns = elapsed_ns(start);
+    const FormatStats after = format_stats(context);
+
+    result["timings"] = timings_json(before, after, total_ns);
+    return result;
+}
+
+// Puts back the budget of a context when a request that set its own is done.
+struct BudgetOverride {
+    FormatContext &context;
+    Budget saved;
+
+    ~BudgetOverride() { set_budget(context, saved); }
+};
+
+// With `"budget-ms": N` the request may spend N milliseconds in `reformat`
+// (0 for no limit) instead of what FORO_CLANG_FORMAT_BUDGET_MS says, and with
+// `"budget-fallback": true|false` it chooses whether to fall back to
+// formatting without a column limit or to fail with a "timeout" status.
+static nlohmann::json foro_main_with_json(FormatContext &context,
+                                          const nlohmann::json &input) {
+    if (!input.contains("budget-ms") && !input.contains("budget-fallback")) {
+        return foro_timed_with_json(context, input);
+    }
+
+    Budget budget = get_budget(context);
+    const BudgetOverride restore{context, budget};
+    if (input.contains("budget-ms")) {
+        if (!input["budget-ms"].is_number_unsigned()) {
+            return nlohmann::json{
+                {"plugin-panic", "Invalid 'budget-ms' field"}};
+        }
+        budget.milliseconds = input["budget-ms"].get<uint64_t>();
+    }
+    if (input.contains("budget-fallback")) {
+        if (!input["budget-fallback"].is_boolean()) {
+            return nlohmann::json{
+                {"plugin-panic", "Invalid 'budget-fallback' field"}};
+        }
+        budget.fallback = input["budget-fallback"].get<bool>();
+    }
+    set_budget(context, budget);
+
+    return foro_timed_with_json(context, input);
+}
+
+static uint8_t *foro_main_binary(FormatContext &context, const uint8_t *data,
+                                 size_t len) {
+    using binary_protocol::Status;
+
+    binary_protocol::Request request;
+    if (const char *err = binary_protocol::parse_request(data, len, request)) {
+        return binary_result(Status::Panic, err);
+    }
+
+    const std::string resolved = resolve_target(request.target);
+    std::string_view target = resolved;
+
+    if (is_ignored(context, target)) {
+        return binary_result(Status::Ignored, "");
+    }
+
+    if (request.mode == binary_protocol::Mode::Check) {
+        CheckResult r = check(context, request.content, target,
+                              defaultFormatStyle());
+        if (r.error) {
+            return binary_result(error_code(r.content), r.content);
+        }
+        if (r.changes == 0) {
+            return binary_result(Status::Unchanged, "");
+        }
+
+        uint8_t *buffer = alloc_binary_result(Status::Changed, 8);
+        binary_protocol::write_le(binary_payload(buffer), r.changes, 4);
+        binary_protocol::write_le(binary_payload(buffer) + 4, r.first_offset,
+                                  4);
+        return buffer;
+    }
+
+    if (request.mode == binary_protocol::Mode::Edits) {
+        EditsResult r = format_edits(context, request.content, target,
+                                     defaultFormatStyle());
+        if (r.error) {
+            return binary_result(error_code(r.content), r.content);
+        }
+
+        size_t size = 4;
+        for (const Edit &e : r.edits) {
+            size += 12 + e.text.size();
+        }
+
+        uint8_t *buffer = alloc_binary_result(Status::Success, size);
+        uint8_t *out = binary_payload(buffer);
+        binary_protocol::write_le(out, r.edits.size(), 4);
+        out += 4;
+        for (const Edit &e : r.edits) {
+            binary_protocol::write_le(out, e.offset, 4);
+            binary_protocol::write_le(out + 4, e.length, 4);
+            binary_protocol::write_le(out + 8, e.text.size(), 4);
+            std::memcpy(out + 12, e.text.data(), e.text.size());
+            out += 12 + e.text.size();
+        }
+        return buffer;
+    }
+
+    if (request.mode == binary_protocol::Mode::FormatFile ||
+        request.mode == binary_protocol::Mode::FormatFileInPlace) {
+        const bool write_back =
+            request.mode == binary_protocol::Mode::FormatFileInPlace;
+        FileResult r =
+            format_file(context, target, defaultFormatStyle(), write_back);
+        if (r.error) {
+            return binary_result(error_code(r.content), r.content);
+        }
+        if (write_back) {
+            return binary_result(
+                r.changed ? Status::Changed : Status::Unchanged, "");
+        }
+        return binary_result(Status::Success, r.content);
+    }
+
+    // The formatted content goes straight into the result buffer.
+    uint8_t *buffer = nullptr;
+    Result r = format_into(context, request.content, target,
+                           defaultFormatStyle(), [&](size_t size) {
+                               buffer =
+                                   alloc_binary_result(Status::Success, size);
+                               return (char *)binary_payload(buffer);
+                           });
+
+    if (r.error) {
+        free_result(buffer);
+        return binary_result(error_code(r.content), r.content);
+    }
+
+    return buffer;
+}
+
+// The workers batch, diff and tree requests are formatted on, one per
+// hardware thread. Each formats with its `thread_context`, which stays warm
+// from one request to the next like those of host threads.
+static WorkStealingPool &worker_pool() {
+    static WorkStealingPool pool(WorkStealingPool::default_threads());
+    return pool;
+}
+
+// The workers to use for the "threads" field of a request: all of the pool's
+// for 0, and never more than that.
+static unsigned worker_threads(uint64_t requested) {
+    const unsigned workers = WorkStealingPool::default_threads();
+    if (requested == 0) {
+        return workers;
+    }
+    return (unsigned)std::min<uint64_t>(requested, workers);
+}
+
+// Runs `work` on `threads` workers of the pool at once and waits for them, or
+// runs it here with one. Only the given tasks are waited for, so requests
+// from several host threads can share the pool.
+static void run_on_workers(unsigned threads,
+                           const std::function<void(FormatContext &)> &work) {
+    if (threads <= 1) {
+        work(thread_context());
+        return;
+    }
+
+    std::latch done(threads);
+    for (unsigned i = 0; i < threads; ++i) {
+        worker_pool().submit([&] {
+            // Counted even if the work throws, which the pool swallows.
+            struct CountDown {
+                std::latch &latch;
+                ~CountDown() { latch.count_down(); }
+            } guard{done};
+            work(thread_context());
+        });
+    }
+    done.wait();
+}
+
+// A batch request is either an array of `foro_main` requests or an object
+// `{"items": [...], "threads": N}`. Items are formatted by `threads` workers
+// of the shared pool (see `worker_threads`), and the results are returned as
+// `{"results": [...]}` in input order, along with the result cache statistics
+// of the batch as `"cache"`: the hits and misses it had, and the size of the
+// caches of the workers it used. An item that throws gets a `plugin-panic`
+// result of its own.
+static nlohmann::json foro_main_batch_with_json(const nlohmann::json &input) {
+    const nlohmann::json *items = &input;
+    uint64_t requested = 0;
+
+    if (input.is_object()) {
+        if (!input.contains("items") || !input["items"].is_array()) {
+            return nlohmann::json{
+                {"plugin-panic", "Missing or invalid 'items' field"}};
+        }
+        items = &input["items"];
+
+        if (input.contains("threads")) {
+            if (!input["threads"].is_number_unsigned()) {
+                return nlohmann::json{
+                    {"plugin-panic", "Invalid 'threads' field"}};
+            }
+            requested = input["threads"].get<uint64_t>();
+        }
+    } else if (!input.is_array()) {
+        return nlohmann::json{
+            {"plugin-panic", "Batch input must be an array or an object"}};
+    }
+
+    const size_t count = items->size();
+    unsigned threads = worker_threads(requested);
+    if (threads > count) {
+        threads = count;
+    }
+
+    std::vector<nlohmann::json> results(count);
+    std::atomic<size_t> next{0};
+    std::mutex cache_mutex;
+    CacheStats cache{};
+    std::unordered_map<const FormatContext *, CacheStats> sizes;
+
+    run_on_workers(threads, [&](FormatContext &context) {
+        const CacheStats before = result_cache_stats(context);
+        for (size_t i; (i = next++) < count;) {
+            try {
+                results[i] = foro_main_with_json(context, (*items)[i]);
+            } catch (const std::exception &e) {
+                results[i] = nlohmann::json{
+                    {"plugin-panic", std::string("Panic: ") + e.what()}};
+            }
+        }
+        const CacheStats after = result_cache_stats(context);
+
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        cache.hits += after.hits - before.hits;
+        cache.disk_hits += after.disk_hits - before.disk_hits;
+        cache.misses += after.misses - before.misses;
+        sizes[&context] = after;
+    });
+    for (const auto &[context, size] : sizes) {
+        cache.entries += size.entries;
+        cache.bytes += size.bytes;
+    }
+
+    return nlohmann::json{{"results", std::move(results)},
+                          {"cache", cache_stats_json(cache)}};
+}
+
+// One file of a tree or diff request, as it is reported.
+static nlohmann::json file_entry_json(const TreeEntry &entry, bool write_back) {
+    nlohmann::json result{{"os-target", entry.path}};
+    if (entry.result.error) {
+        result["format-status"] = error_status(entry.result.content);
+        result["format-error"] = entry.result.content;
+    } else if (write_back) {
+        result["format-status"] = "success";
+        result["written"] = entry.result.changed;
+    } else {
+        result["format-status"] = "success";
+        result["changed"] = entry.result.changed;
+        if (entry.result.changed) {
+            result["formatted-content"] = entry.result.content;
+        }
+    }
+    return result;
+}
+
+// Called with each file of a tree request as it is done: the `user_data`
+// given along, and the file's result as JSON, valid only during the call.
+using tree_callback = void (*)(uint64_t user_data, uint64_t ptr, uint64_t len);
+
+// A tree request `{"root": dir, "extensions": [...], "write-back": bool,
+// "threads": N}` formats every file below `root` with one of `extensions` on
+// `threads` workers (see `worker_threads`), walking the tree as
+// well. Each file's result is like that of an "os-target" request, plus its
+// "os-target"; the formatted content is only there if it changed. The results
+// are passed to `callback` as they come if one is given, and are collected
+// into "results" otherwise; either way the reply counts what was done.
+static nlohmann::json foro_main_tree_with_json(const nlohmann::json &input,
+                                               tree_callback callback,
+                                               uint64_t user_data) {
+    if (!input.is_object() || !input.contains("root") ||
+        !input["root"].is_string()) {
+        return nlohmann::json{
+            {"plugin-panic", "Missing or invalid 'root' field"}};
+    }
+    if (!input.contains("extensions") || !input["extensions"].is_array()) {
+        return nlohmann::json{
+            {"plugin-panic", "Missing or invalid 'extensions' field"}};
+    }
+    std::vector<std::string> extensions;
+    for (const nlohmann::json &extension : input["extensions"]) {
+        if (!extension.is_string()) {
+            return nlohmann::json{
+                {"plugin-panic", "Invalid 'extensions' field"}};
+        }
+        extensions.push_back(extension.get<std::string>());
+    }
+
+    bool write_back = false;
+    if (input.contains("write-back")) {
+        if (!input["write-back"].is_boolean()) {
+            return nlohmann::json{
+                {"plugin-panic", "Invalid 'write-back' field"}};
+        }
+        write_back = input["write-back"].get<bool>();
+    }
+
+    uint64_t requested = 0;
+    if (input.contains("threads")) {
+        if (!input["threads"].is_number_unsigned()) {
+            return nlohmann::json{{"plugin-panic", "Invalid 'threads' field"}};
+        }
+        requested = input["threads"].get<uint64_t>();
+    }
+    const unsigned threads = worker_threads(requested);
+
+    nlohmann::json results = nlohmann::json::array();
+    const TreeResult tree = format_tree(
+        run_on_workers, threads, input["root"].get_ref<const std::string &>(),
+        extensions, defaultFormatStyle(), write_back,
+        [&](const TreeEntry &entry) {
+            nlohmann::json result = file_entry_json(entry, write_back);
+            if (!callback) {
+                results.push_back(std::move(result));
+                return;
+            }
+            const std::string bytes = result.dump();
+            callback(user_data, (uint64_t)bytes.data(), bytes.size());
+        });
+
+    if (tree.error) {
+        return nlohmann::json{{"format-status", "error"},
+                              {"format-error", tree.message}};
+    }
+
+    nlohmann::json reply{{"format-status", "success"},
+                         {"directories", tree.directories},
+                         {"pruned-directories", tree.pruned},
+                         {"files", tree.files},
+                         {"changed", tree.changed},
+                         {"ignored", tree.ignored},
+                         {"errors", tree.errors}};
+    if (!callback) {
+        reply["results"] = std::move(results);
+    }
+    return reply;
+}
+
+// Reads the "lines" of a file of a diff request, an array of `[first, last]`
+// pairs of 1-based line numbers. Returns false if they are malformed.
+static bool read_line_pairs(const nlohmann::json &input,
+                            std::vector<unsigned> &lines) {
+    if (!input.is_array()) {
+        return false;
+    }
+    for (const nlohmann::json &pair : input) {
+        if (!pair.is_array() || pair.size() != 2 ||
+            !pair[0].is_number_unsigned() || !pair[1].is_number_unsigned()) {
+            return false;
+        }
+        lines.push_back(pair[0].get<unsigned>());
+        lines.push_back(pair[1].get<unsigned>());
+    }
+    return true;
+}
+
+// A diff request formats only the lines a change touched, in every file it
+// touched. It is either `{"diff": text, "strip": N, "root": dir}`, a unified
+// diff whose `+++` paths, without their first N components (default 1, for
+// the `b/` of git), are relative to `root` unless absolute, or `{"files":
+// [{"os-target": path, "lines": [[first, last], ...]}, ...]}`. Either takes
+// "write-back" and "threads" as well, and the files are formatted on a
+// work-stealing pool like the items of a batch. The reply has "results" in
+// the order of the files, each like a file of a tree request.
+static nlohmann::json foro_main_diff_with_json(const nlohmann::json &input) {
+    if (!input.is_object()) {
+        return nlohmann::json{
+            {"plugin-panic", "Diff input must be an object"}};
+    }
+
+    std::vector<FileLines> files;
+    if (input.contains("diff")) {
+        if (!input["diff"].is_string()) {
+            return nlohmann::json{{"plugin-panic", "Invalid 'diff' field"}};
+        }
+        unsigned strip = 1;
+        if (input.contains("strip")) {
+            if (!input["strip"].is_number_unsigned()) {
+                return nlohmann::json{
+                    {"plugin-panic", "Invalid 'strip' field"}};
+            }
+            strip = input["strip"].get<unsigned>();
+        }
+        std::string root;
+        if (input.contains("root")) {
+            if (!input["root"].is_string()) {
+                return nlohmann::json{
+                    {"plugin-panic", "Invalid 'root' field"}};
+            }
+            root = input["root"].get<std::string>();
+        }
+
+        DiffResult diff = changed_lines(
+            input["diff"].get_ref<const std::string &>(), strip);
+        if (diff.error) {
+            return nlohmann::json{{"format-status", "error"},
+                                  {"format-error", std::move(diff.content)}};
+        }
+        files = std::move(diff.files);
+        if (!root.empty()) {
+            for (FileLines &file : files) {
+                if (!file.path.starts_with('/')) {
+                    file.path = root + "/" + file.path;
+                }
+            }
+        }
+    } else if (input.contains("files") && input["files"].is_array()) {
+        for (const nlohmann::json &file : input["files"]) {
+            if (!file.is_object() || !file.contains("os-target") ||
+                !file["os-target"].is_string() || !file.contains("lines") ||
+                !read_line_pairs(file["lines"], files.emplace_back().lines)) {
+                return nlohmann::json{
+                    {"plugin-panic", "Invalid 'files' field"}};
+            }
+            files.back().path = file["os-target"].get<std::string>();
+        }
+    } else {
+        return nlohmann::json{
+            {"plugin-panic", "Missing 'diff' or 'files' field"}};
+    }
+
+    bool write_back = false;
+    if (input.contains("write-back")) {
+        if (!input["write-back"].is_boolean()) {
+            return nlohmann::json{
+                {"plugin-panic", "Invalid 'write-back' field"}};
+        }
+        write_back = input["write-back"].get<bool>();
+    }
+
+    uint64_t requested = 0;
+    if (input.contains("threads")) {
+        if (!input["threads"].is_number_unsigned()) {
+            return nlohmann::json{{"plugin-panic", "Invalid 'threads' field"}};
+        }
+        requested = input["threads"].get<uint64_t>();
+    }
+    unsigned threads = worker_threads(requested);
+    if (threads > files.size()) {
+        threads = files.size();
+    }
+
+    std::vector<nlohmann::json> results(files.size());
+    auto format_one = [&](FormatContext &context, size_t i) {
+        const FileLines &file = files[i];
+        if (is_ignored(context, file.path)) {
+            results[i] = nlohmann::json{{"os-target", file.path},
+                                        {"format-status", "ignored"}};
+            return;
+        }
+        FileResult r = format_file_lines(context, file.path,
+                                         defaultFormatStyle(), file.lines,
+                                         write_back);
+        results[i] = file_entry_json({file.path, std::move(r)}, write_back);
+    };
+
+    std::atomic<size_t> next{0};
+    run_on_workers(threads, [&](FormatContext &context) {
+        for (size_t i; (i = next++) < files.size();) {
+            try {
+                format_one(context, i);
+            } catch (const std::exception &e) {
+                results[i] = nlohmann::json{
+                    {"plugin-panic", std::string("Panic: ") + e.what()}};
+            }
+        }
+    });
+
+    return nlohmann::json{{"format-status", "success"},
+                          {"results", std::move(results)}};
+}
+
+static uint8_t *json_to_array_result(const nlohmann::json &result_json) {
+    const std::string result_str = result_json.dump();
+    uint8_t *buffer = alloc_result(result_str.size());
+    std::memcpy(buffer + 8, result_str.data(), result_str.size());
+    return buffer;
+}
+
+static uint8_t *parse_error_result(const std::exception &e) {
+    nlohmann::json err_json = {
+        {"plugin-panic", std::string("JSON parse error: ") + e.what()}};
+    auto b = nlohmann::json::to_cbor(err_json);
+    return to_array_result(b);
+}
+
+static uint8_t *foro_main_dispatch(FormatContext &context, const uint8_t *data,
+                                   uint64_t len) {
+    if (binary_protocol::is_binary(data, len)) {
+        try {
+            return foro_main_binary(context, data, len);
+        } catch (const std::exception &e) {
+            return binary_result(binary_protocol::Status::Panic,
+                                 std::string("Panic: ") + e.what());
+        }
+    }
+
+    std::string input_str((const char *)data, (size_t)len);
+
+    nlohmann::json v;
+    try {
+        v = nlohmann::json::parse(input_str);
+    } catch (const std::exception &e) {
+        return parse_error_result(e);
+    }
+
+    nlohmann::json result_json = foro_main_with_json(context, v);
+
+    return json_to_array_result(result_json);
+}
+
+// Adds a whole call to the statistics, if they are on.
+static uint64_t finish_request(FormatContext &context,
+                               std::chrono::steady_clock::time_point start,
+                               uint64_t len, const uint8_t *result) {
+    record_request(context, elapsed_ns(start), len,
+                   8 + binary_protocol::read_le(result, 8));
+    return (uint64_t)result;
+}
+
+// Runs a job of `foro_submit` on a worker's own context, which stops at the
+// next stage once the job is cancelled.
+static uint8_t *run_job(const std::string &request,
+                        const std::atomic<bool> &cancelled) {
+    const uint8_t *data = (const uint8_t *)request.data();
+    FormatContext &context = thread_context();
+    const auto start = std::chrono::steady_clock::now();
+
+    set_cancel_flag(context, &cancelled);
+    uint8_t *result;
+    try {
+        result = foro_main_dispatch(context, data, request.size());
+    } catch (const std::exception &e) {
+        result = json_to_array_result(nlohmann::json{
+            {"plugin-panic", std::string("Panic: ") + e.what()}});
+    }
+    set_cancel_flag(context, nullptr);
+
+    if (stats_enabled(context)) {
+        finish_request(context, start, request.size(), result);
+    }
+    return result;
+}
+
+// Jobs of `foro_submit`, run on FORO_CLANG_FORMAT_ASYNC_THREADS workers (one
+// per hardware thread by default), started on first use.
+static JobQueue &job_queue() {
+    // Never destroyed, like the statistics registry.
+    static JobQueue *queue = [] {
+        unsigned threads = 0;
+        if (const char *t = std::getenv("FORO_CLANG_FORMAT_ASYNC_THREADS")) {
+            threads = std::strtoul(t, nullptr, 10);
+        }
+        if (threads == 0) {
+            threads = WorkStealingPool::default_threads();
+        }
+        return new JobQueue(threads, run_job, free_result);
+    }();
+    return *queue;
+}
+
+// What `foro_poll` and `foro_wait` return for `outcome`.
+static uint64_t job_result(const JobQueue::Outcome &outcome) {
+    switch (outcome.Status) {
+    case JobQueue::State::Pending:
+        return 0;
+    case JobQueue::State::Done:
+        if (outcome.Result) {
+            return (uint64_t)outcome.Result;
+        }
+        return (uint64_t)json_to_array_result(
+            nlohmann::json{{"plugin-panic", "Panic: job failed"}});
+    case JobQueue::State::Unknown:
+        break;
+    }
+    return (uint64_t)json_to_array_result(
+        nlohmann::json{{"plugin-panic", "Unknown or cancelled ticket"}});
+}
+
+// Answers a request of a ring on one of its workers, straight into the slot
+// if the result fits there.
+static uint8_t *serve_ring_request(const uint8_t *data, size_t len,
+                                   uint8_t *slot, size_t capacity) {
+    FormatContext &context = thread_context();
+    const auto start = std::chrono::steady_clock::now();
+
+    ResultTarget target{slot, capacity, false};
+    result_target = &target;
+    uint8_t *result;
+    try {
+        result = foro_main_dispatch(context, data, len);
+    } catch (const std::exception &e) {
+        result = json_to_array_result(nlohmann::json{
+            {"plugin-panic", std::string("Panic: ") + e.what()}});
+    }
+    result_target = nullptr;
+
+    if (stats_enabled(context)) {
+        finish_request(context, start, len, result);
+    }
+    return result;
+}
+
+// The socket of the daemon to hand requests to, from
+// FORO_CLANG_FORMAT_DAEMON, or nullptr to format in-process.
+static const char *daemon_socket() {
+    static const char *const socket = [] {
+        const char *path = std::getenv("FORO_CLANG_FORMAT_DAEMON");
+        return path && *path ? path : nullptr;
+    }();
+    return socket;
+}
+
+// `foro_main` without the daemon.
+static uint64_t format_here(const uint8_t *data, uint64_t len) {
+    FormatContext &context = thread_context();
+
+    if (!stats_enabled(context)) {
+        return (uint64_t)foro_main_dispatch(context, data, len);
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    return finish_request(context, start, len,
+                          foro_main_dispatch(context, data, len));
+}
+
 extern "C" {
 
+// With FORO_CLANG_FORMAT_DAEMON naming the socket of a running
+// `foro-clang-format-daemon`, requests are formatted there, with its warm
+// caches; if it can't be reached, they are formatted here as usual.
 __attribute__((visibility("default"))) uint64_t foro_main(uint64_t ptr,
                                                           uint64_t len) {
     const uint8_t *data = (const uint8_t *)ptr;
-    std::string input_str((const char *)data, (size_t)len);
+    if (const char *socket = daemon_socket()) {
+        if (uint8_t *result = daemon_client::forward(socket, data, len,
+                                                     alloc_result,
+                                                     free_result)) {
+            return (uint64_t)result;
+        }
+    }
+    return format_here(data, len);
+}
+
+// `foro_main` for a host whose working directory is the absolute path
+// `dir`: relative targets in the request are taken from there. The request
+// is always formatted in this process; the daemon serves its clients with it.
+__attribute__((visibility("default"))) uint64_t
+foro_main_in(uint64_t ptr, uint64_t len, uint64_t dir_ptr, uint64_t dir_len) {
+    const std::string dir((const char *)dir_ptr, (size_t)dir_len);
+    if (!dir.starts_with('/')) {
+        return (uint64_t)json_to_array_result(nlohmann::json{
+            {"plugin-panic", "Working directory must be absolute"}});
+    }
+
+    request_dir = &dir;
+    const RequestDirReset reset;
+    return format_here((const uint8_t *)ptr, len);
+}
+
+__attribute__((visibility("default"))) uint64_t
+foro_main_batch(uint64_t ptr, uint64_t len) {
+    const uint8_t *data = (const uint8_t *)ptr;
+    const auto start = std::chrono::steady_clock::now();
 
     nlohmann::json v;
     try {
-        v = nlohmann::json::parse(input_str);
+        v = nlohmann::json::parse(data, data + len);
     } catch (const std::exception &e) {
-        nlohmann::json err_json = {
-            {"plugin-panic", std::string("JSON parse error: ") + e.what()}};
-        auto b = nlohmann::json::to_cbor(err_json);
-        uint8_t *result_ptr = to_array_result(b);
-        return (uint64_t)result_ptr;
+        return (uint64_t)parse_error_result(e);
     }
 
-    nlohmann::json result_json = foro_main_with_json(v);
+    nlohmann::json result_json;
+    try {
+        result_json = foro_main_batch_with_json(v);
+    } catch (const std::exception &e) {
+        result_json = nlohmann::json{
+            {"plugin-panic", std::string("Panic: ") + e.what()}};
+    }
+
+    return finish_request(thread_context(), start, len,
+                          json_to_array_result(result_json));
+}
+
+__attribute__((visibility("default"))) uint64_t
+foro_main_tree(uint64_t ptr, uint64_t len, uint64_t callback,
+               uint64_t user_data) {
+    const uint8_t *data = (const uint8_t *)ptr;
+    const auto start = std::chrono::steady_clock::now();
 
-    std::string result_str = result_json.dump();
-    std::vector<uint8_t> result_vec(result_str.begin(), result_str.end());
+    nlohmann::json v;
+    try {
+        v = nlohmann::json::parse(data, data + len);
+    } catch (const std::exception &e) {
+        return (uint64_t)parse_error_result(e);
+    }
+
+    nlohmann::json result_json;
+    try {
+        result_json =
+            foro_main_tree_with_json(v, (tree_callback)callback, user_data);
+    } catch (const std::exception &e) {
+        result_json = nlohmann::json{
+            {"plugin-panic", std::string("Panic: ") + e.what()}};
+    }
+
+    return finish_request(thread_context(), start, len,
+                          json_to_array_result(result_json));
+}
+
+__attribute__((visibility("default"))) uint64_t
+foro_main_diff(uint64_t ptr, uint64_t len) {
+    const uint8_t *data = (const uint8_t *)ptr;
+    const auto start = std::chrono::steady_clock::now();
+
+    nlohmann::json v;
+    try {
+        v = nlohmann::json::parse(data, data + len);
+    } catch (const std::exception &e) {
+        return (uint64_t)parse_error_result(e);
+    }
+
+    nlohmann::json result_json;
+    try {
+        result_json = foro_main_diff_with_json(v);
+    } catch (const std::exception &e) {
+        result_json = nlohmann::json{
+            {"plugin-panic", std::string("Panic: ") + e.what()}};
+    }
+
+    return finish_request(thread_context(), start, len,
+                          json_to_array_result(result_json));
+}
+
+// Queues a `foro_main` request and returns at once with a ticket for its
+// result. The request is copied, so the host may free it right away. Unless
+// `key` is 0, unfinished jobs submitted with the same key, such as older
+// versions of the same buffer, are cancelled; finished ones can still be
+// collected.
+__attribute__((visibility("default"))) uint64_t
+foro_submit(uint64_t ptr, uint64_t len, uint64_t key) {
+    return job_queue().submit(std::string((const char *)ptr, (size_t)len),
+                              key);
+}
 
-    uint8_t *result_ptr = to_array_result(result_vec);
+// The result of the job `ticket`, as `foro_main` would have returned it, or 0
+// while it is still running. Once returned, the ticket is gone. Unknown and
+// cancelled tickets get a "plugin-panic" reply in JSON.
+__attribute__((visibility("default"))) uint64_t foro_poll(uint64_t ticket) {
+    return job_result(job_queue().poll(ticket));
+}
+
+// `foro_poll`, after waiting up to `timeout_ms` for the job to finish, or for
+// as long as it takes if `timeout_ms` is UINT64_MAX.
+__attribute__((visibility("default"))) uint64_t
+foro_wait(uint64_t ticket, uint64_t timeout_ms) {
+    std::optional<std::chrono::milliseconds> timeout;
+    if (timeout_ms != UINT64_MAX) {
+        timeout = std::chrono::milliseconds(
+            std::min<uint64_t>(timeout_ms, INT64_MAX / 1000000));
+    }
+    return job_result(job_queue().wait(ticket, timeout));
+}
+
+// Drops the job `ticket`: it doesn't start if it hasn't yet, and stops at its
+// next stage if it has. Returns 1 if it was cancelled before finishing, 0 if
+// it had finished or the ticket is unknown.
+__attribute__((visibility("default"))) uint64_t foro_cancel(uint64_t ticket) {
+    return job_queue().cancel(ticket) ? 1 : 0;
+}
+
+// The number of bytes a ring of `foro_ring_open` takes, or 0 if the sizes
+// don't make one: `slots` must be a power of two, and `request_capacity` and
+// `result_capacity` are the largest request and result, the latter without
+// its length prefix, that fit into a slot.
+__attribute__((visibility("default"))) uint64_t
+foro_ring_size(uint64_t slots, uint64_t request_capacity,
+               uint64_t result_capacity) {
+    if (slots > UINT32_MAX) {
+        return 0;
+    }
+    return RequestRing::bytes_for((uint32_t)slots, request_capacity,
+                                  result_capacity);
+}
+
+// Lays out a ring in the `size` bytes at `ptr`, aligned to 64 bytes, and
+// starts `threads` workers (one per hardware thread if 0) to serve it, each
+// with its own warm context. Returns the handle the other `foro_ring_*` calls
+// take, or 0 if the memory is too small or misaligned. The memory must stay
+// put until `foro_ring_close`.
+//
+// The host writes a `foro_main` request into a slot from `foro_ring_acquire`,
+// at `foro_ring_request`, and submits it with `foro_ring_submit`. Once
+// `foro_ring_take` returns the slot, `foro_ring_result` is its result, in
+// the form `foro_main` returns it, valid until `foro_ring_release` frees the
+// slot. No call allocates; results too large for their slot are the
+// exception, and are freed with the slot.
+__attribute__((visibility("default"))) uint64_t
+foro_ring_open(uint64_t ptr, uint64_t size, uint64_t slots,
+               uint64_t request_capacity, uint64_t result_capacity,
+               uint64_t threads) {
+    const uint64_t needed =
+        foro_ring_size(slots, request_capacity, result_capacity);
+    if (needed == 0 || size < needed || ptr % 64 != 0) {
+        return 0;
+    }
+    if (threads == 0) {
+        threads = WorkStealingPool::default_threads();
+    }
+    return (uint64_t)new RequestRing(
+        (void *)ptr, (uint32_t)slots, request_capacity, result_capacity,
+        (unsigned)std::min<uint64_t>(threads, 1024), serve_ring_request,
+        free_result);
+}
+
+// Answers what has been submitted, then stops the workers of the ring. Its
+// memory is the host's again afterwards.
+__attribute__((visibility("default"))) void foro_ring_close(uint64_t ring) {
+    delete (RequestRing *)ring;
+}
+
+// A free slot, or UINT64_MAX if every slot is in use.
+__attribute__((visibility("default"))) uint64_t
+foro_ring_acquire(uint64_t ring) {
+    return ((RequestRing *)ring)->acquire();
+}
+
+// Where the request of `slot` goes.
+__attribute__((visibility("default"))) uint64_t
+foro_ring_request(uint64_t ring, uint64_t slot) {
+    return (uint64_t)((RequestRing *)ring)->request(slot);
+}
+
+// Hands the first `len` bytes at `foro_ring_request` to the workers. `tag` is
+// the host's, to tell results apart; `foro_ring_tag` gives it back.
+__attribute__((visibility("default"))) void
+foro_ring_submit(uint64_t ring, uint64_t slot, uint64_t len, uint64_t tag) {
+    ((RequestRing *)ring)->submit(slot, len, tag);
+}
+
+// A slot whose result is ready, or UINT64_MAX if there is none. If `wait` is
+// nonzero, blocks until there is one, so at least one request must be
+// outstanding.
+__attribute__((visibility("default"))) uint64_t foro_ring_take(uint64_t ring,
+                                                               uint64_t wait) {
+    return ((RequestRing *)ring)->take(wait != 0);
+}
+
+__attribute__((visibility("default"))) uint64_t
+foro_ring_result(uint64_t ring, uint64_t slot) {
+    return (uint64_t)((RequestRing *)ring)->result(slot);
+}
+
+__attribute__((visibility("default"))) uint64_t foro_ring_tag(uint64_t ring,
+                                                              uint64_t slot) {
+    return ((RequestRing *)ring)->tag(slot);
+}
+
+// Frees a slot from `foro_ring_take`, with its result.
+__attribute__((visibility("default"))) void
+foro_ring_release(uint64_t ring, uint64_t slot) {
+    ((RequestRing *)ring)->release(slot);
+}
+
+// Tells the plugin that the host watches the config files under the
+// directories in the `len` bytes at `ptr`, absolute paths each followed by a
+// NUL, and in the directories above them, and calls `foro_config_changed`
+// whenever one may have changed. For files under those directories, the
+// config files behind a style are then only checked when it is first used
+// after such a call, instead of on every request. With `len` 0, every file is
+// checked on every request again.
+__attribute__((visibility("default"))) void foro_config_watch(uint64_t ptr,
+                                                              uint64_t len) {
+    std::vector<std::string> roots;
+    const char *data = (const char *)ptr;
+    for (size_t start = 0; start < len;) {
+        const char *end = (const char *)std::memchr(data + start, '\0',
+                                                    len - start);
+        const size_t size = end ? end - (data + start) : len - start;
+        if (size > 0 && data[start] == '/') {
+            roots.emplace_back(data + start, size);
+        }
+        start += size + 1;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(watched_roots_mutex);
+        watched_roots = std::move(roots);
+    }
+    config_epoch.fetch_add(1, std::memory_order_acq_rel);
+}
+
+// Makes every thread context drop the styles and ignore files it has cached,
+// the next time it is used.
+__attribute__((visibility("default"))) void foro_config_changed() {
+    config_epoch.fetch_add(1, std::memory_order_acq_rel);
+}
+
+// Result cache statistics of the calling thread's context, as JSON.
+__attribute__((visibility("default"))) uint64_t foro_cache_stats() {
+    return (uint64_t)json_to_array_result(
+        cache_stats_json(result_cache_stats(thread_context())));
+}
 
-    return (uint64_t)result_ptr;
+// Statistics of every context so far, as JSON: per stage the number of
+// runs, their total and longest time and a histogram of their durations, plus
+// the bytes in and out and the cache hits. Empty unless FORO_CLANG_FORMAT_STATS
+// is set.
+__attribute__((visibility("default"))) uint64_t foro_stats() {
+    nlohmann::json result = stats_json(stats_registry().total());
+    result["enabled"] = stats_enabled(thread_context());
+    result["pool-cached-bytes"] = buffer_pool::cached_bytes();
+    return (uint64_t)json_to_array_result(result);
 }
 
 } // extern "C"
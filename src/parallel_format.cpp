@@ -0,0 +1,228 @@
+#include "parallel_format.h"
+
+#include <algorithm>
+#include <atomic>
+#include <latch>
+#include <string>
+#include <vector>
+
+#include "replacements.h"
+#include "thread_pool.h"
+#include "top_level_scanner.h"
+
+using namespace llvm;
+
+namespace clang {
+namespace format {
+
+// Chunks smaller than this aren't worth a task.
+constexpr size_t MinChunkSize = 16 << 10;
+
+// Tasks per thread, to even out chunks that take longer than others.
+constexpr unsigned ChunksPerThread = 4;
+
+namespace {
+
+struct Chunk {
+    unsigned Begin; // Offsets in the code; the blank lines between two
+    unsigned End;   // chunks belong to neither.
+    tooling::Replacements Replaces;
+    std::string Formatted;
+    bool Complete = false;
+};
+
+} // namespace
+
+static auto is_blank(StringRef Line) -> bool {
+    return Line.find_first_not_of(" \t\v\f") == StringRef::npos;
+}
+
+// Start of the blank lines that end right before `Pos`, a line start.
+static auto blank_lines_before(StringRef Code, size_t Pos) -> size_t {
+    while (Pos > 0) {
+        const size_t Newline =
+            Pos > 1 ? Code.rfind('\n', Pos - 2) : StringRef::npos;
+        const size_t LineStart = Newline == StringRef::npos ? 0 : Newline + 1;
+        if (!is_blank(Code.slice(LineStart, Pos - 1)))
+            break;
+        Pos = LineStart;
+    }
+    return Pos;
+}
+
+// End of the blank lines that start at `Pos`, a line start.
+static auto blank_lines_after(StringRef Code, size_t Pos) -> size_t {
+    while (Pos < Code.size()) {
+        const size_t Newline = Code.find('\n', Pos);
+        if (Newline == StringRef::npos || !is_blank(Code.slice(Pos, Newline)))
+            break;
+        Pos = Newline + 1;
+    }
+    return Pos;
+}
+
+// The blank lines between two chunks, as `reformat` leaves them.
+static auto collapsed_gap(const FormatStyle &Style, StringRef Gap)
+    -> std::string {
+    const size_t Lines =
+        std::min<size_t>(Gap.count('\n'), Style.MaxEmptyLinesToKeep);
+    return std::string(Lines, '\n');
+}
+
+// Cuts `Code` at independent boundaries into chunks of about `Target` bytes.
+static auto cut(StringRef Code, size_t Target) -> std::vector<Chunk> {
+    const std::vector<unsigned> Boundaries = independent_boundaries(Code);
+
+    std::vector<Chunk> Chunks;
+    size_t Begin = 0;
+    for (size_t Want = Target; Want + MinChunkSize < Code.size();
+         Want += Target) {
+        auto It = std::lower_bound(Boundaries.begin(), Boundaries.end(), Want);
+        if (It == Boundaries.end())
+            break;
+
+        const size_t End = blank_lines_before(Code, *It);
+        const size_t Next = blank_lines_after(Code, *It);
+        if (End <= Begin || Next >= Code.size())
+            continue;
+        Chunks.push_back({static_cast<unsigned>(Begin),
+                          static_cast<unsigned>(End)});
+        Begin = Next;
+        Want = std::max(Want, Next);
+    }
+    if (Chunks.empty())
+        return {};
+
+    Chunks.push_back({static_cast<unsigned>(Begin),
+                      static_cast<unsigned>(Code.size())});
+    return Chunks;
+}
+
+static auto format_chunk(const FormatStyle &Style, StringRef Code,
+                         StringRef FileName, Chunk &C) -> void {
+    const StringRef Text = Code.slice(C.Begin, C.End);
+    FormattingAttemptStatus Status;
+    C.Replaces = reformat(Style, Text, {tooling::Range(0, Text.size())},
+                          FileName, &Status);
+    C.Complete = Status.FormatComplete;
+    C.Formatted = apply_replacements(Text, C.Replaces);
+}
+
+// Whether formatting the declarations on both sides of the seam between
+// `Before` and `After` together leaves them as they are.
+static auto seam_holds(const FormatStyle &Style, StringRef FileName,
+                       StringRef Before, StringRef Gap, StringRef After)
+    -> bool {
+    const std::vector<unsigned> Tail = independent_boundaries(Before);
+    const std::vector<unsigned> Head = independent_boundaries(After);
+    const size_t TailStart = blank_lines_after(Before, Tail.back());
+    const size_t HeadEnd =
+        Head.size() > 1 ? blank_lines_before(After, Head[1]) : After.size();
+
+    std::string Window = Before.substr(TailStart).str();
+    Window += Gap;
+    Window += After.substr(0, HeadEnd);
+    const tooling::Replacements Replaces = reformat(
+        Style, Window, {tooling::Range(0, Window.size())}, FileName);
+    return std::all_of(Replaces.begin(), Replaces.end(), [&](const auto &R) {
+        return R.getReplacementText() ==
+               StringRef(Window).substr(R.getOffset(), R.getLength());
+    });
+}
+
+// Every call shares one pool, so that callers that are already one per core,
+// such as the workers of a batch, don't multiply the threads.
+static auto chunk_pool() -> WorkStealingPool & {
+    static WorkStealingPool Pool(WorkStealingPool::default_threads());
+    return Pool;
+}
+
+// Runs `Task(I)` for every `I` below `Count` on the shared pool and waits for
+// those tasks, and only those, to finish.
+template <typename Fn> static auto run_all(size_t Count, Fn Task) -> void {
+    std::latch Done(Count);
+    for (size_t I = 0; I < Count; ++I) {
+        chunk_pool().submit([&, I] {
+            // Counted even if the task throws, which the pool swallows.
+            struct CountDown {
+                std::latch &L;
+                ~CountDown() { L.count_down(); }
+            } Guard{Done};
+            Task(I);
+        });
+    }
+    Done.wait();
+}
+
+auto reformat_in_chunks(const FormatStyle &Style, StringRef Code,
+                        StringRef FileName, unsigned Threads)
+    -> std::optional<tooling::Replacements> {
+    if (Threads == 0)
+        Threads = WorkStealingPool::default_threads();
+    // Each chunk would pick its own line endings and pointer alignment, and
+    // a cut could fall into a region formatting is turned off for.
+    if (Threads < 2 || Code.contains('\r') || Style.DerivePointerAlignment ||
+        Code.contains("clang-format off") || Code.contains("clang-format on")) {
+        return std::nullopt;
+    }
+
+    const size_t Target = std::max(
+        MinChunkSize, Code.size() / (size_t(Threads) * ChunksPerThread));
+    std::vector<Chunk> Chunks = cut(Code, Target);
+    if (Chunks.size() < 2)
+        return std::nullopt;
+
+    std::vector<std::string> Gaps(Chunks.size() - 1);
+    for (size_t I = 0; I + 1 < Chunks.size(); ++I) {
+        Gaps[I] = collapsed_gap(
+            Style, Code.slice(Chunks[I].End, Chunks[I + 1].Begin));
+    }
+
+    run_all(Chunks.size(),
+            [&](size_t I) { format_chunk(Style, Code, FileName, Chunks[I]); });
+
+    if (!std::all_of(Chunks.begin(), Chunks.end(),
+                     [](const Chunk &C) { return C.Complete; })) {
+        return std::nullopt;
+    }
+
+    std::atomic<bool> Holds{true};
+    run_all(Chunks.size() - 1, [&](size_t I) {
+        if (Holds.load(std::memory_order_relaxed) &&
+            !seam_holds(Style, FileName, Chunks[I].Formatted, Gaps[I],
+                        Chunks[I + 1].Formatted)) {
+            Holds.store(false, std::memory_order_relaxed);
+        }
+    });
+    if (!Holds)
+        return std::nullopt;
+
+    // Shift everything back into the coordinates of `Code`.
+    tooling::Replacements Replaces;
+    for (size_t I = 0; I < Chunks.size(); ++I) {
+        for (const tooling::Replacement &R : Chunks[I].Replaces) {
+            if (auto Err = Replaces.add(tooling::Replacement(
+                    FileName, Chunks[I].Begin + R.getOffset(), R.getLength(),
+                    R.getReplacementText()))) {
+                consumeError(std::move(Err));
+                return std::nullopt;
+            }
+        }
+
+        if (I + 1 == Chunks.size())
+            break;
+        const unsigned GapBegin = Chunks[I].End;
+        const unsigned GapLength = Chunks[I + 1].Begin - GapBegin;
+        if (Code.substr(GapBegin, GapLength) == Gaps[I])
+            continue;
+        if (auto Err = Replaces.add(
+                tooling::Replacement(FileName, GapBegin, GapLength, Gaps[I]))) {
+            consumeError(std::move(Err));
+            return std::nullopt;
+        }
+    }
+    return Replaces;
+}
+
+} // namespace format
+} // namespace clang
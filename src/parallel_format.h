@@ -0,0 +1,34 @@
+#ifndef FORO_CLANG_FORMAT_PARALLEL_FORMAT_H_
+#define FORO_CLANG_FORMAT_PARALLEL_FORMAT_H_
+
+#include <optional>
+
+#include "clang/Basic/LLVM.h"
+#include "clang/Format/Format.h"
+#include "clang/Tooling/Core/Replacement.h"
+
+namespace clang {
+namespace format {
+
+// `reformat` of all of the C-family `Code`, cut for `Threads` threads (0 for
+// one per hardware thread). The code is cut at `independent_boundaries` into
+// chunks of about equal size, which are formatted as buffers of their own;
+// the blank lines between them are collapsed the way `reformat` would. The
+// chunks of every call run on one pool with a thread per hardware thread.
+//
+// Chunks formatted on their own can differ from the whole file at the seams,
+// where alignment or blank-line rules look across declarations. So the last
+// declaration before each seam and the first one after it are formatted
+// again together, and unless that changes nothing, this gives up. It also
+// gives up when the code can't be cut or a chunk doesn't parse cleanly, and
+// right away for what chunks can't tell on their own: line endings and
+// pointer alignment derived from the whole file, and `clang-format off`
+// regions. The caller then formats the whole file as usual.
+auto reformat_in_chunks(const FormatStyle &Style, StringRef Code,
+                        StringRef FileName, unsigned Threads)
+    -> std::optional<tooling::Replacements>;
+
+} // namespace format
+} // namespace clang
+
+#endif
@@ -0,0 +1,36 @@
+#include "replacements.h"
+
+#include <algorithm>
+
+namespace clang {
+namespace format {
+
+auto formatted_size(StringRef Code, const tooling::Replacements &Replaces)
+    -> size_t {
+    size_t Size = Code.size();
+    for (const auto &R : Replaces)
+        Size = Size - R.getLength() + R.getReplacementText().size();
+    return Size;
+}
+
+auto apply_into(StringRef Code, const tooling::Replacements &Replaces,
+                char *Out) -> void {
+    size_t Pos = 0;
+    for (const auto &R : Replaces) {
+        const auto Text = R.getReplacementText();
+        Out = std::copy(Code.begin() + Pos, Code.begin() + R.getOffset(), Out);
+        Out = std::copy(Text.begin(), Text.end(), Out);
+        Pos = R.getOffset() + R.getLength();
+    }
+    std::copy(Code.begin() + Pos, Code.end(), Out);
+}
+
+auto apply_replacements(StringRef Code, const tooling::Replacements &Replaces)
+    -> std::string {
+    std::string Out(formatted_size(Code, Replaces), '\0');
+    apply_into(Code, Replaces, Out.data());
+    return Out;
+}
+
+} // namespace format
+} // namespace clang
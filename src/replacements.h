@@ -0,0 +1,29 @@
+#ifndef FORO_CLANG_FORMAT_REPLACEMENTS_H_
+#define FORO_CLANG_FORMAT_REPLACEMENTS_H_
+
+#include <string>
+
+#include "clang/Basic/LLVM.h"
+#include "clang/Tooling/Core/Replacement.h"
+
+namespace clang {
+namespace format {
+
+// Size of `Code` once `Replaces` is applied.
+auto formatted_size(StringRef Code, const tooling::Replacements &Replaces)
+    -> size_t;
+
+// `applyAllReplacements` into a caller-provided buffer of
+// `formatted_size(Code, Replaces)` bytes. `Replaces` is sorted and free of
+// overlaps, so a single forward pass splices it in.
+auto apply_into(StringRef Code, const tooling::Replacements &Replaces,
+                char *Out) -> void;
+
+// `applyAllReplacements` without the `SourceManager` and `Rewriter` it sets up.
+auto apply_replacements(StringRef Code, const tooling::Replacements &Replaces)
+    -> std::string;
+
+} // namespace format
+} // namespace clang
+
+#endif
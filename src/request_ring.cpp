@@ -0,0 +1,281 @@
+#include "request_ring.h"
+
+#include <cstring>
+#include <new>
+
+namespace {
+
+constexpr uint64_t LineSize = 64;
+constexpr uint64_t HeaderSize = 2 * LineSize;
+
+// The first line of the memory says what it holds; the second has the
+// counters the two sides wait on.
+struct Header {
+    char Magic[4];
+    uint32_t Version;
+    uint32_t Slots;
+    uint32_t Reserved;
+    uint64_t RequestCapacity;
+    uint64_t ResultCapacity;
+};
+
+constexpr char Magic[4] = {'F', 'C', 'F', 'R'};
+constexpr uint32_t Version = 1;
+
+// Times a side looks for work again before it sleeps, which costs the other
+// side a wake-up when the work comes.
+constexpr unsigned SpinLimit = 64;
+
+enum Queues : unsigned { FreeQueue, SubmittedQueue, DoneQueue, QueueCount };
+
+auto round_up(uint64_t Bytes) -> uint64_t {
+    return (Bytes + LineSize - 1) / LineSize * LineSize;
+}
+
+auto slot_size(uint64_t RequestCapacity, uint64_t ResultCapacity)
+    -> uint64_t {
+    return LineSize + round_up(RequestCapacity) + round_up(8 + ResultCapacity);
+}
+
+auto queue_size(uint32_t Slots) -> uint64_t {
+    return 2 * LineSize + round_up(uint64_t(Slots) * 16);
+}
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free &&
+              std::atomic<uint64_t>::is_always_lock_free);
+static_assert(sizeof(std::atomic<uint64_t>) == 8 && sizeof(Header) <= LineSize);
+
+} // namespace
+
+// A cell holds a slot number once its sequence is one past its position, and
+// is free for the position a lap later once it is that position plus the
+// number of cells, as in Vyukov's bounded MPMC queue.
+struct RequestRing::Queue {
+    struct Cell {
+        std::atomic<uint64_t> Sequence;
+        uint64_t Value;
+    };
+
+    alignas(LineSize) std::atomic<uint64_t> Head; // Next position to pop.
+    alignas(LineSize) std::atomic<uint64_t> Tail; // Next position to push.
+    alignas(LineSize) Cell Cells[1];              // As many as there are slots.
+};
+
+struct RequestRing::Slot {
+    uint64_t Tag;
+    uint64_t Length;
+    uint8_t *Spilled;
+};
+
+auto RequestRing::bytes_for(uint32_t Slots, uint64_t RequestCapacity,
+                            uint64_t ResultCapacity) -> uint64_t {
+    if (Slots == 0 || (Slots & (Slots - 1)) != 0 || RequestCapacity == 0 ||
+        RequestCapacity > (uint64_t(1) << 40) ||
+        ResultCapacity > (uint64_t(1) << 40)) {
+        return 0;
+    }
+    const uint64_t Size = slot_size(RequestCapacity, ResultCapacity);
+    if (Size > (uint64_t(1) << 48) / Slots)
+        return 0;
+    return HeaderSize + QueueCount * queue_size(Slots) + Slots * Size;
+}
+
+RequestRing::RequestRing(void *Memory, uint32_t Slots,
+                         uint64_t RequestCapacity, uint64_t ResultCapacity,
+                         unsigned Threads, Server Serve, Releaser Release)
+    : Memory(static_cast<uint8_t *>(Memory)), Slots(Slots),
+      RequestCapacity(RequestCapacity), ResultCapacity(ResultCapacity),
+      QueueSize(queue_size(Slots)),
+      SlotSize(slot_size(RequestCapacity, ResultCapacity)),
+      Serve(std::move(Serve)), Release(std::move(Release)) {
+    auto *H = new (this->Memory) Header{};
+    std::memcpy(H->Magic, Magic, sizeof(Magic));
+    H->Version = Version;
+    H->Slots = Slots;
+    H->RequestCapacity = RequestCapacity;
+    H->ResultCapacity = ResultCapacity;
+
+    auto *Counters = this->Memory + LineSize;
+    Stopping = new (Counters) std::atomic<uint32_t>(0);
+    Submitted = new (Counters + 4) std::atomic<uint32_t>(0);
+    Completed = new (Counters + 8) std::atomic<uint32_t>(0);
+
+    for (unsigned I = 0; I < QueueCount; ++I) {
+        auto *Q = this->Memory + HeaderSize + I * QueueSize;
+        new (Q) std::atomic<uint64_t>(0);
+        new (Q + LineSize) std::atomic<uint64_t>(0);
+        for (uint64_t C = 0; C < Slots; ++C) {
+            auto *Cell = Q + 2 * LineSize + C * sizeof(Queue::Cell);
+            new (Cell) std::atomic<uint64_t>(C);
+        }
+    }
+    for (uint64_t S = 0; S < Slots; ++S) {
+        new (&slot(S)) Slot{};
+        push(queue(FreeQueue), S);
+    }
+
+    if (Threads == 0)
+        Threads = 1;
+    for (unsigned I = 0; I < Threads; ++I)
+        Workers.emplace_back([this] { worker_loop(); });
+}
+
+RequestRing::~RequestRing() {
+    Stopping->store(1, std::memory_order_release);
+    Submitted->fetch_add(1, std::memory_order_release);
+    Submitted->notify_all();
+    for (std::thread &Worker : Workers)
+        Worker.join();
+
+    for (uint64_t S = 0; S < Slots; ++S) {
+        if (uint8_t *Spilled = slot(S).Spilled) {
+            slot(S).Spilled = nullptr;
+            Release(Spilled);
+        }
+    }
+}
+
+auto RequestRing::queue(unsigned Index) const -> Queue & {
+    return *reinterpret_cast<Queue *>(Memory + HeaderSize + Index * QueueSize);
+}
+
+auto RequestRing::slot(uint64_t Index) const -> Slot & {
+    return *reinterpret_cast<Slot *>(Memory + HeaderSize +
+                                     QueueCount * QueueSize +
+                                     Index * SlotSize);
+}
+
+auto RequestRing::request(uint64_t Index) -> uint8_t * {
+    return reinterpret_cast<uint8_t *>(&slot(Index)) + LineSize;
+}
+
+auto RequestRing::result_area(uint64_t Index) const -> uint8_t * {
+    return reinterpret_cast<uint8_t *>(&slot(Index)) + LineSize +
+           round_up(RequestCapacity);
+}
+
+auto RequestRing::push(Queue &Q, uint64_t Value) -> void {
+    const uint64_t Mask = Slots - 1;
+    uint64_t Position = Q.Tail.load(std::memory_order_relaxed);
+    for (;;) {
+        Queue::Cell &C = Q.Cells[Position & Mask];
+        const uint64_t Sequence = C.Sequence.load(std::memory_order_acquire);
+        const int64_t Lag = int64_t(Sequence - Position);
+        if (Lag == 0) {
+            if (Q.Tail.compare_exchange_weak(Position, Position + 1,
+                                             std::memory_order_relaxed)) {
+                C.Value = Value;
+                C.Sequence.store(Position + 1, std::memory_order_release);
+                return;
+            }
+        } else {
+            // A slot is only ever in one queue, so a queue has room for it;
+            // the cell is being popped and is about to come free.
+            Position = Q.Tail.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+auto RequestRing::pop(Queue &Q) -> uint64_t {
+    const uint64_t Mask = Slots - 1;
+    uint64_t Position = Q.Head.load(std::memory_order_relaxed);
+    for (;;) {
+        Queue::Cell &C = Q.Cells[Position & Mask];
+        const uint64_t Sequence = C.Sequence.load(std::memory_order_acquire);
+        const int64_t Lag = int64_t(Sequence - (Position + 1));
+        if (Lag == 0) {
+            if (Q.Head.compare_exchange_weak(Position, Position + 1,
+                                             std::memory_order_relaxed)) {
+                const uint64_t Value = C.Value;
+                C.Sequence.store(Position + Mask + 1,
+                                 std::memory_order_release);
+                return Value;
+            }
+        } else if (Lag < 0) {
+            return None;
+        } else {
+            Position = Q.Head.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+auto RequestRing::acquire() -> uint64_t { return pop(queue(FreeQueue)); }
+
+auto RequestRing::submit(uint64_t Index, uint64_t Length, uint64_t Tag)
+    -> void {
+    Slot &S = slot(Index);
+    S.Tag = Tag;
+    S.Length = Length < RequestCapacity ? Length : RequestCapacity;
+    push(queue(SubmittedQueue), Index);
+    Submitted->fetch_add(1, std::memory_order_release);
+    Submitted->notify_one();
+}
+
+auto RequestRing::take(bool Wait) -> uint64_t {
+    for (unsigned Spins = 0;; ++Spins) {
+        const uint32_t Seen = Completed->load(std::memory_order_acquire);
+        const uint64_t Index = pop(queue(DoneQueue));
+        if (Index != None || !Wait)
+            return Index;
+        if (Spins < SpinLimit)
+            std::this_thread::yield();
+        else
+            Completed->wait(Seen, std::memory_order_acquire);
+    }
+}
+
+auto RequestRing::result(uint64_t Index) const -> const uint8_t * {
+    if (const uint8_t *Spilled = slot(Index).Spilled)
+        return Spilled;
+    return result_area(Index);
+}
+
+auto RequestRing::tag(uint64_t Index) const -> uint64_t {
+    return slot(Index).Tag;
+}
+
+auto RequestRing::release(uint64_t Index) -> void {
+    Slot &S = slot(Index);
+    if (S.Spilled) {
+        Release(S.Spilled);
+        S.Spilled = nullptr;
+    }
+    push(queue(FreeQueue), Index);
+}
+
+auto RequestRing::next() -> uint64_t {
+    for (unsigned Spins = 0;; ++Spins) {
+        const uint32_t Seen = Submitted->load(std::memory_order_acquire);
+        const uint64_t Index = pop(queue(SubmittedQueue));
+        if (Index != None)
+            return Index;
+        if (Stopping->load(std::memory_order_acquire))
+            return None;
+        if (Spins < SpinLimit)
+            std::this_thread::yield();
+        else
+            Submitted->wait(Seen, std::memory_order_acquire);
+    }
+}
+
+auto RequestRing::worker_loop() -> void {
+    for (uint64_t Index; (Index = next()) != None;) {
+        Slot &S = slot(Index);
+        uint8_t *Area = result_area(Index);
+        uint8_t *Result = nullptr;
+        try {
+            Result = Serve(request(Index), S.Length, Area, 8 + ResultCapacity);
+        } catch (...) {
+            // Answered with an empty result below.
+        }
+        if (!Result) {
+            std::memset(Area, 0, 8);
+        } else if (Result != Area) {
+            S.Spilled = Result;
+        }
+
+        push(queue(DoneQueue), Index);
+        Completed->fetch_add(1, std::memory_order_release);
+        Completed->notify_all();
+    }
+}
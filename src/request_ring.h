@@ -0,0 +1,118 @@
+#ifndef FORO_CLANG_FORMAT_REQUEST_RING_H_
+#define FORO_CLANG_FORMAT_REQUEST_RING_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <vector>
+
+// A transport for hosts that send requests at a high rate: a block of memory
+// the host provides, split into a fixed number of slots, each with room for a
+// request and for its result. The host writes a request into a free slot in
+// place and submits the slot; a worker of the ring formats it and writes the
+// result into the same slot; the host takes the slot back, reads the result
+// and frees the slot. No message is allocated by either side, and nothing
+// crosses the boundary but slot numbers.
+//
+// Slots move between three queues, the free, submitted and done queues: each
+// a bounded lock-free MPMC queue of slot numbers with as many cells as there
+// are slots, so that pushing to one never fails. Any number of host threads
+// may acquire, submit, take and release at the same time.
+//
+// The memory holds only offsets and fixed-size atomics in native byte order;
+// its layout, after a 128-byte header, is the three queues (each a 64-byte
+// head, a 64-byte tail and 16 bytes per slot) followed by the slots. A slot is
+// a 64-byte header (the tag, the request length and the spilled result), then
+// the request area, then the result area, each padded to 64 bytes.
+//
+// A result takes the form `foro_main` gives it, a u64 length followed by that
+// many bytes. One too large for its slot is handed over as it was allocated,
+// a spilled result, which the ring releases when the slot is freed.
+class RequestRing {
+  public:
+    // Answers the request of a slot. Returns `Result` once it has written the
+    // result there, within `Capacity` bytes, or else a result allocated
+    // elsewhere, for the ring to pass on and release.
+    using Server = std::function<uint8_t *(
+        const uint8_t *Request, size_t Length, uint8_t *Result,
+        size_t Capacity)>;
+    using Releaser = std::function<void(uint8_t *Result)>;
+
+    // Bytes of memory for a ring of `Slots` slots, a power of two, whose
+    // requests and results take up to `RequestCapacity` and `ResultCapacity`
+    // bytes, the latter without the length prefix. 0 if the sizes are
+    // invalid.
+    static auto bytes_for(uint32_t Slots, uint64_t RequestCapacity,
+                          uint64_t ResultCapacity) -> uint64_t;
+
+    // Lays out a ring in `Memory`, which is aligned to 64 bytes and has
+    // `bytes_for` bytes, with every slot free, and starts `Threads` workers
+    // to serve it.
+    RequestRing(void *Memory, uint32_t Slots, uint64_t RequestCapacity,
+                uint64_t ResultCapacity, unsigned Threads, Server Serve,
+                Releaser Release);
+
+    // Serves what has been submitted, stops the workers and releases the
+    // spilled results that were never freed. Results still in the slots stay
+    // readable until the memory goes.
+    ~RequestRing();
+
+    RequestRing(const RequestRing &) = delete;
+    RequestRing &operator=(const RequestRing &) = delete;
+
+    static constexpr uint64_t None = UINT64_MAX;
+
+    // Host side. `acquire` returns a free slot, or `None` if every slot is in
+    // use; its request goes into `request`, up to `RequestCapacity` bytes.
+    auto acquire() -> uint64_t;
+    auto request(uint64_t Slot) -> uint8_t *;
+    // Hands the first `Length` bytes of the slot's request to the workers.
+    // `Tag` is the host's own, for it to tell the results apart.
+    auto submit(uint64_t Slot, uint64_t Length, uint64_t Tag) -> void;
+    // Returns a slot whose result is ready, or `None` if there is none. With
+    // `Wait`, blocks until one is ready instead, which had better be certain.
+    auto take(bool Wait) -> uint64_t;
+    auto result(uint64_t Slot) const -> const uint8_t *;
+    auto tag(uint64_t Slot) const -> uint64_t;
+    // Frees a slot taken back with `take`.
+    auto release(uint64_t Slot) -> void;
+
+    auto slots() const -> uint32_t { return Slots; }
+    auto request_capacity() const -> uint64_t { return RequestCapacity; }
+
+  private:
+    struct Queue;
+    struct Slot;
+
+    auto queue(unsigned Index) const -> Queue &;
+    auto slot(uint64_t Index) const -> Slot &;
+    auto result_area(uint64_t Index) const -> uint8_t *;
+
+    auto push(Queue &Q, uint64_t Value) -> void;
+    auto pop(Queue &Q) -> uint64_t;
+
+    auto worker_loop() -> void;
+    // Next submitted slot for a worker, or `None` once the ring is stopping
+    // and nothing is left.
+    auto next() -> uint64_t;
+
+    uint8_t *Memory;
+    uint32_t Slots;
+    uint64_t RequestCapacity;
+    uint64_t ResultCapacity;
+    uint64_t QueueSize; // Bytes per queue.
+    uint64_t SlotSize;  // Bytes per slot.
+
+    Server Serve;
+    Releaser Release;
+
+    std::atomic<uint32_t> *Stopping;
+    std::atomic<uint32_t> *Submitted; // Bumped by `submit`, to wake workers.
+    std::atomic<uint32_t> *Completed; // Bumped by workers, to wake `take`.
+
+    std::vector<std::thread> Workers;
+};
+
+#endif
@@ -0,0 +1,172 @@
+#include "result_cache.h"
+
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
+
+using namespace llvm;
+
+namespace clang {
+namespace format {
+
+// Entries on disk start with one of these, followed by the formatted code for
+// `Formatted`.
+constexpr char UnchangedTag = 'U';
+constexpr char FormattedTag = 'F';
+
+static auto raw(const ResultCache::Key &K) -> StringRef {
+    static_assert(sizeof(ResultCache::Key) == 4 * sizeof(uint64_t));
+    return {reinterpret_cast<const char *>(&K), sizeof(K)};
+}
+
+static auto cost(const std::string &Key, const std::string &Formatted)
+    -> size_t {
+    return 64 + Key.size() + Formatted.size(); // Rough list and map overhead.
+}
+
+auto ResultCache::key(StringRef Code, uint64_t Settings) -> Key {
+    Key K;
+    K.Hash[0] = xxh3_64bits(arrayRefFromStringRef(Code));
+    K.Hash[1] = xxHash64(Code);
+    K.Size = Code.size();
+    K.Settings = Settings;
+    return K;
+}
+
+auto ResultCache::file_for(StringRef Key) const -> std::string {
+    const std::string Hex = toHex(Key, /*LowerCase=*/true);
+    SmallString<128> Path(Directory);
+    sys::path::append(Path, StringRef(Hex).take_front(2),
+                      StringRef(Hex).drop_front(2));
+    return Path.str().str();
+}
+
+auto ResultCache::evict(size_t Limit) -> void {
+    while (Used > Limit && !Recent.empty()) {
+        const Entry &Oldest = Recent.back();
+        Used -= cost(Oldest.Key, Oldest.Formatted);
+        Index.erase(Oldest.Key);
+        Recent.pop_back();
+    }
+}
+
+auto ResultCache::remember(std::string Key, bool Unchanged,
+                           StringRef Formatted) -> const Entry * {
+    if (auto It = Index.find(Key); It != Index.end()) {
+        Used -= cost(It->second->Key, It->second->Formatted);
+        Recent.erase(It->second);
+        Index.erase(It);
+    }
+
+    Entry E{std::move(Key), Unchanged, Unchanged ? "" : Formatted.str()};
+    const size_t Cost = cost(E.Key, E.Formatted);
+    if (Cost > Capacity)
+        return nullptr;
+
+    evict(Capacity - Cost);
+    Recent.push_front(std::move(E));
+    Index[Recent.front().Key] = Recent.begin();
+    Used += Cost;
+    return &Recent.front();
+}
+
+auto ResultCache::lookup(const Key &K) -> std::optional<Found> {
+    const StringRef Raw = raw(K);
+
+    if (auto It = Index.find(Raw); It != Index.end()) {
+        Recent.splice(Recent.begin(), Recent, It->second);
+        ++Counters.Hits;
+        return Found{It->second->Unchanged, It->second->Formatted};
+    }
+
+    if (!Directory.empty()) {
+        auto Buffer = MemoryBuffer::getFile(file_for(Raw), /*IsText=*/false,
+                                            /*RequiresNullTerminator=*/false);
+        if (Buffer && (*Buffer)->getBufferSize() > 0) {
+            const StringRef Data = (*Buffer)->getBuffer();
+            if (Data.front() == UnchangedTag || Data.front() == FormattedTag) {
+                ++Counters.Hits;
+                ++Counters.DiskHits;
+
+                const bool Unchanged = Data.front() == UnchangedTag;
+                if (const Entry *E =
+                        remember(Raw.str(), Unchanged, Data.drop_front())) {
+                    return Found{E->Unchanged, E->Formatted};
+                }
+                LastRead = std::move(*Buffer);
+                return Found{Unchanged, LastRead->getBuffer().drop_front()};
+            }
+        }
+    }
+
+    ++Counters.Misses;
+    return std::nullopt;
+}
+
+auto ResultCache::insert(const Key &K, StringRef Code, StringRef Formatted)
+    -> void {
+    const StringRef Raw = raw(K);
+    const bool Unchanged = Formatted == Code;
+
+    if (Capacity > 0)
+        remember(Raw.str(), Unchanged, Formatted);
+
+    if (Directory.empty())
+        return;
+
+    // The store is best effort: any failure just leaves the entry out.
+    const std::string Path = file_for(Raw);
+    if (sys::fs::exists(Path) ||
+        sys::fs::create_directories(sys::path::parent_path(Path))) {
+        return;
+    }
+
+    // Write to a temporary next to the entry and rename it into place, so
+    // readers in other processes never see a partial entry.
+    int FD;
+    SmallString<128> TempPath;
+    if (sys::fs::createUniqueFile(Path + "-%%%%%%%%.tmp", FD, TempPath))
+        return;
+
+    raw_fd_ostream OS(FD, /*shouldClose=*/true);
+    OS << (Unchanged ? UnchangedTag : FormattedTag);
+    if (!Unchanged)
+        OS << Formatted;
+    OS.close();
+
+    if (OS.has_error()) {
+        OS.clear_error();
+        sys::fs::remove(TempPath);
+        return;
+    }
+    if (sys::fs::rename(TempPath, Path))
+        sys::fs::remove(TempPath);
+}
+
+auto ResultCache::set_capacity(size_t Bytes) -> void {
+    Capacity = Bytes;
+    evict(Capacity);
+}
+
+auto ResultCache::set_directory(StringRef Dir) -> void {
+    Directory = Dir.str();
+}
+
+auto ResultCache::stats() const -> Stats {
+    Stats S = Counters;
+    S.Entries = Recent.size();
+    S.Bytes = Used;
+    return S;
+}
+
+auto ResultCache::clear() -> void {
+    Recent.clear();
+    Index.clear();
+    Used = 0;
+    LastRead.reset();
+}
+
+} // namespace format
+} // namespace clang
@@ -0,0 +1,91 @@
+#ifndef FORO_CLANG_FORMAT_RESULT_CACHE_H_
+#define FORO_CLANG_FORMAT_RESULT_CACHE_H_
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include "clang/Basic/LLVM.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+namespace clang {
+namespace format {
+
+// Remembers formatted code by content. An entry is keyed by two independent
+// 64-bit hashes and the size of the input, and by a fingerprint of everything
+// else the output depends on: the resolved style, the context's overrides and
+// the formatter version. Entries are kept in memory, least recently used
+// first out once they take more than the capacity, and, if a directory is
+// set, in one file each under it. Those files outlive the process and may be
+// shared by several of them; they are written atomically and read through
+// `mmap`.
+//
+// Inputs that format to themselves, the common case in a tree that is already
+// formatted, cost no more than their key.
+class ResultCache {
+  public:
+    struct Key {
+        uint64_t Hash[2];
+        uint64_t Size;
+        uint64_t Settings;
+    };
+
+    struct Stats {
+        uint64_t Hits = 0;
+        uint64_t DiskHits = 0; // Also counted in `Hits`.
+        uint64_t Misses = 0;
+        uint64_t Entries = 0;
+        uint64_t Bytes = 0;
+    };
+
+    struct Found {
+        bool Unchanged;      // The input formats to itself.
+        StringRef Formatted; // Otherwise; valid until the next call.
+    };
+
+    static auto key(StringRef Code, uint64_t Settings) -> Key;
+
+    auto enabled() const -> bool {
+        return Capacity > 0 || !Directory.empty();
+    }
+
+    auto lookup(const Key &K) -> std::optional<Found>;
+    auto insert(const Key &K, StringRef Code, StringRef Formatted) -> void;
+
+    auto set_capacity(size_t Bytes) -> void;
+    auto set_directory(StringRef Dir) -> void;
+    auto stats() const -> Stats;
+
+    // Drops the entries in memory; the files on disk stay.
+    auto clear() -> void;
+
+  private:
+    struct Entry {
+        std::string Key;
+        bool Unchanged;
+        std::string Formatted;
+    };
+
+    auto remember(std::string Key, bool Unchanged, StringRef Formatted)
+        -> const Entry *;
+    auto evict(size_t Limit) -> void;
+    auto file_for(StringRef Key) const -> std::string;
+
+    std::list<Entry> Recent; // Most recently used first.
+    llvm::StringMap<std::list<Entry>::iterator> Index;
+    size_t Capacity = 0;
+    size_t Used = 0;
+
+    std::string Directory;
+    std::unique_ptr<llvm::MemoryBuffer> LastRead; // Backs a disk hit.
+
+    Stats Counters;
+};
+
+} // namespace format
+} // namespace clang
+
+#endif
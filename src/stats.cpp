@@ -0,0 +1,70 @@
+#include "stats.h"
+
+#include <algorithm>
+#include <bit>
+
+namespace clang {
+namespace format {
+
+static auto load(const std::atomic<uint64_t> &C) -> uint64_t {
+    return C.load(std::memory_order_relaxed);
+}
+
+// Only the owning thread writes, so this needs no atomic read-modify-write.
+static auto add(std::atomic<uint64_t> &C, uint64_t N) -> void {
+    C.store(load(C) + N, std::memory_order_relaxed);
+}
+
+// Bucket `I` holds the runs under 2^I microseconds, see `StageStats`.
+static auto bucket(uint64_t Nanoseconds) -> unsigned {
+    const unsigned I = std::bit_width(Nanoseconds / 1000);
+    return std::min(I, stats_buckets - 1);
+}
+
+auto StatsCollector::record(Stage S, uint64_t Nanoseconds) -> void {
+    Histogram &H = Stages[static_cast<unsigned>(S)];
+    add(H.Count, 1);
+    add(H.TotalNs, Nanoseconds);
+    if (Nanoseconds > load(H.MaxNs))
+        H.MaxNs.store(Nanoseconds, std::memory_order_relaxed);
+    add(H.Buckets[bucket(Nanoseconds)], 1);
+}
+
+auto StatsCollector::add_bytes(uint64_t In, uint64_t Out) -> void {
+    add(BytesIn, In);
+    add(BytesOut, Out);
+}
+
+auto StatsCollector::set_style_counts(uint64_t Hits, uint64_t Misses) -> void {
+    StyleHits.store(Hits, std::memory_order_relaxed);
+    StyleMisses.store(Misses, std::memory_order_relaxed);
+}
+
+auto StatsCollector::set_result_counts(uint64_t Hits, uint64_t Misses)
+    -> void {
+    ResultHits.store(Hits, std::memory_order_relaxed);
+    ResultMisses.store(Misses, std::memory_order_relaxed);
+}
+
+auto StatsCollector::snapshot() const -> FormatStats {
+    FormatStats S{};
+    for (unsigned I = 0; I < stage_count; ++I) {
+        const Histogram &H = Stages[I];
+        StageStats &Out = S.stages[I];
+        Out.count = load(H.Count);
+        Out.total_ns = load(H.TotalNs);
+        Out.max_ns = load(H.MaxNs);
+        for (unsigned B = 0; B < stats_buckets; ++B)
+            Out.buckets[B] = load(H.Buckets[B]);
+    }
+    S.bytes_in = load(BytesIn);
+    S.bytes_out = load(BytesOut);
+    S.style_hits = load(StyleHits);
+    S.style_misses = load(StyleMisses);
+    S.result_hits = load(ResultHits);
+    S.result_misses = load(ResultMisses);
+    return S;
+}
+
+} // namespace format
+} // namespace clang
@@ -0,0 +1,85 @@
+#ifndef FORO_CLANG_FORMAT_STATS_H_
+#define FORO_CLANG_FORMAT_STATS_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "lib.h"
+
+namespace clang {
+namespace format {
+
+// Stage timings and counters of one context. Only the thread using the
+// context writes them, so updates are plain loads and stores rather than
+// read-modify-write operations; the counters are atomic only so that other
+// threads can take a `snapshot` at any time.
+class StatsCollector {
+  public:
+    auto enabled() const -> bool {
+        return Enabled.load(std::memory_order_relaxed);
+    }
+    auto set_enabled(bool On) -> void {
+        Enabled.store(On, std::memory_order_relaxed);
+    }
+
+    auto record(Stage S, uint64_t Nanoseconds) -> void;
+    auto add_bytes(uint64_t In, uint64_t Out) -> void;
+
+    // The caches count hits themselves; these mirror their current totals.
+    auto set_style_counts(uint64_t Hits, uint64_t Misses) -> void;
+    auto set_result_counts(uint64_t Hits, uint64_t Misses) -> void;
+
+    auto snapshot() const -> FormatStats;
+
+  private:
+    using Counter = std::atomic<uint64_t>;
+
+    struct Histogram {
+        Counter Count{0};
+        Counter TotalNs{0};
+        Counter MaxNs{0};
+        Counter Buckets[stats_buckets] = {};
+    };
+
+    std::atomic<bool> Enabled{false};
+    Histogram Stages[stage_count];
+    Counter BytesIn{0};
+    Counter BytesOut{0};
+    Counter StyleHits{0};
+    Counter StyleMisses{0};
+    Counter ResultHits{0};
+    Counter ResultMisses{0};
+};
+
+// Times the enclosing scope as a run of `S`, if stats are enabled.
+class StageTimer {
+  public:
+    StageTimer(StatsCollector &Stats, Stage S)
+        : Stats(Stats.enabled() ? &Stats : nullptr), S(S) {
+        if (this->Stats)
+            Start = std::chrono::steady_clock::now();
+    }
+
+    ~StageTimer() {
+        if (!Stats)
+            return;
+        const auto Elapsed =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - Start);
+        Stats->record(S, Elapsed.count());
+    }
+
+    StageTimer(const StageTimer &) = delete;
+    StageTimer &operator=(const StageTimer &) = delete;
+
+  private:
+    StatsCollector *Stats;
+    Stage S;
+    std::chrono::steady_clock::time_point Start;
+};
+
+} // namespace format
+} // namespace clang
+
+#endif
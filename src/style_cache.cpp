@@ -0,0 +1,193 @@
+#include "style_cache.h"
+
+#include <algorithm>
+
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
+
+using namespace llvm;
+
+namespace clang {
+namespace format {
+
+static auto stamp(const std::string &Path, sys::fs::file_status &Status)
+    -> bool {
+    return !sys::fs::status(Path, Status) &&
+           Status.type() == sys::fs::file_type::regular_file;
+}
+
+static auto fingerprint(const FormatStyle &Style) -> uint64_t {
+    return xxh3_64bits(arrayRefFromStringRef(configurationAsText(Style)));
+}
+
+static auto modification_time(StringRef Dir) -> sys::TimePoint<> {
+    sys::fs::file_status Status;
+    if (sys::fs::status(Dir, Status))
+        return {};
+    return Status.getLastModificationTime();
+}
+
+auto StyleCache::config_files(StringRef Dir) -> const std::vector<std::string> & {
+    if (auto It = Dirs.find(Dir); It != Dirs.end())
+        return It->second.Files;
+
+    // Taken before looking, so that a file created meanwhile makes the entry
+    // stale rather than silently incomplete.
+    const sys::TimePoint<> ModTime = modification_time(Dir);
+
+    // Same names and order `getStyle` looks for.
+    std::vector<std::string> Files;
+    for (const char *Name : {".clang-format", "_clang-format"}) {
+        SmallString<128> ConfigFile(Dir);
+        sys::path::append(ConfigFile, Name);
+        if (sys::fs::is_regular_file(ConfigFile))
+            Files.push_back(ConfigFile.str().str());
+    }
+
+    if (StringRef Parent = sys::path::parent_path(Dir);
+        !Parent.empty() && Parent != Dir) {
+        // Entries of a `StringMap` don't move on rehash, so this reference
+        // stays valid while the parent's entry is inserted.
+        const auto &Inherited = config_files(Parent);
+        Files.insert(Files.end(), Inherited.begin(), Inherited.end());
+    }
+
+    DirEntry &Listed = Dirs[Dir];
+    Listed = {std::move(Files), ModTime};
+    return Listed.Files;
+}
+
+auto StyleCache::chain_fresh(StringRef Dir) const -> bool {
+    for (;;) {
+        // A directory not listed yet is looked at once it is, but it
+        // inherits the list of its nearest listed ancestor, which must be
+        // current as well.
+        if (auto It = Dirs.find(Dir);
+            It != Dirs.end() && modification_time(Dir) != It->second.ModTime)
+            return false;
+        const StringRef Parent = sys::path::parent_path(Dir);
+        if (Parent.empty() || Parent == Dir)
+            return true;
+        Dir = Parent;
+    }
+}
+
+auto StyleCache::trusted(StringRef Path) const -> bool {
+    if (InPass)
+        return true;
+    return std::any_of(
+        TrustedRoots.begin(), TrustedRoots.end(), [&](const std::string &Root) {
+            return Path.starts_with(Root) &&
+                   (Path.size() == Root.size() || Root.ends_with("/") ||
+                    sys::path::is_separator(Path[Root.size()]));
+        });
+}
+
+auto StyleCache::get(StringRef StyleName, StringRef FileName,
+                     StringRef FallbackStyle, StringRef Code,
+                     uint64_t *Fingerprint) -> llvm::Expected<FormatStyle> {
+    auto Uncached = [&]() -> llvm::Expected<FormatStyle> {
+        ++Counters.Misses;
+        llvm::Expected<FormatStyle> Style =
+            getStyle(StyleName, FileName, FallbackStyle, Code);
+        if (Style && Fingerprint)
+            *Fingerprint = fingerprint(*Style);
+        return Style;
+    };
+
+    // Inline styles and explicit `file:<path>` styles are rare enough not to
+    // be worth tracking.
+    if (StyleName.starts_with("{") || StyleName.starts_with_insensitive("file:"))
+        return Uncached();
+
+    SmallString<128> Path(FileName);
+    if (sys::fs::make_absolute(Path))
+        return Uncached();
+
+    static const std::vector<std::string> NoFiles;
+    const bool FromFile = StyleName.equals_insensitive("file");
+    const StringRef Dir = sys::path::parent_path(Path);
+    const bool Trusted = trusted(Path);
+    // A config file may have been created in the chain since it was listed,
+    // or in an ancestor that a newly seen directory would inherit from.
+    if (FromFile && !Trusted && !chain_fresh(Dir))
+        Dirs.clear();
+    const auto &Files = FromFile ? config_files(Dir) : NoFiles;
+
+    std::string Key;
+    raw_string_ostream OS(Key);
+    OS << (Files.empty() ? "" : Files.front()) << '\0' << StyleName << '\0'
+       << FallbackStyle << '\0'
+       << static_cast<int>(guessLanguage(FileName, Code));
+    OS.flush();
+
+    sys::fs::file_status Status;
+
+    if (auto It = Styles.find(Key); It != Styles.end()) {
+        bool Fresh = true;
+        if (!Trusted || It->second.CheckedIn != Pass) {
+            for (const auto &Source : It->second.Sources) {
+                if (!stamp(Source.Path, Status)) {
+                    // A config file went away; the directory chains that list
+                    // it are wrong as well.
+                    Dirs.clear();
+                    Styles.clear();
+                    return get(StyleName, FileName, FallbackStyle, Code,
+                               Fingerprint);
+                }
+                if (Status.getLastModificationTime() != Source.ModTime ||
+                    Status.getSize() != Source.Size) {
+                    Fresh = false;
+                    break;
+                }
+            }
+            It->second.CheckedIn = Pass;
+        }
+        if (Fresh) {
+            ++Counters.Hits;
+            if (Fingerprint) {
+                if (!It->second.Fingerprint)
+                    It->second.Fingerprint = fingerprint(It->second.Style);
+                *Fingerprint = *It->second.Fingerprint;
+            }
+            return It->second.Style;
+        }
+    }
+
+    // Stamp the files before parsing them, so that an edit racing with the
+    // parse makes the entry stale rather than silently outdated.
+    std::vector<Stamp> Sources;
+    Sources.reserve(Files.size());
+    for (const auto &File : Files) {
+        if (stamp(File, Status)) {
+            Sources.push_back(
+                {File, Status.getLastModificationTime(), Status.getSize()});
+        }
+    }
+
+    ++Counters.Misses;
+    llvm::Expected<FormatStyle> Style =
+        getStyle(StyleName, FileName, FallbackStyle, Code);
+    if (!Style)
+        return Style.takeError();
+
+    std::optional<uint64_t> Hash;
+    if (Fingerprint) {
+        Hash = fingerprint(*Style);
+        *Fingerprint = *Hash;
+    }
+
+    Styles.insert_or_assign(Key,
+                            Entry{std::move(Sources), *Style, Hash, Pass});
+    return Style;
+}
+
+auto StyleCache::clear() -> void {
+    Dirs.clear();
+    Styles.clear();
+}
+
+} // namespace format
+} // namespace clang
@@ -0,0 +1,97 @@
+#ifndef FORO_CLANG_FORMAT_STYLE_CACHE_H_
+#define FORO_CLANG_FORMAT_STYLE_CACHE_H_
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "clang/Format/Format.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Chrono.h"
+
+namespace clang {
+namespace format {
+
+// Memoizes `getStyle`. Every directory is mapped to the `.clang-format` and
+// `_clang-format` files found in it and its ancestors (nearest first), and the
+// parsed style is kept per nearest config file, style name, fallback style and
+// language. A hit costs one `stat` per config file in that chain to make sure
+// none of them changed since it was parsed, and one per directory in it, whose
+// modification time says whether a config file was created there since.
+class StyleCache {
+  public:
+    struct Stats {
+        uint64_t Hits = 0;
+        uint64_t Misses = 0; // Including styles that are never cached.
+    };
+
+    // Same contract as `getStyle(StyleName, FileName, FallbackStyle, Code)`.
+    // If `Fingerprint` is given, it receives a hash of the style's
+    // configuration, computed once per entry.
+    auto get(StringRef StyleName, StringRef FileName, StringRef FallbackStyle,
+             StringRef Code = "", uint64_t *Fingerprint = nullptr)
+        -> llvm::Expected<FormatStyle>;
+
+    auto stats() const -> Stats { return Counters; }
+
+    // Between these, an entry's config files are checked the first time it
+    // is hit and trusted after that, so that formatting a whole tree stats
+    // each config file once instead of once per file. Edits made to config
+    // files meanwhile may go unnoticed until `end_pass`.
+    auto begin_pass() -> void {
+        ++Pass;
+        InPass = true;
+    }
+    auto end_pass() -> void { InPass = false; }
+
+    // Entries for files under one of `Roots`, absolute directories whose
+    // config files the host watches, are checked the first time they are hit
+    // and trusted until `clear()`, which the host calls on changes. Other
+    // files are checked as usual.
+    auto trust_under(std::vector<std::string> Roots) -> void {
+        TrustedRoots = std::move(Roots);
+    }
+
+    auto clear() -> void;
+
+  private:
+    struct Stamp {
+        std::string Path;
+        llvm::sys::TimePoint<> ModTime;
+        uint64_t Size;
+    };
+
+    // The config files of a directory and its ancestors, and when the
+    // directory itself was last modified as they were looked for.
+    struct DirEntry {
+        std::vector<std::string> Files;
+        llvm::sys::TimePoint<> ModTime;
+    };
+
+    struct Entry {
+        std::vector<Stamp> Sources;
+        FormatStyle Style;
+        std::optional<uint64_t> Fingerprint;
+        uint64_t CheckedIn = 0; // The last pass `Sources` were checked in.
+    };
+
+    auto config_files(StringRef Dir) -> const std::vector<std::string> &;
+    // Whether no listed directory from `Dir` up has changed since
+    // `config_files` looked at it.
+    auto chain_fresh(StringRef Dir) const -> bool;
+    auto trusted(StringRef Path) const -> bool;
+
+    llvm::StringMap<DirEntry> Dirs;
+    llvm::StringMap<Entry> Styles;
+
+    Stats Counters;
+
+    uint64_t Pass{0};
+    bool InPass{false};
+    std::vector<std::string> TrustedRoots;
+};
+
+} // namespace format
+} // namespace clang
+
+#endif
@@ -0,0 +1,131 @@
+#include "thread_pool.h"
+
+namespace {
+struct WorkerIdentity {
+    const WorkStealingPool *Pool{nullptr};
+    int Index{-1};
+};
+
+thread_local WorkerIdentity CurrentWorker;
+} // namespace
+
+WorkStealingPool::WorkStealingPool(unsigned Threads) {
+    if (Threads == 0)
+        Threads = 1;
+
+    Queues.reserve(Threads);
+    for (unsigned I = 0; I < Threads; ++I)
+        Queues.push_back(std::make_unique<Queue>());
+
+    Workers.reserve(Threads);
+    for (unsigned I = 0; I < Threads; ++I)
+        Workers.emplace_back([this, I] { worker_loop(I); });
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        Stopping = true;
+    }
+    WorkAvailable.notify_all();
+    for (auto &Worker : Workers)
+        Worker.join();
+}
+
+auto WorkStealingPool::submit(std::function<void()> Task) -> void {
+    // Count the task before it becomes visible so that neither counter can
+    // drop below zero when a worker picks it up straight away.
+    unsigned Target;
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        ++Queued;
+        ++Pending;
+        const int Self = current_worker();
+        Target = Self >= 0 ? Self : NextQueue++ % Queues.size();
+    }
+
+    {
+        std::lock_guard<std::mutex> Lock(Queues[Target]->Mutex);
+        Queues[Target]->Tasks.push_back(std::move(Task));
+    }
+    WorkAvailable.notify_one();
+}
+
+auto WorkStealingPool::wait() -> void {
+    std::unique_lock<std::mutex> Lock(Mutex);
+    AllDone.wait(Lock, [this] { return Pending == 0; });
+}
+
+auto WorkStealingPool::current_worker() const -> int {
+    return CurrentWorker.Pool == this ? CurrentWorker.Index : -1;
+}
+
+auto WorkStealingPool::default_threads() -> unsigned {
+    const unsigned N = std::thread::hardware_concurrency();
+    return N == 0 ? 1 : N;
+}
+
+auto WorkStealingPool::try_take(unsigned Index, std::function<void()> &Task)
+    -> bool {
+    // Newest task from our own deque first; it is the most likely to be hot.
+    {
+        auto &Own = *Queues[Index];
+        std::lock_guard<std::mutex> Lock(Own.Mutex);
+        if (!Own.Tasks.empty()) {
+            Task = std::move(Own.Tasks.back());
+            Own.Tasks.pop_back();
+            return true;
+        }
+    }
+
+    // Otherwise steal the oldest task of another worker.
+    for (size_t Step = 1; Step < Queues.size(); ++Step) {
+        auto &Victim = *Queues[(Index + Step) % Queues.size()];
+        std::lock_guard<std::mutex> Lock(Victim.Mutex);
+        if (!Victim.Tasks.empty()) {
+            Task = std::move(Victim.Tasks.front());
+            Victim.Tasks.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+auto WorkStealingPool::worker_loop(unsigned Index) -> void {
+    CurrentWorker = {this, static_cast<int>(Index)};
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> Lock(Mutex);
+            WorkAvailable.wait(Lock, [this] { return Stopping || Queued > 0; });
+            if (Queued == 0)
+                return; // Stopping and nothing left to run.
+        }
+
+        std::function<void()> Task;
+        if (!try_take(Index, Task)) {
+            // Another worker got there first.
+            std::this_thread::yield();
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> Lock(Mutex);
+            --Queued;
+        }
+
+        try {
+            Task();
+        } catch (...) {
+        }
+
+        bool Finished;
+        {
+            std::lock_guard<std::mutex> Lock(Mutex);
+            Finished = --Pending == 0;
+        }
+        if (Finished)
+            AllDone.notify_all();
+    }
+}
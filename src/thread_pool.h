@@ -0,0 +1,66 @@
+#ifndef FORO_CLANG_FORMAT_THREAD_POOL_H_
+#define FORO_CLANG_FORMAT_THREAD_POOL_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads, each owning a deque of tasks. A worker pops
+// the newest task from its own deque and, once that is empty, steals the
+// oldest task from the others, so a few long tasks (huge generated files) do
+// not hold up everything queued behind them.
+//
+// Tasks must handle their own errors; an exception escaping a task is
+// swallowed so that the pool keeps running.
+class WorkStealingPool {
+  public:
+    explicit WorkStealingPool(unsigned Threads);
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool &) = delete;
+    WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+    // Tasks submitted from a worker of this pool go to that worker's deque,
+    // others are spread round-robin.
+    auto submit(std::function<void()> Task) -> void;
+
+    // Blocks until every submitted task, including tasks submitted by other
+    // tasks, has finished. Must not be called from one of the pool's workers.
+    auto wait() -> void;
+
+    auto size() const -> unsigned { return Workers.size(); }
+
+    // Index of the calling thread in [0, size()) if it is a worker of this
+    // pool, or -1 otherwise.
+    auto current_worker() const -> int;
+
+    // `std::thread::hardware_concurrency()`, but never 0.
+    static auto default_threads() -> unsigned;
+
+  private:
+    struct Queue {
+        std::mutex Mutex;
+        std::deque<std::function<void()>> Tasks;
+    };
+
+    auto worker_loop(unsigned Index) -> void;
+    auto try_take(unsigned Index, std::function<void()> &Task) -> bool;
+
+    std::vector<std::unique_ptr<Queue>> Queues;
+    std::vector<std::thread> Workers;
+
+    std::mutex Mutex;
+    std::condition_variable WorkAvailable;
+    std::condition_variable AllDone;
+    size_t Queued{0};  // Tasks sitting in some deque.
+    size_t Pending{0}; // Tasks submitted but not yet finished.
+    unsigned NextQueue{0};
+    bool Stopping{false};
+};
+
+#endif
@@ -0,0 +1,253 @@
+#include "top_level_scanner.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringExtras.h"
+
+using namespace llvm;
+
+namespace clang {
+namespace format {
+
+static auto is_identifier_char(char C) -> bool {
+    return isAlnum(C) || C == '_';
+}
+
+// Drops `Keyword` and the whitespace after it from `Text` if `Text` starts
+// with it as a whole word.
+static auto consume_keyword(StringRef &Text, StringRef Keyword) -> bool {
+    if (!Text.starts_with(Keyword) ||
+        (Text.size() > Keyword.size() &&
+         is_identifier_char(Text[Keyword.size()]))) {
+        return false;
+    }
+    Text = Text.drop_front(Keyword.size()).ltrim();
+    return true;
+}
+
+// Whether a `{` after `Head` opens a namespace or an `extern "C"` block, whose
+// contents are top-level as well.
+static auto opens_scope(StringRef Head) -> bool {
+    Head = Head.trim();
+    consume_keyword(Head, "export");
+    consume_keyword(Head, "inline");
+    if (consume_keyword(Head, "namespace"))
+        return true;
+
+    if (!consume_keyword(Head, "extern") || !Head.starts_with("\""))
+        return false;
+    const auto Quote = Head.find('"', 1);
+    return Quote != StringRef::npos && Head.drop_front(Quote + 1).trim().empty();
+}
+
+// The identifier that ends right before `Pos`.
+static auto identifier_before(StringRef Code, size_t Pos) -> StringRef {
+    size_t Start = Pos;
+    while (Start > 0 && is_identifier_char(Code[Start - 1]))
+        --Start;
+    return Code.slice(Start, Pos);
+}
+
+// With `Strict`, namespace and `extern "C"` bodies count as nested like any
+// other braces, and lines inside any preprocessor conditional don't qualify.
+static auto scan_boundaries(StringRef Code, bool Strict)
+    -> std::vector<unsigned> {
+    enum class In { Code, LineComment, BlockComment, String, Char, RawString };
+
+    std::vector<unsigned> Boundaries{0};
+
+    In State = In::Code;
+    std::string RawEnd;          // What closes the raw string, `)delim"`.
+    SmallVector<bool, 16> Braces; // Whether each open brace adds depth.
+    unsigned Depth = 0;          // Braces, except those of namespaces.
+    unsigned Parens = 0;         // Parentheses and brackets.
+    SmallVector<bool, 8> Branches; // Whether each open `#if` is past a branch.
+    unsigned SkippedBranches = 0;  // Number of `true` in `Branches`.
+    bool Directive = false;      // In a preprocessor directive.
+    bool LineStart = true;       // Nothing but whitespace yet on this line.
+    bool Ended = true;           // The last token ends a declaration.
+    bool Number = false;         // In a numeric literal.
+    size_t Head = StringRef::npos; // Where the current declaration starts.
+
+    const size_t Size = Code.size();
+    for (size_t I = 0; I < Size; ++I) {
+        const char C = Code[I];
+        const char Next = I + 1 < Size ? Code[I + 1] : '\0';
+
+        if (C == '\n') {
+            const bool Continued =
+                (I > 0 && Code[I - 1] == '\\') ||
+                (I > 1 && Code[I - 1] == '\r' && Code[I - 2] == '\\');
+            if (!Continued) {
+                // Ordinary literals can't span lines; recover from a stray
+                // quote at the end of the line.
+                if (State == In::LineComment || State == In::String ||
+                    State == In::Char) {
+                    State = In::Code;
+                }
+                // A directive between declarations ends one as well.
+                if (Directive && State == In::Code) {
+                    Directive = false;
+                    if (Head == StringRef::npos)
+                        Ended = true;
+                }
+            }
+            LineStart = true;
+            Number = false;
+
+            const bool Unconditional =
+                Strict ? Branches.empty() : SkippedBranches == 0;
+            if (!Continued && State == In::Code && Depth == 0 && Parens == 0 &&
+                Unconditional && Ended && I + 1 < Size) {
+                Boundaries.push_back(I + 1);
+            }
+            continue;
+        }
+
+        switch (State) {
+        case In::LineComment:
+            continue;
+        case In::BlockComment:
+            if (C == '*' && Next == '/') {
+                State = In::Code;
+                ++I;
+            }
+            continue;
+        case In::String:
+        case In::Char:
+            if (C == '\\')
+                ++I;
+            else if (C == (State == In::String ? '"' : '\''))
+                State = In::Code;
+            continue;
+        case In::RawString:
+            if (Code.substr(I).starts_with(RawEnd)) {
+                I += RawEnd.size() - 1;
+                State = In::Code;
+            }
+            continue;
+        case In::Code:
+            break;
+        }
+
+        if (isSpace(C))
+            continue;
+
+        if (C == '/' && (Next == '/' || Next == '*')) {
+            State = Next == '/' ? In::LineComment : In::BlockComment;
+            ++I;
+            continue;
+        }
+
+        if (LineStart && C == '#') {
+            LineStart = false;
+            Directive = true;
+
+            StringRef Rest = Code.substr(I + 1).ltrim(" \t");
+            const StringRef Name = Rest.take_while(is_identifier_char);
+            if (Name == "if" || Name == "ifdef" || Name == "ifndef") {
+                Branches.push_back(false);
+            } else if (Name.starts_with("el") && !Branches.empty()) {
+                if (!Branches.back()) {
+                    Branches.back() = true;
+                    ++SkippedBranches;
+                }
+            } else if (Name == "endif" && !Branches.empty()) {
+                if (Branches.back())
+                    --SkippedBranches;
+                Branches.pop_back();
+            }
+            continue;
+        }
+        LineStart = false;
+
+        if (Number && !(is_identifier_char(C) || C == '.' || C == '\'')) {
+            Number = false;
+        } else if (!Number && isDigit(C) &&
+                   (I == 0 || !is_identifier_char(Code[I - 1]))) {
+            Number = true;
+        }
+
+        if (C == '"') {
+            const StringRef Prefix = identifier_before(Code, I);
+            if (Prefix == "R" || Prefix == "uR" || Prefix == "UR" ||
+                Prefix == "LR" || Prefix == "u8R") {
+                const auto Open = Code.find('(', I + 1);
+                if (Open != StringRef::npos) {
+                    RawEnd = ")" + Code.slice(I + 1, Open).str() + "\"";
+                    State = In::RawString;
+                    I = Open;
+                }
+            } else {
+                State = In::String;
+            }
+        } else if (C == '\'' && !Number) {
+            State = In::Char;
+        }
+
+        if (Directive || SkippedBranches > 0)
+            continue;
+
+        if (Head == StringRef::npos)
+            Head = I;
+
+        switch (C) {
+        case '{': {
+            const bool Scope =
+                !Strict && Depth == 0 && opens_scope(Code.slice(Head, I));
+            Braces.push_back(!Scope);
+            if (Scope) {
+                Ended = true;
+                Head = StringRef::npos;
+            } else {
+                ++Depth;
+                Ended = false;
+            }
+            break;
+        }
+        case '}':
+            if (!Braces.empty()) {
+                if (Braces.back())
+                    --Depth;
+                Braces.pop_back();
+            }
+            if (Depth == 0) {
+                Ended = true;
+                Head = StringRef::npos;
+            }
+            break;
+        case '(':
+        case '[':
+            ++Parens;
+            Ended = false;
+            break;
+        case ')':
+        case ']':
+            if (Parens > 0)
+                --Parens;
+            Ended = false;
+            break;
+        case ';':
+            if (Depth == 0 && Parens == 0) {
+                Ended = true;
+                Head = StringRef::npos;
+            }
+            break;
+        default:
+            if (Depth == 0)
+                Ended = false;
+        }
+    }
+
+    return Boundaries;
+}
+
+auto top_level_boundaries(StringRef Code) -> std::vector<unsigned> {
+    return scan_boundaries(Code, /*Strict=*/false);
+}
+
+auto independent_boundaries(StringRef Code) -> std::vector<unsigned> {
+    return scan_boundaries(Code, /*Strict=*/true);
+}
+
+} // namespace format
+} // namespace clang
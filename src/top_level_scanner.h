@@ -0,0 +1,32 @@
+#ifndef FORO_CLANG_FORMAT_TOP_LEVEL_SCANNER_H_
+#define FORO_CLANG_FORMAT_TOP_LEVEL_SCANNER_H_
+
+#include <vector>
+
+#include "clang/Basic/LLVM.h"
+#include "llvm/ADT/StringRef.h"
+
+namespace clang {
+namespace format {
+
+// Returns the offsets of the lines of C-family `Code` that start outside any
+// top-level declaration, in increasing order and starting with 0. A line
+// qualifies if the code before it ends with a `;` or `}` at depth zero, or a
+// preprocessor directive, and it doesn't start inside a comment or a literal.
+// The bodies of namespaces and `extern "C"` blocks count as depth zero.
+//
+// This is a lexical scan and no parser: braces that only appear in the
+// `#else` or `#elif` branches of conditionals are skipped, like clang-format
+// does, and macros that expand to braces are not seen through. Callers must
+// treat the result as a hint that at worst splits a declaration.
+auto top_level_boundaries(StringRef Code) -> std::vector<unsigned>;
+
+// Like `top_level_boundaries`, but only the lines that start outside every
+// brace, namespaces included, and outside every preprocessor conditional, so
+// that the code on either side can be formatted on its own.
+auto independent_boundaries(StringRef Code) -> std::vector<unsigned>;
+
+} // namespace format
+} // namespace clang
+
+#endif
@@ -0,0 +1,231 @@
+#include "tree_walk.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+#include "ignore_index.h"
+#include "stats.h"
+#include "style_cache.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+
+using namespace llvm;
+
+namespace clang {
+namespace format {
+
+namespace {
+
+class TreeWalk {
+  public:
+    TreeWalk(const std::vector<std::string> &Extensions, StringRef Style,
+             bool WriteBack, const std::function<void(const TreeEntry &)> &Emit)
+        : Style(Style), WriteBack(WriteBack), Emit(Emit) {
+        for (StringRef Extension : Extensions)
+            this->Extensions.insert(Extension.ltrim('.'));
+    }
+
+    auto run(const WorkerRunner &Run, unsigned Threads, std::string Root)
+        -> TreeResult {
+        Jobs.push_back({std::move(Root), true});
+        Run(Threads, [this](FormatContext &Ctx) { drain(Ctx); });
+        return {false,
+                "",
+                Directories.load(),
+                Pruned.load(),
+                Files.load(),
+                Changed.load(),
+                Ignored.load(),
+                Errors.load()};
+    }
+
+  private:
+    struct Job {
+        std::string Path;
+        bool Directory{false}; // To list, or else a file to format.
+    };
+
+    // Runs jobs on `Ctx` until there are none left, nor any running that
+    // could add more. The context's config files are checked once per call.
+    auto drain(FormatContext &Ctx) -> void {
+        Ctx.Styles->begin_pass();
+        Ctx.Ignores->begin_pass();
+        struct EndPass {
+            FormatContext &Ctx;
+            ~EndPass() {
+                Ctx.Styles->end_pass();
+                Ctx.Ignores->end_pass();
+            }
+        } Guard{Ctx};
+
+        for (;;) {
+            Job J;
+            {
+                std::unique_lock<std::mutex> Lock(JobsMutex);
+                JobsChanged.wait(Lock,
+                                 [&] { return !Jobs.empty() || Active == 0; });
+                if (Jobs.empty())
+                    return;
+                // The newest first, so that the walk goes depth first.
+                J = std::move(Jobs.back());
+                Jobs.pop_back();
+                ++Active;
+            }
+
+            const JobDone Done{*this};
+            try {
+                if (J.Directory)
+                    list(Ctx, J.Path);
+                else
+                    format(Ctx, J.Path);
+            } catch (const std::exception &E) {
+                report({J.Path,
+                        {true, std::string("Panic: ") + E.what(), false}});
+            }
+        }
+    }
+
+    // Counts a job as no longer running, however it ended, and wakes the
+    // workers waiting for more once the walk is over.
+    struct JobDone {
+        TreeWalk &Walk;
+        ~JobDone() {
+            std::lock_guard<std::mutex> Lock(Walk.JobsMutex);
+            if (--Walk.Active == 0 && Walk.Jobs.empty())
+                Walk.JobsChanged.notify_all();
+        }
+    };
+
+    auto push(std::string Path, bool Directory) -> void {
+        {
+            std::lock_guard<std::mutex> Lock(JobsMutex);
+            Jobs.push_back({std::move(Path), Directory});
+        }
+        JobsChanged.notify_one();
+    }
+
+    auto wanted(StringRef Name) const -> bool {
+        const StringRef Extension = sys::path::extension(Name);
+        return !Extension.empty() &&
+               Extensions.contains(Extension.drop_front());
+    }
+
+    auto report(TreeEntry Entry) -> void {
+        if (Entry.result.error)
+            ++Errors;
+        std::lock_guard<std::mutex> Lock(EmitMutex);
+        Emit(Entry);
+    }
+
+    auto has_ignore_file(const std::string &Dir) const -> bool {
+        SmallString<128> Path(Dir);
+        sys::path::append(Path, ".clang-format-ignore");
+        return sys::fs::is_regular_file(Path);
+    }
+
+    auto list(FormatContext &Ctx, const std::string &Dir) -> void {
+        ++Directories;
+        // Every file below is ignored, but for what the ignore file of a
+        // subdirectory lets through; only such subdirectories are looked
+        // into, and the others are pruned unlisted.
+        const bool Prune = Ctx.Ignores->ignores_all_below(Dir);
+        if (Prune)
+            ++Pruned;
+
+        std::error_code EC;
+        for (sys::fs::directory_iterator It(Dir, EC, /*follow_symlinks=*/false),
+             End;
+             It != End && !EC; It.increment(EC)) {
+            const std::string &Path = It->path();
+            const StringRef Name = sys::path::filename(Path);
+
+            sys::fs::file_type Type = It->type();
+            if (Prune && Type != sys::fs::file_type::directory_file &&
+                Type != sys::fs::file_type::type_unknown) {
+                continue;
+            }
+            if (Type == sys::fs::file_type::type_unknown) {
+                // The file system didn't say; ask it.
+                sys::fs::file_status Status;
+                if (!sys::fs::status(Path, Status, /*follow=*/false))
+                    Type = Status.type();
+            }
+
+            if (Type == sys::fs::file_type::directory_file) {
+                if (Name == ".git" || Name == ".hg" || Name == ".svn")
+                    continue;
+                if (Prune && !has_ignore_file(Path)) {
+                    ++Pruned;
+                    continue;
+                }
+                push(Path, true);
+            } else if (Type == sys::fs::file_type::regular_file && !Prune &&
+                       wanted(Name)) {
+                bool Skip;
+                {
+                    StageTimer Timer(*Ctx.Stats, Stage::Ignore);
+                    Skip = Ctx.Ignores->is_ignored_file(Path);
+                }
+                if (Skip)
+                    ++Ignored;
+                else
+                    push(Path, false);
+            }
+        }
+        if (EC) {
+            report({Dir, {true, "cannot list " + Dir + ": " + EC.message(),
+                          false}});
+        }
+    }
+
+    auto format(FormatContext &Ctx, const std::string &Path) -> void {
+        FileResult Result = ::format_file(Ctx, Path, Style, WriteBack);
+        ++Files;
+        if (Result.changed)
+            ++Changed;
+        report({Path, std::move(Result)});
+    }
+
+    StringSet<> Extensions;
+    const std::string Style;
+    const bool WriteBack;
+    const std::function<void(const TreeEntry &)> &Emit;
+    std::mutex EmitMutex;
+
+    std::mutex JobsMutex;
+    std::condition_variable JobsChanged;
+    std::vector<Job> Jobs;
+    unsigned Active{0}; // Jobs being run, which may push more.
+
+    std::atomic<uint64_t> Directories{0};
+    std::atomic<uint64_t> Pruned{0};
+    std::atomic<uint64_t> Files{0};
+    std::atomic<uint64_t> Changed{0};
+    std::atomic<uint64_t> Ignored{0};
+    std::atomic<uint64_t> Errors{0};
+};
+
+} // namespace
+
+auto format_tree(const WorkerRunner &Run, unsigned Threads, StringRef Root,
+                 const std::vector<std::string> &Extensions, StringRef Style,
+                 bool WriteBack,
+                 const std::function<void(const TreeEntry &)> &Emit)
+    -> TreeResult {
+    SmallString<128> AbsRoot(Root);
+    if (std::error_code EC = sys::fs::make_absolute(AbsRoot))
+        return {true, "cannot resolve " + Root.str() + ": " + EC.message()};
+    sys::path::remove_dots(AbsRoot, /*remove_dot_dot=*/true);
+    if (!sys::fs::is_directory(AbsRoot))
+        return {true, AbsRoot.str().str() + " is not a directory"};
+
+    return TreeWalk(Extensions, Style, WriteBack, Emit)
+        .run(Run, std::max(Threads, 1u), AbsRoot.str().str());
+}
+
+} // namespace format
+} // namespace clang
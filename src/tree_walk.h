@@ -0,0 +1,26 @@
+#ifndef FORO_CLANG_FORMAT_TREE_WALK_H_
+#define FORO_CLANG_FORMAT_TREE_WALK_H_
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "lib.h"
+#include "clang/Basic/LLVM.h"
+#include "llvm/ADT/StringRef.h"
+
+namespace clang {
+namespace format {
+
+// See `::format_tree`. The walk is shared out between the workers `Run`
+// starts, each running jobs on its own context until none are left.
+auto format_tree(const WorkerRunner &Run, unsigned Threads, StringRef Root,
+                 const std::vector<std::string> &Extensions, StringRef Style,
+                 bool WriteBack,
+                 const std::function<void(const TreeEntry &)> &Emit)
+    -> TreeResult;
+
+} // namespace format
+} // namespace clang
+
+#endif
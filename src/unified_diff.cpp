@@ -0,0 +1,119 @@
+#include "unified_diff.h"
+
+#include <algorithm>
+#include <optional>
+#include <tuple>
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/Twine.h"
+
+using namespace llvm;
+
+namespace clang {
+namespace format {
+
+static auto diff_error(unsigned LineNumber, const Twine &Message)
+    -> llvm::Error {
+    return llvm::make_error<llvm::StringError>(
+        "diff line " + Twine(LineNumber) + ": " + Message,
+        llvm::inconvertibleErrorCode());
+}
+
+// Parses the `start[,count]` of one side of a hunk header.
+static auto hunk_side(StringRef &Header, char Sign, unsigned &Start,
+                      unsigned &Count) -> bool {
+    Header = Header.ltrim(' ');
+    if (!Header.consume_front(StringRef(&Sign, 1)) ||
+        Header.consumeInteger(10, Start)) {
+        return false;
+    }
+    Count = 1;
+    if (Header.consume_front(",") && Header.consumeInteger(10, Count))
+        return false;
+    return true;
+}
+
+auto changed_lines(StringRef Diff, unsigned Strip)
+    -> llvm::Expected<std::vector<FileLines>> {
+    std::vector<FileLines> Files;
+    // Index into `Files`, unless outside a file that has a new side.
+    std::optional<size_t> Current;
+    unsigned OldLeft = 0, NewLeft = 0; // Lines the current hunk has to go.
+    unsigned NewLine = 0;              // Line of the new side next up.
+
+    unsigned LineNumber = 0;
+    while (!Diff.empty()) {
+        StringRef Line;
+        std::tie(Line, Diff) = Diff.split('\n');
+        Line.consume_back("\r");
+        ++LineNumber;
+
+        if (OldLeft > 0 || NewLeft > 0) {
+            const char Kind = Line.empty() ? ' ' : Line[0];
+            if (Kind == '\\')
+                continue; // "\ No newline at end of file".
+            if (Kind == '-' && OldLeft > 0) {
+                --OldLeft;
+                continue;
+            }
+            if (Kind == ' ' && OldLeft > 0 && NewLeft > 0) {
+                --OldLeft, --NewLeft, ++NewLine;
+                continue;
+            }
+            if (Kind == '+' && NewLeft > 0) {
+                --NewLeft;
+                if (Current) {
+                    std::vector<unsigned> &Lines = Files[*Current].lines;
+                    if (!Lines.empty() && Lines.back() + 1 == NewLine)
+                        Lines.back() = NewLine;
+                    else
+                        Lines.insert(Lines.end(), {NewLine, NewLine});
+                }
+                ++NewLine;
+                continue;
+            }
+            return diff_error(LineNumber, "hunk is shorter than its header");
+        }
+
+        if (Line.consume_front("+++ ")) {
+            Current.reset();
+            // Some tools append a tab and a timestamp.
+            StringRef Path = Line.split('\t').first.rtrim(' ');
+            if (Path == "/dev/null")
+                continue;
+            for (unsigned I = 0; I < Strip; ++I) {
+                const size_t Slash = Path.find('/');
+                if (Slash == StringRef::npos) {
+                    return diff_error(LineNumber,
+                                      "cannot strip " + Twine(Strip) +
+                                          " components from " + Path);
+                }
+                Path = Path.drop_front(Slash + 1);
+            }
+
+            auto It = std::find_if(
+                Files.begin(), Files.end(),
+                [&](const FileLines &F) { return F.path == Path; });
+            Current = It - Files.begin();
+            if (It == Files.end())
+                Files.push_back({Path.str(), {}});
+        } else if (Line.consume_front("@@ ")) {
+            unsigned OldStart, NewStart;
+            if (!hunk_side(Line, '-', OldStart, OldLeft) ||
+                !hunk_side(Line, '+', NewStart, NewLeft)) {
+                return diff_error(LineNumber, "malformed hunk header");
+            }
+            NewLine = NewStart;
+        }
+        // Anything else is a header line or commentary.
+    }
+
+    if (OldLeft > 0 || NewLeft > 0)
+        return diff_error(LineNumber, "diff ends inside a hunk");
+
+    llvm::erase_if(Files, [](const FileLines &F) { return F.lines.empty(); });
+    return Files;
+}
+
+} // namespace format
+} // namespace clang
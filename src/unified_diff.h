@@ -0,0 +1,26 @@
+#ifndef FORO_CLANG_FORMAT_UNIFIED_DIFF_H_
+#define FORO_CLANG_FORMAT_UNIFIED_DIFF_H_
+
+#include <vector>
+
+#include "lib.h"
+#include "clang/Basic/LLVM.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+
+namespace clang {
+namespace format {
+
+// The lines that `Diff`, in unified format as `diff -u` or `git diff` print
+// it, adds to each file, as first and last line pairs of the new version,
+// merged where they touch. Context lines don't count, so the result is the
+// same whatever `-U` the diff was made with. Paths are those of the `+++`
+// lines with their first `Strip` components removed, like `patch -p`; files
+// the diff deletes or only removes lines from are left out.
+auto changed_lines(StringRef Diff, unsigned Strip)
+    -> llvm::Expected<std::vector<FileLines>>;
+
+} // namespace format
+} // namespace clang
+
+#endif